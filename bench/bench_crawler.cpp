@@ -0,0 +1,363 @@
+// Crawler throughput benchmark against an in-process synthetic site.
+//
+//   bench_crawler [pages] [fanout] [page_kb] [latency_ms] [error_pct] [redirect_pct] [threads] [http|https]
+//
+// A Beast server on 127.0.0.1 serves /p/<n> pages of roughly page_kb
+// kilobytes, each linking to page n+1 (so every page is reachable) and to
+// fanout-1 pseudo-random others. error_pct of the pages answer 500 and
+// links to redirect_pct of them go through /r/<n>, a 301 to /p/<n>. Every
+// response is delayed by latency_ms. Spider::crawl then walks the whole
+// graph and the run reports pages/s, bytes/s, p50/p99 fetch latency and the
+// CPU time spent by the crawler (the server's own threads are subtracted).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+#include <sys/resource.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/ec.h>
+#include "../spider/Spider.h"
+#include "../logger/Logger.h"
+
+namespace
+{
+	std::size_t pages = 2000;
+	std::size_t fanout = 10;
+	std::size_t pageBytes = 16 * 1024;
+	int latencyMs = 0;
+	unsigned errorPct = 0;
+	unsigned redirectPct = 0;
+	int threads = 8;
+	bool https = false;
+
+	std::uint64_t mix(std::uint64_t x)
+	{
+		x ^= x >> 31;
+		x *= 0x94D049BB133111EBULL;
+		x ^= x >> 29;
+		return x;
+	}
+
+	bool failing(std::size_t id) { return id != 0 && mix(id * 0x9E3779B97F4A7C15ULL) % 100 < errorPct; }
+	bool redirected(std::size_t id) { return id != 0 && mix(id * 0xBF58476D1CE4E5B9ULL) % 100 < redirectPct; }
+
+	std::string renderPage(std::size_t id)
+	{
+		static const char *words[] = {"search", "engine", "crawler", "index", "query", "document",
+																	"поиск", "ранжирование", "ссылка", "страница", "слово", "текст"};
+		std::string html = "<html><head><title>Page " + std::to_string(id) + "</title></head><body>\n";
+		for (std::size_t k = 0; k < fanout; ++k)
+		{
+			std::size_t to = k == 0 ? (id + 1) % pages : mix(id * 31 + k) % pages;
+			html += redirected(to) ? "<a href=\"/r/" : "<a href=\"/p/";
+			html += std::to_string(to) + "\">link " + std::to_string(to) + "</a>\n";
+		}
+		std::uint64_t state = id + 1;
+		html += "<p>";
+		while (html.size() < pageBytes)
+		{
+			state = mix(state + 0x9E3779B97F4A7C15ULL);
+			html += words[state % (sizeof(words) / sizeof(words[0]))];
+			html += (state >> 8) % 16 == 0 ? ".</p>\n<p>" : " ";
+		}
+		html += "</p></body></html>\n";
+		return html;
+	}
+
+	// Self-signed P-256 certificate for 127.0.0.1, valid for a day.
+	void useSelfSignedCertificate(ssl::context &ctx)
+	{
+		EVP_PKEY *key = nullptr;
+		EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+		EVP_PKEY_keygen_init(kctx);
+		EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1);
+		EVP_PKEY_keygen(kctx, &key);
+		EVP_PKEY_CTX_free(kctx);
+
+		X509 *cert = X509_new();
+		X509_set_version(cert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+		X509_set_pubkey(cert, key);
+		X509_NAME *name = X509_get_subject_name(cert);
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("127.0.0.1"), -1, -1, 0);
+		X509_set_issuer_name(cert, name);
+		X509_sign(cert, key, EVP_sha256());
+
+		SSL_CTX_use_certificate(ctx.native_handle(), cert);
+		SSL_CTX_use_PrivateKey(ctx.native_handle(), key);
+		X509_free(cert);
+		EVP_PKEY_free(key);
+	}
+
+	double threadCpuSeconds()
+	{
+		timespec ts{};
+		::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	double processCpuSeconds()
+	{
+		rusage usage{};
+		::getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	}
+
+	// Thread-per-connection server; latency injection is a plain sleep, so
+	// slow responses hold a thread, not the acceptor.
+	class SiteServer
+	{
+	public:
+		SiteServer() : acceptor_(ioc_, {net::ip::make_address("127.0.0.1"), 0}), tls_(ssl::context::tls_server)
+		{
+			if (https)
+				useSelfSignedCertificate(tls_);
+			port_ = acceptor_.local_endpoint().port();
+			thread_ = std::thread([this]
+														{ acceptLoop(); });
+		}
+
+		~SiteServer()
+		{
+			stop_ = true;
+			// A blocking accept() is not woken by close(); connect once instead.
+			beast::error_code ec;
+			tcp::socket wake(ioc_);
+			wake.connect(acceptor_.local_endpoint(), ec);
+			wake.close(ec);
+			thread_.join();
+			acceptor_.close(ec);
+			std::unique_lock<std::mutex> lk(mtx_);
+			idle_.wait(lk, [this]
+								 { return connections_ == 0; });
+		}
+
+		unsigned short port() const { return port_; }
+
+		std::atomic<std::uint64_t> requests{0};
+		std::atomic<std::uint64_t> errors{0};
+		std::atomic<std::uint64_t> redirects{0};
+		double cpuSeconds()
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			return cpu_;
+		}
+
+	private:
+		void acceptLoop()
+		{
+			while (!stop_)
+			{
+				beast::error_code ec;
+				tcp::socket socket(ioc_);
+				acceptor_.accept(socket, ec);
+				if (ec)
+					continue;
+				{
+					std::lock_guard<std::mutex> lk(mtx_);
+					++connections_;
+				}
+				std::thread([this, s = std::move(socket)]() mutable
+										{ serve(std::move(s)); })
+						.detach();
+			}
+		}
+
+		void serve(tcp::socket socket)
+		{
+			try
+			{
+				if (https)
+				{
+					beast::ssl_stream<tcp::socket> stream(std::move(socket), tls_);
+					stream.handshake(ssl::stream_base::server);
+					session(stream);
+					beast::error_code ec;
+					stream.shutdown(ec);
+				}
+				else
+				{
+					session(socket);
+					beast::error_code ec;
+					socket.shutdown(tcp::socket::shutdown_send, ec);
+				}
+			}
+			catch (const std::exception &)
+			{
+				// Client went away mid-exchange; nothing to report.
+			}
+
+			double cpu = threadCpuSeconds();
+			std::lock_guard<std::mutex> lk(mtx_);
+			cpu_ += cpu;
+			if (--connections_ == 0)
+				idle_.notify_all();
+		}
+
+		template <class Stream>
+		void session(Stream &stream)
+		{
+			beast::flat_buffer buffer;
+			for (;;)
+			{
+				http::request<http::string_body> req;
+				beast::error_code ec;
+				http::read(stream, buffer, req, ec);
+				if (ec)
+					return;
+				++requests;
+
+				if (latencyMs > 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(latencyMs));
+
+				http::response<http::string_body> res{http::status::ok, req.version()};
+				res.set(http::field::server, "bench_crawler");
+				res.keep_alive(req.keep_alive());
+
+				std::string target(req.target());
+				std::size_t id = 0;
+				bool known = target.size() > 3 && (target.compare(0, 3, "/p/") == 0 || target.compare(0, 3, "/r/") == 0);
+				if (known)
+				{
+					id = std::strtoull(target.c_str() + 3, nullptr, 10);
+					known = id < pages;
+				}
+
+				if (!known)
+				{
+					res.result(http::status::not_found);
+				}
+				else if (target[1] == 'r')
+				{
+					++redirects;
+					res.result(http::status::moved_permanently);
+					res.set(http::field::location, std::string(https ? "https" : "http") + "://127.0.0.1:" +
+																						 std::to_string(port_) + "/p/" + std::to_string(id));
+				}
+				else if (failing(id))
+				{
+					++errors;
+					res.result(http::status::internal_server_error);
+				}
+				else
+				{
+					res.set(http::field::content_type, "text/html; charset=utf-8");
+					res.body() = renderPage(id);
+				}
+				res.prepare_payload();
+				http::write(stream, res, ec);
+				if (ec || !res.keep_alive())
+					return;
+			}
+		}
+
+		net::io_context ioc_;
+		tcp::acceptor acceptor_;
+		ssl::context tls_;
+		unsigned short port_ = 0;
+		std::thread thread_;
+		std::atomic<bool> stop_{false};
+		std::mutex mtx_;
+		std::condition_variable idle_;
+		std::size_t connections_ = 0;
+		double cpu_ = 0;
+	};
+
+	double percentile(std::vector<std::int64_t> &values, double p)
+	{
+		if (values.empty())
+			return 0;
+		std::size_t k = std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()));
+		std::nth_element(values.begin(), values.begin() + k, values.end());
+		return values[k] / 1000.0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		if (argc > 1)
+			pages = std::stoul(argv[1]);
+		if (argc > 2)
+			fanout = std::max<std::size_t>(1, std::stoul(argv[2]));
+		if (argc > 3)
+			pageBytes = std::stoul(argv[3]) * 1024;
+		if (argc > 4)
+			latencyMs = std::stoi(argv[4]);
+		if (argc > 5)
+			errorPct = std::stoul(argv[5]);
+		if (argc > 6)
+			redirectPct = std::stoul(argv[6]);
+		if (argc > 7)
+			threads = std::max(1, std::stoi(argv[7]));
+	}
+	catch (const std::logic_error &)
+	{
+		std::cerr << "usage: bench_crawler [pages] [fanout] [page_kb] [latency_ms] [error_pct] [redirect_pct] [threads] "
+					 "[http|https]\n";
+		return 2;
+	}
+	if (argc > 8)
+		https = std::string(argv[8]) == "https";
+
+	std::cout << "site: " << pages << " pages, fanout " << fanout << ", ~" << pageBytes / 1024 << " KB/page, "
+						<< latencyMs << " ms latency, " << errorPct << "% errors, " << redirectPct << "% redirected, "
+						<< (https ? "https" : "http") << "; crawler: " << threads << " threads" << std::endl;
+
+	SiteServer server;
+
+	SpiderOptions options;
+	options.politenessDelayMs = 0;
+	options.verifyPeer = false;
+	options.maxDuration = std::chrono::seconds(0);
+	Spider spider(options);
+
+	std::mutex mtx;
+	std::vector<std::int64_t> latencies;
+	latencies.reserve(pages);
+
+	// The spider logs every page; keep the formatting and ring buffer cost
+	// but send the lines nowhere.
+	LogOptions logOptions;
+	logOptions.file = "/dev/null";
+	Logger::configure(logOptions);
+
+	std::string start = std::string(https ? "https" : "http") + "://127.0.0.1:" + std::to_string(server.port()) + "/p/0";
+	double cpuBefore = processCpuSeconds();
+	double serverBefore = server.cpuSeconds();
+	auto t0 = std::chrono::steady_clock::now();
+	spider.crawl(start, static_cast<int>(pages) + 1, threads, [&](const Spider::Page &page)
+							 {
+		std::lock_guard<std::mutex> lk(mtx);
+		latencies.push_back(page.fetchTime.count()); });
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	double cpu = processCpuSeconds() - cpuBefore;
+
+	auto stats = spider.transferStats();
+	double crawlerCpu = cpu - (server.cpuSeconds() - serverBefore);
+
+	std::cout << std::fixed << std::setprecision(1)
+						<< "fetched " << latencies.size() << " pages in " << wall << " s; server saw "
+						<< server.requests << " requests, " << server.errors << " errors, " << server.redirects << " redirects\n"
+						<< "throughput: " << latencies.size() / wall << " pages/s, "
+						<< stats.bytesOnWire / wall / (1024 * 1024) << " MB/s\n"
+						<< std::setprecision(2)
+						<< "fetch latency: p50 " << percentile(latencies, 0.50) << " ms, p99 "
+						<< percentile(latencies, 0.99) << " ms\n"
+						<< "crawler cpu: " << crawlerCpu << " s (" << 100 * crawlerCpu / wall << "% of one core), "
+						<< 1e6 * crawlerCpu / std::max<std::size_t>(1, latencies.size()) << " us/page" << std::endl;
+	return 0;
+}
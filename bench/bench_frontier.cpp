@@ -0,0 +1,156 @@
+// Frontier contention benchmark on a synthetic link graph.
+//
+//   bench_frontier [pages] [fanout] [max_workers]
+//
+// Workers pop a page, "extract" fanout links from it and push every link
+// through the visited check, which is the spider's hot path minus the
+// network. The old layout (one mutex over a std::queue and the visited
+// set) is compared with ShardedVisitedSet + WorkQueue at 1..max_workers.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../spider/VisitedSet.h"
+#include "../spider/WorkQueue.h"
+
+namespace
+{
+	std::size_t pages = 200000;
+	std::size_t fanout = 50;
+
+	std::string pageUrl(std::size_t id)
+	{
+		return "https://bench.local/wiki/Page_" + std::to_string(id);
+	}
+
+	std::size_t pageId(const std::string &url)
+	{
+		return std::stoul(url.substr(url.rfind('_') + 1));
+	}
+
+	std::size_t link(std::size_t from, std::size_t k)
+	{
+		std::uint64_t x = from * 0x9E3779B97F4A7C15ULL + k * 0xBF58476D1CE4E5B9ULL;
+		x ^= x >> 31;
+		x *= 0x94D049BB133111EBULL;
+		x ^= x >> 29;
+		return x % pages;
+	}
+
+	// Pending = queued + being processed; the crawl is over when it hits 0.
+	template <class Pop, class Push>
+	void runWorkers(int workers, std::atomic<std::size_t> &pending, Pop pop, Push push)
+	{
+		std::vector<std::thread> threads;
+		for (int id = 0; id < workers; ++id)
+		{
+			threads.emplace_back([&, id]
+													 {
+				CrawlTask task;
+				while (pending.load() > 0)
+				{
+					if (!pop(id, task))
+					{
+						std::this_thread::yield();
+						continue;
+					}
+					std::size_t from = pageId(task.url);
+					for (std::size_t k = 0; k < fanout; ++k)
+						push(id, CrawlTask{pageUrl(link(from, k)), task.depth + 1});
+					pending.fetch_sub(1);
+				} });
+		}
+		for (auto &t : threads)
+			t.join();
+	}
+
+	double globalLock(int workers)
+	{
+		std::mutex mtx;
+		std::queue<CrawlTask> queue;
+		VisitedSetOptions options;
+		auto visited = VisitedSet::create(options);
+		std::atomic<std::size_t> pending{1};
+		visited->insert(pageUrl(0));
+		queue.push({pageUrl(0), 1});
+
+		auto start = std::chrono::steady_clock::now();
+		runWorkers(
+				workers, pending,
+				[&](int, CrawlTask &task)
+				{
+					std::lock_guard<std::mutex> lk(mtx);
+					if (queue.empty())
+						return false;
+					task = std::move(queue.front());
+					queue.pop();
+					return true;
+				},
+				[&](int, CrawlTask task)
+				{
+					std::lock_guard<std::mutex> lk(mtx);
+					if (!visited->insert(task.url))
+						return;
+					pending.fetch_add(1);
+					queue.push(std::move(task));
+				});
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double sharded(int workers, std::uint64_t &steals)
+	{
+		WorkQueue queue(workers);
+		VisitedSetOptions options;
+		ShardedVisitedSet visited(options);
+		std::atomic<std::size_t> pending{1};
+		visited.insert(pageUrl(0));
+		queue.push(-1, {pageUrl(0), 1});
+
+		auto start = std::chrono::steady_clock::now();
+		runWorkers(
+				workers, pending,
+				[&](int id, CrawlTask &task)
+				{ return queue.tryPop(id, task); },
+				[&](int id, CrawlTask task)
+				{
+					if (!visited.insert(task.url))
+						return;
+					pending.fetch_add(1);
+					queue.push(id, std::move(task));
+				});
+		steals = queue.steals();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		pages = std::stoul(argv[1]);
+	if (argc > 2)
+		fanout = std::stoul(argv[2]);
+	int maxWorkers = argc > 3 ? std::stoi(argv[3]) : 32;
+
+	double links = static_cast<double>(pages) * fanout;
+	std::cout << pages << " pages x " << fanout << " links, " << std::thread::hardware_concurrency()
+						<< " hardware threads\n";
+	std::cout << std::setw(8) << "workers" << std::setw(18) << "global M links/s" << std::setw(18)
+						<< "sharded M links/s" << std::setw(10) << "speedup" << std::setw(12) << "steals\n";
+
+	for (int workers = 1; workers <= maxWorkers; workers *= 2)
+	{
+		double g = globalLock(workers);
+		std::uint64_t steals = 0;
+		double s = sharded(workers, steals);
+		std::cout << std::setw(8) << workers << std::fixed << std::setprecision(2)
+							<< std::setw(18) << links / g / 1e6 << std::setw(18) << links / s / 1e6
+							<< std::setw(10) << g / s << std::setw(11) << steals << "\n";
+	}
+}
@@ -0,0 +1,448 @@
+// Search server load generator.
+//
+//   bench_search generate [documents] [vocabulary] [words_per_document]
+//   bench_search run [host:port] [connections] [seconds] [queries] [k]
+//
+// generate fills the database named in config.ini with a synthetic corpus:
+// syllable words drawn with Zipf-distributed frequencies, stored with their
+// positions like crawled pages, under http://bench.local/doc/<n> URLs.
+//
+// run opens connections keep-alive connections and has each send
+// GET /api/search?q=...&k=k back to back (a closed loop) for seconds, after
+// one second of unrecorded warm-up. queries is a file with one query per
+// line, replayed in order across all connections, or "zipf" (the default)
+// for a pool of 1-3 word queries built from the words table, asked with
+// Zipf-distributed popularity so that the result cache sees realistic
+// repeats. Reports QPS, p50/p90/p99/p999 latency (to within the 12.5% of a
+// Histogram bucket), answers by status, and the server's CPU time and cache
+// hits read from its /metrics before and after the run.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include "../database/Database.h"
+#include "../metrics/Metrics.h"
+#include "../parser/Parser.h"
+#include "../vars.h"
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+namespace
+{
+	constexpr auto kWarmup = std::chrono::seconds(1);
+	constexpr std::size_t kQueryPool = 10000;
+
+	// Draws ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s.
+	class Zipf
+	{
+	public:
+		Zipf(std::size_t n, double s)
+		{
+			cdf_.reserve(n);
+			double sum = 0;
+			for (std::size_t rank = 0; rank < n; ++rank)
+				cdf_.push_back(sum += 1.0 / std::pow(static_cast<double>(rank + 1), s));
+			for (auto &c : cdf_)
+				c /= sum;
+		}
+
+		std::size_t operator()(std::mt19937_64 &rng) const
+		{
+			double u = std::uniform_real_distribution<double>(0, 1)(rng);
+			auto it = std::lower_bound(cdf_.begin(), cdf_.end(), u);
+			return std::min(static_cast<std::size_t>(it - cdf_.begin()), cdf_.size() - 1);
+		}
+
+	private:
+		std::vector<double> cdf_;
+	};
+
+	std::string connectionString()
+	{
+		IniParser parser;
+		if (!parser.load(config_path))
+			throw std::runtime_error("cannot load " + config_path);
+		return "dbname=" + parser.get("Database", "dbname") + " user=" + parser.get("Database", "user") +
+					 " password=" + parser.get("Database", "password") + " host=" + parser.get("Database", "hostname");
+	}
+
+	// Distinct words of 2-4 syllables, at least 3 letters so the tokenizer keeps them.
+	std::vector<std::string> makeVocabulary(std::size_t count, std::mt19937_64 &rng)
+	{
+		static const char *syllables[] = {"ka", "ri", "to", "men", "sa", "lo", "ve", "ni", "tra", "de",
+																			"po", "ing", "ex", "con", "str", "us", "el", "or", "bi", "ze"};
+		const std::size_t syllableCount = sizeof(syllables) / sizeof(syllables[0]);
+		std::unordered_set<std::string> seen;
+		std::vector<std::string> words;
+		words.reserve(count);
+		while (words.size() < count)
+		{
+			std::string word;
+			std::size_t parts = 2 + rng() % 3 + words.size() / 8000; // longer words once short ones run out
+			for (std::size_t i = 0; i < parts; ++i)
+				word += syllables[rng() % syllableCount];
+			if (word.size() >= 3 && word.size() <= 32 && seen.insert(word).second)
+				words.push_back(std::move(word));
+		}
+		return words;
+	}
+
+	int generate(std::size_t documents, std::size_t vocabularySize, std::size_t wordsPerDocument)
+	{
+		std::mt19937_64 rng(42);
+		auto vocabulary = makeVocabulary(vocabularySize, rng);
+		Zipf zipf(vocabulary.size(), 1.0);
+		std::uniform_int_distribution<std::size_t> length(wordsPerDocument / 2, wordsPerDocument * 3 / 2);
+
+		Database db(connectionString());
+		db.ensureSchema();
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t d = 0; d < documents; ++d)
+		{
+			std::unordered_map<std::string, int> freq;
+			std::unordered_map<std::string, std::vector<int>> positions;
+			std::size_t n = length(rng);
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				const auto &word = vocabulary[zipf(rng)];
+				++freq[word];
+				positions[word].push_back(static_cast<int>(i));
+			}
+
+			DocumentMeta meta;
+			meta.url = "http://bench.local/doc/" + std::to_string(d);
+			meta.contentHash = d + 1;
+			int docId = db.upsertDocument(meta);
+			db.insertWordFrequency(docId, freq, positions);
+
+			if ((d + 1) % 1000 == 0 || d + 1 == documents)
+			{
+				double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				std::cout << "\r" << d + 1 << " documents, " << std::fixed << std::setprecision(1)
+									<< (d + 1) / elapsed << " per second" << std::flush;
+			}
+		}
+		std::cout << "\n";
+		return 0;
+	}
+
+	// Pool of distinct queries, most popular first.
+	std::vector<std::string> zipfQueries(std::mt19937_64 &rng)
+	{
+		Database db(connectionString());
+		auto vocabulary = db.loadVocabulary();
+		if (vocabulary.empty())
+			throw std::runtime_error("the words table is empty; run bench_search generate first");
+		std::sort(vocabulary.begin(), vocabulary.end(), [](const auto &a, const auto &b)
+							{ return a.second > b.second; });
+
+		// Words as frequent in queries as in documents, but no single word so
+		// common that every query reads most of the index.
+		Zipf words(vocabulary.size(), 1.0);
+		std::size_t skip = std::min<std::size_t>(10, vocabulary.size() / 2);
+		std::unordered_set<std::string> seen;
+		std::vector<std::string> queries;
+		for (std::size_t attempt = 0; queries.size() < kQueryPool && attempt < kQueryPool * 10; ++attempt)
+		{
+			std::size_t count = 1 + (rng() % 100 >= 50) + (rng() % 100 >= 70);
+			std::string query;
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				std::size_t rank = std::min(vocabulary.size() - 1, skip + words(rng));
+				query += (i ? " " : "") + vocabulary[rank].first;
+			}
+			if (seen.insert(query).second)
+				queries.push_back(std::move(query));
+		}
+		return queries;
+	}
+
+	std::vector<std::string> logQueries(const std::string &path)
+	{
+		std::ifstream in(path);
+		if (!in)
+			throw std::runtime_error("cannot read " + path);
+		std::vector<std::string> queries;
+		std::string line;
+		while (std::getline(in, line))
+			if (!line.empty())
+				queries.push_back(line);
+		if (queries.empty())
+			throw std::runtime_error(path + " has no queries");
+		return queries;
+	}
+
+	std::string urlEncode(const std::string &s)
+	{
+		static const char hex[] = "0123456789ABCDEF";
+		std::string out;
+		for (unsigned char c : s)
+		{
+			if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+				out += static_cast<char>(c);
+			else
+			{
+				out += '%';
+				out += hex[c >> 4];
+				out += hex[c & 15];
+			}
+		}
+		return out;
+	}
+
+	// Unlabelled series of the server's /metrics; empty when it has none.
+	std::map<std::string, double> scrape(net::io_context &ioc, const tcp::endpoint &endpoint, const std::string &host)
+	{
+		std::map<std::string, double> values;
+		try
+		{
+			beast::tcp_stream stream(ioc);
+			stream.connect(endpoint);
+			http::request<http::empty_body> req{http::verb::get, "/metrics", 11};
+			req.set(http::field::host, host);
+			http::write(stream, req);
+			beast::flat_buffer buffer;
+			http::response<http::string_body> res;
+			http::read(stream, buffer, res);
+			std::istringstream body(res.body());
+			std::string line;
+			while (std::getline(body, line))
+			{
+				auto space = line.find(' ');
+				if (line.empty() || line[0] == '#' || space == std::string::npos || line.find('{') < space)
+					continue;
+				values[line.substr(0, space)] = std::strtod(line.c_str() + space + 1, nullptr);
+			}
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << "cannot read /metrics: " << e.what() << "\n";
+		}
+		return values;
+	}
+
+	struct Results
+	{
+		Histogram latency; // microseconds
+		std::atomic<std::uint64_t> ok{0};
+		std::atomic<std::uint64_t> rejected{0};		 // 429 and 503: load shedding
+		std::atomic<std::uint64_t> clientErrors{0};	 // other 4xx, e.g. queries refused as too broad
+		std::atomic<std::uint64_t> serverErrors{0};	 // other 5xx
+		std::atomic<std::uint64_t> transportErrors{0}; // connect, read or write failures
+		std::atomic<std::uint64_t> connections{0};
+	};
+
+	struct Workload
+	{
+		std::vector<std::string> queries;
+		bool replay = false;				// a query log, asked in order
+		std::optional<Zipf> popularity; // otherwise, over queries most popular first
+		std::size_t k = 10;
+		std::atomic<std::size_t> next{0};
+	};
+
+	void client(net::io_context &ioc, const tcp::endpoint &endpoint, const std::string &host, Workload &workload,
+							Results &results, std::uint64_t seed, std::chrono::steady_clock::time_point recordFrom,
+							std::chrono::steady_clock::time_point end)
+	{
+		std::mt19937_64 rng(seed);
+		std::optional<beast::tcp_stream> stream;
+		beast::flat_buffer buffer;
+
+		while (std::chrono::steady_clock::now() < end)
+		{
+			try
+			{
+				if (!stream)
+				{
+					stream.emplace(ioc);
+					stream->connect(endpoint);
+					buffer.clear();
+					results.connections.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				const auto &query = workload.replay
+																? workload.queries[workload.next.fetch_add(1, std::memory_order_relaxed) % workload.queries.size()]
+																: workload.queries[(*workload.popularity)(rng)];
+				http::request<http::empty_body> req{http::verb::get,
+																						"/api/search?q=" + urlEncode(query) + "&k=" + std::to_string(workload.k), 11};
+				req.set(http::field::host, host);
+				req.keep_alive(true);
+
+				auto t0 = std::chrono::steady_clock::now();
+				http::write(*stream, req);
+				http::response<http::string_body> res;
+				http::read(*stream, buffer, res);
+				auto t1 = std::chrono::steady_clock::now();
+
+				if (t0 >= recordFrom)
+				{
+					results.latency.record(static_cast<std::uint64_t>(
+							std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count()));
+					unsigned status = res.result_int();
+					if (status < 400)
+						results.ok.fetch_add(1, std::memory_order_relaxed);
+					else if (status == 429 || status == 503)
+						results.rejected.fetch_add(1, std::memory_order_relaxed);
+					else if (status < 500)
+						results.clientErrors.fetch_add(1, std::memory_order_relaxed);
+					else
+						results.serverErrors.fetch_add(1, std::memory_order_relaxed);
+				}
+				if (!res.keep_alive())
+					stream.reset();
+			}
+			catch (const std::exception &)
+			{
+				results.transportErrors.fetch_add(1, std::memory_order_relaxed);
+				stream.reset();
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+	}
+
+	int run(const std::string &address, std::size_t connections, int seconds, const std::string &source, std::size_t k)
+	{
+		auto colon = address.rfind(':');
+		std::string host = colon == std::string::npos ? address : address.substr(0, colon);
+		std::string port = colon == std::string::npos ? "8080" : address.substr(colon + 1);
+
+		net::io_context ioc;
+		tcp::resolver resolver(ioc);
+		tcp::endpoint endpoint = *resolver.resolve(host, port).begin();
+
+		std::mt19937_64 rng(7);
+		Workload workload;
+		workload.replay = source != "zipf";
+		workload.queries = workload.replay ? logQueries(source) : zipfQueries(rng);
+		if (!workload.replay)
+			workload.popularity.emplace(workload.queries.size(), 1.0);
+		workload.k = k;
+
+		std::cout << "server " << host << ":" << port << ", " << connections << " connections, " << seconds
+							<< " s after " << kWarmup.count() << " s warm-up, " << workload.queries.size()
+							<< (workload.replay ? " logged queries replayed from " + source : " distinct queries (zipf)")
+							<< ", k=" << k << "\n";
+
+		Results results;
+		auto start = std::chrono::steady_clock::now();
+		auto recordFrom = start + kWarmup;
+		auto end = recordFrom + std::chrono::seconds(seconds);
+
+		std::vector<std::thread> clients;
+		clients.reserve(connections);
+		for (std::size_t i = 0; i < connections; ++i)
+			clients.emplace_back(client, std::ref(ioc), std::cref(endpoint), std::cref(host), std::ref(workload),
+													 std::ref(results), rng(), recordFrom, end);
+
+		std::this_thread::sleep_until(recordFrom);
+		auto before = scrape(ioc, endpoint, host);
+		for (auto &t : clients)
+			t.join();
+		double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - recordFrom).count();
+		auto after = scrape(ioc, endpoint, host);
+
+		auto snap = results.latency.snapshot();
+		std::uint64_t answered = snap.count;
+		auto ms = [&snap](double q)
+		{ return static_cast<double>(snap.percentile(q)) / 1000.0; };
+		std::cout << std::fixed << std::setprecision(2)
+							<< "requests: " << answered << " answered, " << results.ok << " ok, " << results.rejected
+							<< " rejected (429/503), " << results.clientErrors << " other 4xx, " << results.serverErrors
+							<< " other 5xx, " << results.transportErrors << " transport errors, " << results.connections
+							<< " connections opened\n"
+							<< "throughput: " << answered / wall << " qps\n"
+							<< "latency: p50 " << ms(0.5) << " ms, p90 " << ms(0.9) << " ms, p99 " << ms(0.99) << " ms, p999 "
+							<< ms(0.999) << " ms, mean " << (answered ? snap.sum / 1000.0 / answered : 0.0) << " ms\n";
+
+		auto delta = [&](const std::string &name)
+		{ return after.count(name) && before.count(name) ? after[name] - before[name] : -1.0; };
+		double cpu = delta("process_cpu_seconds_total");
+		if (cpu >= 0)
+			std::cout << "server cpu: " << cpu << " s (" << 100.0 * cpu / wall << "% of one core), "
+								<< (answered ? cpu * 1e6 / answered : 0.0) << " us/query\n";
+		double hits = delta("search_cache_hits_total"), misses = delta("search_cache_misses_total");
+		if (hits >= 0 && misses >= 0)
+			std::cout << "server cache: " << static_cast<std::uint64_t>(hits) << " hits, " << static_cast<std::uint64_t>(misses)
+								<< " misses (" << (hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0) << "% hit rate)\n";
+		return 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::string mode = argc > 1 ? argv[1] : "run";
+	auto usage = []
+	{
+		std::cerr << "usage: bench_search generate [documents] [vocabulary] [words_per_document]\n"
+							<< "       bench_search run [host:port] [connections] [seconds] [queries|zipf] [k]\n";
+		return 2;
+	};
+	try
+	{
+		if (mode == "generate")
+		{
+			std::size_t documents = 10000, vocabulary = 50000, words = 300;
+			try
+			{
+				if (argc > 2)
+					documents = std::stoul(argv[2]);
+				if (argc > 3)
+					vocabulary = std::stoul(argv[3]);
+				if (argc > 4)
+					words = std::stoul(argv[4]);
+			}
+			catch (const std::logic_error &)
+			{
+				return usage();
+			}
+			return generate(documents, vocabulary, words);
+		}
+		if (mode == "run")
+		{
+			std::size_t connections = 32, k = 10;
+			int seconds = 10;
+			try
+			{
+				if (argc > 3)
+					connections = std::max(1ul, std::stoul(argv[3]));
+				if (argc > 4)
+					seconds = std::stoi(argv[4]);
+				if (argc > 6)
+					k = std::stoul(argv[6]);
+			}
+			catch (const std::logic_error &)
+			{
+				return usage();
+			}
+			return run(argc > 2 ? argv[2] : "127.0.0.1:8080", connections, seconds, argc > 5 ? argv[5] : "zipf", k);
+		}
+		return usage();
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << "bench_search: " << e.what() << "\n";
+		return 1;
+	}
+}
@@ -0,0 +1,211 @@
+// Search latency against the number of in-memory index shards.
+//
+//   bench_shards [documents] [words_per_document] [max_shards] [clients] [queries]
+//
+// Generates a corpus in memory (no database): words built from syllables
+// with Zipf-distributed frequencies, positions included. The same corpus
+// is loaded into a ShardedIndex of 1, 2, 4 ... max_shards shards, each time
+// with a pool of one thread per shard, and the same query mix is run
+// against each: single words, two-word ANDs and ORs, and two-word phrases,
+// with words drawn by their frequency so that common words come up as
+// often as they do in real queries.
+//
+// Reports per shard count the build time, latency percentiles of a single
+// client issuing queries back to back (what one search costs, and what the
+// fan-out is for) and the throughput of `clients` concurrent clients, where
+// the shards of one query compete with the other queries for the cores.
+// The top 10 of every query are checked against the single-shard run.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../index/ShardedIndex.h"
+#include "../query/QueryParser.h"
+
+namespace
+{
+	struct Corpus
+	{
+		std::vector<std::string> words; // by rank, most frequent first
+		std::vector<double> cdf;		// Zipf over words
+		std::size_t documents;
+		std::size_t wordsPerDocument;
+
+		Corpus(std::size_t vocabulary, std::size_t documents, std::size_t wordsPerDocument)
+			: documents(documents), wordsPerDocument(wordsPerDocument)
+		{
+			static const char *syllables[] = {"a", "ka", "ri", "to", "men", "sa", "lo", "ve", "ni", "tra",
+											  "de", "po", "ing", "ex", "con", "str", "us", "el", "or", "qu"};
+			const std::size_t syllableCount = sizeof(syllables) / sizeof(syllables[0]);
+			std::mt19937_64 rng(7);
+			double sum = 0;
+			for (std::size_t i = 0; i < vocabulary; ++i)
+			{
+				std::string word;
+				for (std::size_t s = 0, length = 2 + rng() % 3; s < length; ++s)
+					word += syllables[rng() % syllableCount];
+				words.push_back(word + std::to_string(i));
+				sum += 1.0 / static_cast<double>(i + 1);
+				cdf.push_back(sum);
+			}
+			for (auto &c : cdf)
+				c /= sum;
+		}
+
+		std::size_t draw(std::mt19937_64 &rng) const
+		{
+			double u = std::uniform_real_distribution<double>(0, 1)(rng);
+			return std::min<std::size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+		}
+
+		// The same documents every time: fn(docId, word, frequency, positions).
+		template <class Fn>
+		void generate(Fn fn) const
+		{
+			std::mt19937_64 rng(11);
+			std::unordered_map<std::size_t, std::vector<int>> positions;
+			for (std::size_t doc = 1; doc <= documents; ++doc)
+			{
+				positions.clear();
+				for (std::size_t p = 0; p < wordsPerDocument; ++p)
+					positions[draw(rng)].push_back(static_cast<int>(p));
+				for (const auto &[word, list] : positions)
+					fn(static_cast<int>(doc), words[word], static_cast<int>(list.size()), list);
+			}
+		}
+	};
+
+	std::vector<QueryNode> makeQueries(const Corpus &corpus, std::size_t count)
+	{
+		std::mt19937_64 rng(13);
+		std::vector<QueryNode> queries;
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const std::string &a = corpus.words[corpus.draw(rng)];
+			const std::string &b = corpus.words[corpus.draw(rng)];
+			switch (i % 4)
+			{
+			case 0:
+				queries.push_back(QueryParser::parse(a));
+				break;
+			case 1:
+				queries.push_back(QueryParser::parse(a + " " + b));
+				break;
+			case 2:
+				queries.push_back(QueryParser::parse(a + " OR " + b));
+				break;
+			default:
+				queries.push_back(QueryParser::parse("\"" + a + " " + b + "\""));
+				break;
+			}
+		}
+		return queries;
+	}
+
+	double percentile(std::vector<double> &samples, double p)
+	{
+		std::size_t index = static_cast<std::size_t>(p * (samples.size() - 1));
+		std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+		return samples[index];
+	}
+
+	QueryPlan::Matches search(ShardedIndex &index, const QueryNode &query, const QueryLimits &limits)
+	{
+		QueryPlan plan(query, index, limits);
+		return index.top(plan, 10);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::size_t documents = argc > 1 ? std::stoul(argv[1]) : 50000;
+	std::size_t wordsPerDocument = argc > 2 ? std::stoul(argv[2]) : 150;
+	std::size_t maxShards = argc > 3 ? std::max(1ul, std::stoul(argv[3])) : 8;
+	std::size_t clients = argc > 4 ? std::max(1ul, std::stoul(argv[4])) : 4;
+	std::size_t queryCount = argc > 5 ? std::max(1ul, std::stoul(argv[5])) : 2000;
+
+	Corpus corpus(std::max<std::size_t>(1000, documents), documents, wordsPerDocument);
+	auto queries = makeQueries(corpus, queryCount);
+	QueryLimits limits;
+	limits.maxPostings = static_cast<std::size_t>(-1);
+
+	std::cout << documents << " documents x " << wordsPerDocument << " words, " << corpus.words.size()
+			  << " word vocabulary, " << queries.size() << " queries, " << std::thread::hardware_concurrency()
+			  << " cores\n\n"
+			  << "shards  build ms    MB    p50 us    p99 us   mean us   QPS x1   QPS x" << clients << '\n';
+
+	std::vector<QueryPlan::Matches> expected;
+	for (std::size_t shards = 1; shards <= maxShards; shards *= 2)
+	{
+		// The caller runs one shard itself.
+		auto pool = std::make_shared<ShardPool>(static_cast<int>(std::max<std::size_t>(1, shards - 1)));
+		auto start = std::chrono::steady_clock::now();
+		std::vector<IndexShard::Builder> builders(shards);
+		corpus.generate([&](int docId, const std::string &word, int frequency, const std::vector<int> &positions)
+						{ builders[ShardedIndex::shardOf(docId, shards)].add(docId, word, frequency, positions); });
+		std::vector<ShardedIndex::Shard> built(shards);
+		pool->run(shards, [&](std::size_t i)
+				  { built[i].segments.push_back(std::make_shared<IndexShard>(builders[i].build())); });
+		ShardedIndex index(std::move(built), pool, 0, static_cast<int>(documents), std::chrono::system_clock::now());
+		double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		// Warm-up, and the results every shard count has to agree on.
+		std::size_t mismatches = 0;
+		for (std::size_t i = 0; i < queries.size(); ++i)
+		{
+			auto matches = search(index, queries[i], limits);
+			if (shards == 1)
+				expected.push_back(std::move(matches));
+			else
+				mismatches += !std::equal(matches.begin(), matches.end(), expected[i].begin(), expected[i].end(),
+										  [](const QueryPlan::Match &a, const QueryPlan::Match &b)
+										  { return a.docId == b.docId && a.score == b.score; });
+		}
+
+		std::vector<double> micros;
+		micros.reserve(queries.size());
+		auto single = std::chrono::steady_clock::now();
+		for (const auto &query : queries)
+		{
+			auto begin = std::chrono::steady_clock::now();
+			search(index, query, limits);
+			micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+		}
+		double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - single).count();
+		double mean = 0;
+		for (double m : micros)
+			mean += m;
+		mean /= static_cast<double>(micros.size());
+
+		// Each client runs the whole mix from its own starting point.
+		std::atomic<std::size_t> done{0};
+		auto concurrent = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (std::size_t c = 0; c < clients; ++c)
+			threads.emplace_back([&, c]
+								 {
+				for (std::size_t i = 0; i < queries.size(); ++i)
+					search(index, queries[(i + c * queries.size() / clients) % queries.size()], limits);
+				done += queries.size(); });
+		for (auto &t : threads)
+			t.join();
+		double concurrentSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - concurrent).count();
+
+		std::cout << std::fixed << std::setprecision(1) << std::setw(6) << shards << std::setw(10) << buildMs
+				  << std::setw(6) << index.memoryBytes() / (1 << 20) << std::setw(10) << percentile(micros, 0.5)
+				  << std::setw(10) << percentile(micros, 0.99) << std::setw(10) << mean << std::setprecision(0)
+				  << std::setw(9) << static_cast<double>(queries.size()) / singleSeconds << std::setw(9)
+				  << static_cast<double>(done.load()) / concurrentSeconds;
+		if (mismatches)
+			std::cout << "   " << mismatches << " queries differ from 1 shard!";
+		std::cout << std::endl;
+	}
+	return 0;
+}
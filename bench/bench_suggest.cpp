@@ -0,0 +1,142 @@
+// Memory footprint and latency of prefix completion on a synthetic vocabulary.
+//
+//   bench_suggest [term_count] [top_n]
+//
+// Terms are built from syllables so that they share prefixes the way real
+// words do, with Zipf-distributed document frequencies. Reports build time,
+// bytes per term of the front-coded PrefixDictionary against a plain
+// std::map<std::string, uint32_t>, and completion latency percentiles for
+// prefixes of 1 to 4 characters, with the map answering the same queries by
+// scanning its whole prefix range.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <unistd.h>
+#include "../server/PrefixDictionary.h"
+
+namespace
+{
+	std::size_t residentBytes()
+	{
+		std::ifstream statm("/proc/self/statm");
+		std::size_t pages = 0, resident = 0;
+		statm >> pages >> resident;
+		return resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	}
+
+	std::vector<PrefixDictionary::Entry> makeVocabulary(std::size_t count, std::mt19937_64 &rng)
+	{
+		static const char *syllables[] = {"a", "ka", "ri", "to", "men", "sa", "lo", "ve", "ni", "tra",
+																			"de", "po", "ing", "ex", "con", "str", "us", "el", "or", "qu",
+																			"bi", "ze", "ph", "on", "at", "ic", "mo", "ur", "he", "gy"};
+		const std::size_t syllableCount = sizeof(syllables) / sizeof(syllables[0]);
+
+		std::vector<PrefixDictionary::Entry> entries;
+		entries.reserve(count);
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			std::string term;
+			std::size_t length = 2 + rng() % 4;
+			for (std::size_t s = 0; s < length; ++s)
+				term += syllables[rng() % syllableCount];
+			term += std::to_string(i % 97); // keeps most terms distinct
+			// Zipf-like: the i-th term occurs in about N / (i + 1) documents.
+			entries.push_back({std::move(term), static_cast<std::uint32_t>(count / (i + 1) + 1)});
+		}
+		std::shuffle(entries.begin(), entries.end(), rng);
+		return entries;
+	}
+
+	double percentile(std::vector<double> &samples, double p)
+	{
+		std::size_t index = static_cast<std::size_t>(p * (samples.size() - 1));
+		std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+		return samples[index];
+	}
+
+	template <class Complete>
+	void measure(const std::string &label, const std::vector<std::string> &prefixes, Complete complete)
+	{
+		std::vector<double> micros;
+		micros.reserve(prefixes.size());
+		std::size_t results = 0;
+		for (const auto &prefix : prefixes)
+		{
+			auto start = std::chrono::steady_clock::now();
+			results += complete(prefix);
+			micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		}
+		std::cout << std::left << std::setw(22) << label << std::right << std::fixed << std::setprecision(2)
+							<< "p50 " << std::setw(9) << percentile(micros, 0.5) << " us  p99 " << std::setw(9)
+							<< percentile(micros, 0.99) << " us  max " << std::setw(10) << percentile(micros, 1.0)
+							<< " us  (" << results << " results)" << std::endl;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::size_t count = argc > 1 ? std::stoul(argv[1]) : 2000000;
+	std::size_t topN = argc > 2 ? std::stoul(argv[2]) : 10;
+
+	std::mt19937_64 rng(42);
+	auto entries = makeVocabulary(count, rng);
+	std::size_t rawBytes = 0;
+	for (const auto &entry : entries)
+		rawBytes += entry.term.size();
+
+	std::vector<std::string> prefixes;
+	for (std::size_t i = 0; i < 20000; ++i)
+	{
+		const auto &term = entries[rng() % entries.size()].term;
+		prefixes.push_back(term.substr(0, 1 + rng() % std::min<std::size_t>(4, term.size())));
+	}
+
+	malloc_trim(0);
+	std::size_t rssBefore = residentBytes();
+	auto start = std::chrono::steady_clock::now();
+	PrefixDictionary dictionary(entries);
+	double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::size_t dictionaryRss = residentBytes() - std::min(rssBefore, residentBytes());
+
+	malloc_trim(0);
+	rssBefore = residentBytes();
+	start = std::chrono::steady_clock::now();
+	std::map<std::string, std::uint32_t> map;
+	for (const auto &entry : entries)
+	{
+		auto &frequency = map[entry.term];
+		frequency = std::max(frequency, entry.frequency);
+	}
+	double mapSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::size_t mapRss = residentBytes() - std::min(rssBefore, residentBytes());
+
+	std::cout << "terms: " << dictionary.size() << " distinct of " << count << ", "
+						<< std::fixed << std::setprecision(1) << static_cast<double>(rawBytes) / count << " bytes on average\n"
+						<< "PrefixDictionary: built in " << std::setprecision(2) << buildSeconds << " s, "
+						<< std::setprecision(1) << static_cast<double>(dictionary.memoryBytes()) / dictionary.size()
+						<< " B/term (" << dictionary.memoryBytes() / (1 << 20) << " MiB, rss +" << dictionaryRss / (1 << 20) << " MiB)\n"
+						<< "std::map:         built in " << std::setprecision(2) << mapSeconds << " s, "
+						<< std::setprecision(1) << static_cast<double>(mapRss) / map.size()
+						<< " B/term (rss +" << mapRss / (1 << 20) << " MiB)\n";
+
+	measure("PrefixDictionary", prefixes, [&](const std::string &prefix)
+					{ return dictionary.complete(prefix, topN).size(); });
+	measure("std::map range scan", prefixes, [&](const std::string &prefix)
+					{
+		std::vector<std::pair<std::uint32_t, const std::string *>> range;
+		for (auto it = map.lower_bound(prefix); it != map.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+			range.emplace_back(it->second, &it->first);
+		std::size_t n = std::min(topN, range.size());
+		std::partial_sort(range.begin(), range.begin() + n, range.end(), [](const auto &a, const auto &b)
+											{ return a.first > b.first; });
+		return n; });
+	return 0;
+}
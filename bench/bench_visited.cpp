@@ -0,0 +1,109 @@
+// Compares visited-set backends on synthetic crawl URLs.
+//
+//   bench_visited [url_count] [spill_dir]
+//
+// For each backend: insert throughput, memory per URL (estimated by the set
+// and measured as resident-set growth), bytes spilled to disk, and the
+// false-positive rate observed on URLs that were never inserted.
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <unistd.h>
+#include "../spider/VisitedSet.h"
+
+namespace
+{
+	std::size_t residentBytes()
+	{
+		std::ifstream statm("/proc/self/statm");
+		std::size_t pages = 0, resident = 0;
+		statm >> pages >> resident;
+		return resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+	}
+
+	std::string makeUrl(std::size_t i, bool unseen)
+	{
+		// Wikipedia-like URLs, ~55 bytes on average.
+		char buf[128];
+		std::snprintf(buf, sizeof(buf), "https://en.wikipedia.org/wiki/%s_%zu_%08zx",
+									unseen ? "Missing" : "Article", i, (i * 2654435761u) & 0xffffffff);
+		return buf;
+	}
+
+	void run(const std::string &label, const VisitedSetOptions &options, std::size_t count)
+	{
+		std::size_t rssBefore = residentBytes();
+		auto set = VisitedSet::create(options);
+
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < count; ++i)
+			set->insert(makeUrl(i, false));
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::size_t rss = residentBytes() - std::min(rssBefore, residentBytes());
+		auto stats = set->stats();
+
+		const std::size_t probes = std::min<std::size_t>(count, 1000000);
+		std::size_t falsePositives = 0;
+		auto probeStart = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < probes; ++i)
+			if (set->contains(makeUrl(i, true)))
+				++falsePositives;
+		double probeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - probeStart).count();
+
+		std::cout << std::left << std::setw(26) << label << std::right
+							<< std::setw(12) << static_cast<std::size_t>(count / seconds) << " ins/s"
+							<< std::setw(12) << static_cast<std::size_t>(probes / probeSeconds) << " miss/s"
+							<< std::setw(8) << stats.memoryBytes / std::max<std::size_t>(stats.count, 1) << " B/URL est"
+							<< std::setw(8) << rss / std::max<std::size_t>(stats.count, 1) << " B/URL rss"
+							<< std::setw(14) << stats.diskBytes << " B disk"
+							<< "   fp est " << stats.falsePositiveRate
+							<< ", observed " << falsePositives << "/" << probes << std::endl;
+
+		set.reset();
+		::malloc_trim(0); // hand freed nodes back so the next run's RSS growth is its own
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::size_t count = 10000000;
+	try
+	{
+		if (argc > 1)
+			count = std::stoul(argv[1]);
+	}
+	catch (const std::logic_error &)
+	{
+		std::cerr << "usage: bench_visited [url_count] [spill_dir]\n";
+		return 2;
+	}
+	std::string spillDir = argc > 2 ? argv[2] : "/tmp";
+
+	std::cout << "Inserting " << count << " URLs per backend\n";
+
+	VisitedSetOptions options;
+	options.backend = "strings";
+	run("strings", options, count);
+
+	options.backend = "fingerprint64";
+	run("fingerprint64", options, count);
+
+	options.backend = "fingerprint128";
+	run("fingerprint128", options, count);
+
+	options.backend = "fingerprint64";
+	options.bloom = true;
+	run("fingerprint64+bloom", options, count);
+
+	options.spillDir = spillDir;
+	options.spillThreshold = count / 8 + 1;
+	run("fingerprint64+bloom+spill", options, count);
+}
@@ -1,4 +1,68 @@
 #include "Database.h"
+#include <algorithm>
+#include <cstdio>
+
+std::atomic<std::uint64_t> Database::generation_{0};
+
+namespace
+{
+	// Postgres array literal: {1,2,3}
+	template <class Int>
+	std::string intArray(const std::vector<Int> &values)
+	{
+		std::string out = "{";
+		for (std::size_t i = 0; i < values.size(); ++i)
+		{
+			if (i)
+				out += ',';
+			out += std::to_string(values[i]);
+		}
+		out += '}';
+		return out;
+	}
+
+	std::string realArray(const std::vector<float> &values)
+	{
+		std::string out = "{";
+		char buf[32];
+		for (std::size_t i = 0; i < values.size(); ++i)
+		{
+			std::snprintf(buf, sizeof(buf), "%s%.7g", i ? "," : "", static_cast<double>(values[i]));
+			out += buf;
+		}
+		out += '}';
+		return out;
+	}
+
+	std::vector<int> parseIntArray(const std::string &text)
+	{
+		std::vector<int> values;
+		const char *p = text.c_str();
+		while (*p)
+		{
+			if (*p == '-' || std::isdigit(static_cast<unsigned char>(*p)))
+			{
+				char *end = nullptr;
+				values.push_back(static_cast<int>(std::strtol(p, &end, 10)));
+				p = end;
+			}
+			else
+				++p;
+		}
+		return values;
+	}
+}
+
+std::string Database::deadlinePrefix() const
+{
+	if (deadline_ == std::chrono::steady_clock::time_point{})
+		return {};
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - std::chrono::steady_clock::now()).count();
+	if (left <= 0)
+		throw DeadlineExceeded("query deadline exceeded");
+	// Sent with the statement itself, so it costs no extra round trip.
+	return "SET LOCAL statement_timeout = " + std::to_string(left) + "; ";
+}
 
 void Database::ensureSchema()
 {
@@ -18,7 +82,24 @@ void Database::ensureSchema()
 				word_id INT REFERENCES words(id),
 				frequency INT,
 				PRIMARY KEY (document_id, word_id)
-			);			
+			);
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS etag TEXT;
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS last_modified TEXT;
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS fetched_at TIMESTAMPTZ;
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS content_hash BIGINT;
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS depth INT;
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS simhash BIGINT;
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS canonical_id INT REFERENCES documents(id);
+			ALTER TABLE word_freq ADD COLUMN IF NOT EXISTS positions INT[];
+			CREATE INDEX IF NOT EXISTS word_freq_word_idx ON word_freq (word_id, document_id);
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS static_rank REAL;
+			ALTER TABLE documents ADD COLUMN IF NOT EXISTS indexed_at TIMESTAMPTZ;
+			CREATE INDEX IF NOT EXISTS documents_indexed_at_idx ON documents (indexed_at);
+			CREATE TABLE IF NOT EXISTS links (
+				source_id INT REFERENCES documents(id),
+				target_hash BIGINT,
+				PRIMARY KEY (source_id, target_hash)
+			);
 		)");
 	w.commit();
 }
@@ -39,6 +120,65 @@ int Database::insertDocument(const std::string &url)
 	return id;
 }
 
+int Database::upsertDocument(const DocumentMeta &meta)
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+
+	std::stringstream query;
+	query << "INSERT INTO documents (url, etag, last_modified, fetched_at, content_hash, simhash, canonical_id, depth) VALUES ('"
+				<< w.esc(meta.url) << "', "
+				<< (meta.etag.empty() ? "NULL" : "'" + w.esc(meta.etag) + "'") << ", "
+				<< (meta.lastModified.empty() ? "NULL" : "'" + w.esc(meta.lastModified) + "'") << ", "
+				<< "now(), " << static_cast<std::int64_t>(meta.contentHash) << ", "
+				<< static_cast<std::int64_t>(meta.simhash) << ", "
+				<< (meta.canonicalId ? std::to_string(meta.canonicalId) : "NULL") << ", " << meta.depth << ") "
+				<< "ON CONFLICT (url) DO UPDATE SET etag = EXCLUDED.etag, last_modified = EXCLUDED.last_modified, "
+				<< "fetched_at = EXCLUDED.fetched_at, content_hash = EXCLUDED.content_hash, "
+				<< "simhash = EXCLUDED.simhash, canonical_id = EXCLUDED.canonical_id, "
+				<< "depth = LEAST(documents.depth, EXCLUDED.depth) RETURNING id;";
+
+	auto res = w.exec(query.str());
+	int id = res[0][0].as<int>();
+	w.commit();
+	return id;
+}
+
+void Database::touchDocument(const std::string &url)
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	w.exec("UPDATE documents SET fetched_at = now() WHERE url = '" + w.esc(url) + "';");
+	w.commit();
+}
+
+std::vector<DocumentMeta> Database::loadDocumentMeta()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+
+	auto res = w.exec("SELECT id, url, COALESCE(etag, ''), COALESCE(last_modified, ''), "
+										"COALESCE(content_hash, 0), COALESCE(simhash, 0), COALESCE(canonical_id, 0), "
+										"COALESCE(depth, 1) FROM documents;");
+
+	std::vector<DocumentMeta> docs;
+	docs.reserve(res.size());
+	for (auto row : res)
+	{
+		DocumentMeta meta;
+		meta.id = row[0].as<int>();
+		meta.url = row[1].as<std::string>();
+		meta.etag = row[2].as<std::string>();
+		meta.lastModified = row[3].as<std::string>();
+		meta.contentHash = static_cast<std::uint64_t>(row[4].as<std::int64_t>());
+		meta.simhash = static_cast<std::uint64_t>(row[5].as<std::int64_t>());
+		meta.canonicalId = row[6].as<int>();
+		meta.depth = row[7].as<int>();
+		docs.push_back(std::move(meta));
+	}
+	return docs;
+}
+
 int Database::insertWord(const std::string &word)
 {
 	pqxx::work w(conn);
@@ -54,11 +194,13 @@ int Database::insertWord(const std::string &word)
 	return id;
 }
 
-void Database::insertWordFrequency(int docId, const std::unordered_map<std::string, int> &freq)
+void Database::insertWordFrequency(int docId, const std::unordered_map<std::string, int> &freq,
+								   const std::unordered_map<std::string, std::vector<int>> &positions)
 {
 	std::lock_guard<std::mutex> lk(mtx_);
 	pqxx::work w(conn);
 
+	std::stringstream wordIds;
 	for (auto it = freq.begin(); it != freq.end(); ++it)
 	{
 		const std::string &word = it->first;
@@ -71,56 +213,255 @@ void Database::insertWordFrequency(int docId, const std::unordered_map<std::stri
 
 		auto res_word = w.exec(query_word.str());
 		int wordId = res_word[0][0].as<int>();
+		wordIds << (it == freq.begin() ? "" : ", ") << wordId;
 
+		std::string wordPositions = "NULL";
+		auto pos = positions.find(word);
+		if (pos != positions.end())
+			wordPositions = "'" + intArray(pos->second) + "'";
+
+		// Rows whose frequency and positions did not change are left alone rather than rewritten.
 		std::stringstream query_freq;
-		query_freq << "INSERT INTO word_freq (document_id, word_id, frequency) "
-							 << "VALUES (" << docId << ", " << wordId << ", " << count << ") "
+		query_freq << "INSERT INTO word_freq (document_id, word_id, frequency, positions) "
+							 << "VALUES (" << docId << ", " << wordId << ", " << count << ", " << wordPositions << ") "
 							 << "ON CONFLICT (document_id, word_id) "
-							 << "DO UPDATE SET frequency = EXCLUDED.frequency;";
+							 << "DO UPDATE SET frequency = EXCLUDED.frequency, positions = EXCLUDED.positions "
+							 << "WHERE word_freq.frequency IS DISTINCT FROM EXCLUDED.frequency "
+							 << "OR word_freq.positions IS DISTINCT FROM EXCLUDED.positions;";
 
 		w.exec(query_freq.str());
 	}
+
+	// Words that disappeared from a re-indexed page.
+	std::stringstream query_stale;
+	query_stale << "DELETE FROM word_freq WHERE document_id = " << docId;
+	if (!freq.empty())
+		query_stale << " AND word_id NOT IN (" << wordIds.str() << ")";
+	query_stale << ";";
+	w.exec(query_stale.str());
+
+	// Stamped last, as close to the commit as possible: a reader that
+	// started before this time may have missed these postings.
+	w.exec("UPDATE documents SET indexed_at = clock_timestamp() WHERE id = " + std::to_string(docId) + ";");
+
 	w.commit();
+	++generation_;
+}
+
+std::vector<std::pair<std::string, int>> Database::loadVocabulary(int afterDocId, int upToDocId)
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+
+	auto res = w.exec("SELECT w.word, COUNT(*) AS df FROM words w "
+					  "JOIN word_freq wf ON wf.word_id = w.id "
+					  "WHERE wf.document_id > " + std::to_string(afterDocId) +
+					  " AND wf.document_id <= " + std::to_string(upToDocId) + " "
+					  "GROUP BY w.word;");
+
+	std::vector<std::pair<std::string, int>> vocabulary;
+	vocabulary.reserve(res.size());
+	for (auto row : res)
+		vocabulary.emplace_back(row["word"].as<std::string>(), row["df"].as<int>());
+	return vocabulary;
 }
 
-std::vector<SearchResult> Database::searchDocuments(const std::vector<std::string> &words)
+std::unordered_map<std::string, int> Database::documentFrequencies(const std::vector<std::string> &words)
 {
+	std::unordered_map<std::string, int> frequencies;
 	if (words.empty())
-		return {};
+		return frequencies;
 
 	std::lock_guard<std::mutex> lk(mtx_);
 	pqxx::work w(conn);
 
 	std::stringstream ss;
-	ss << "SELECT d.url, SUM(wf.frequency) AS relevance "
-	   << "FROM documents d "
-	   << "JOIN word_freq wf ON d.id = wf.document_id "
-	   << "JOIN words w ON wf.word_id = w.id "
+	ss << deadlinePrefix() << "SELECT w.word, COUNT(*) AS df FROM words w "
+	   << "JOIN word_freq wf ON wf.word_id = w.id "
 	   << "WHERE w.word IN (";
-
 	for (size_t i = 0; i < words.size(); ++i)
+		ss << (i ? ", " : "") << "'" << w.esc(words[i]) << "'";
+	ss << ") GROUP BY w.word;";
+
+	for (auto row : w.exec(ss.str()))
+		frequencies[row["word"].as<std::string>()] = row["df"].as<int>();
+	return frequencies;
+}
+
+std::vector<Posting> Database::postings(const std::string &word, const std::vector<int> *documents, bool positions)
+{
+	if (documents && documents->empty())
+		return {};
+
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+
+	std::stringstream ss;
+	ss << deadlinePrefix() << "SELECT wf.document_id, wf.frequency" << (positions ? ", wf.positions" : "") << " FROM word_freq wf "
+	   << "JOIN words w ON w.id = wf.word_id "
+	   << "WHERE w.word = '" << w.esc(word) << "' ";
+	if (documents)
+		ss << "AND wf.document_id = ANY('" << intArray(*documents) << "'::int[]) ";
+	ss << "ORDER BY wf.document_id;";
+
+	auto res = w.exec(ss.str());
+	std::vector<Posting> list;
+	list.reserve(res.size());
+	for (auto row : res)
 	{
-		ss << "'" << w.esc(words[i]) << "'";
-		if (i + 1 < words.size())
-			ss << ", ";
+		Posting p;
+		p.docId = row["document_id"].as<int>();
+		p.frequency = row["frequency"].as<int>();
+		if (positions && !row["positions"].is_null())
+			p.positions = parseIntArray(row["positions"].as<std::string>());
+		list.push_back(std::move(p));
 	}
+	return list;
+}
+
+int Database::scanPostings(int afterDocId, int upToDocId, std::size_t batchRows,
+						   const std::function<void(int docId, const std::string &word, int frequency, std::vector<int> positions)> &fn)
+{
+	// Keyset batches over the primary key, so each statement starts where the
+	// previous one stopped instead of re-reading what came before.
+	int lastDoc = afterDocId, lastWord = 0;
+	for (;;)
+	{
+		pqxx::result res;
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			pqxx::work w(conn);
+			std::stringstream ss;
+			ss << "SELECT wf.document_id, wf.word_id, w.word, wf.frequency, wf.positions FROM word_freq wf "
+			   << "JOIN words w ON w.id = wf.word_id "
+			   << "WHERE (wf.document_id, wf.word_id) > (" << lastDoc << ", " << lastWord << ") "
+			   << "AND wf.document_id <= " << upToDocId << " "
+			   << "ORDER BY wf.document_id, wf.word_id LIMIT " << batchRows << ";";
+			res = w.exec(ss.str());
+		}
 
-	ss << ") "
-	   << "GROUP BY d.id "
-	   << "HAVING COUNT(DISTINCT w.word) = " << words.size() << " "
-	   << "ORDER BY relevance DESC "
-	   << "LIMIT 10;";
+		for (auto row : res)
+		{
+			lastDoc = row["document_id"].as<int>();
+			lastWord = row["word_id"].as<int>();
+			fn(lastDoc, row["word"].as<std::string>(), row["frequency"].as<int>(),
+			   row["positions"].is_null() ? std::vector<int>{} : parseIntArray(row["positions"].as<std::string>()));
+		}
+		if (res.size() < batchRows)
+			return lastDoc;
+	}
+}
 
-	auto res = w.exec(ss.str());
+int Database::maxDocumentId(std::chrono::seconds settle)
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	auto res = w.exec("SELECT COALESCE(MAX(id), 0) FROM documents "
+					  "WHERE fetched_at IS NULL OR fetched_at <= now() - interval '" +
+					  std::to_string(settle.count()) + " seconds';");
+	return res[0][0].as<int>();
+}
+
+std::chrono::system_clock::time_point Database::serverTime()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	auto res = w.exec("SELECT (extract(epoch FROM clock_timestamp()) * 1000000)::BIGINT;");
+	return std::chrono::system_clock::time_point(std::chrono::microseconds(res[0][0].as<std::int64_t>()));
+}
+
+bool Database::reindexedSince(std::chrono::system_clock::time_point since, int upToDocId)
+{
+	auto micros = std::chrono::duration_cast<std::chrono::microseconds>(since.time_since_epoch()).count();
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	auto res = w.exec("SELECT EXISTS (SELECT 1 FROM documents WHERE indexed_at >= to_timestamp(" +
+					  std::to_string(micros) + " / 1000000.0) AND id <= " + std::to_string(upToDocId) + ");");
+	return res[0][0].as<bool>();
+}
+
+std::unordered_map<int, std::string> Database::documentUrls(const std::vector<int> &ids)
+{
+	std::unordered_map<int, std::string> urls;
+	if (ids.empty())
+		return urls;
 
-	std::vector<SearchResult> results;
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+
+	auto res = w.exec(deadlinePrefix() + "SELECT id, url FROM documents WHERE id = ANY('" + intArray(ids) + "'::int[]);");
+	for (auto row : res)
+		urls[row["id"].as<int>()] = row["url"].as<std::string>();
+	return urls;
+}
+
+void Database::replaceLinks(int docId, std::vector<std::uint64_t> targets)
+{
+	std::sort(targets.begin(), targets.end());
+	targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+	std::vector<std::int64_t> hashes(targets.begin(), targets.end());
+
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	w.exec("DELETE FROM links WHERE source_id = " + std::to_string(docId) + ";");
+	if (!hashes.empty())
+		w.exec("INSERT INTO links (source_id, target_hash) SELECT " + std::to_string(docId) + ", unnest('" +
+			   intArray(hashes) + "'::bigint[]);");
+	w.commit();
+}
+
+std::vector<std::pair<int, std::uint64_t>> Database::loadLinks()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+
+	auto res = w.exec("SELECT source_id, target_hash FROM links;");
+	std::vector<std::pair<int, std::uint64_t>> links;
+	links.reserve(res.size());
 	for (auto row : res)
+		links.emplace_back(row[0].as<int>(), static_cast<std::uint64_t>(row[1].as<std::int64_t>()));
+	return links;
+}
+
+void Database::storeStaticRanks(const std::vector<float> &ranks)
+{
+	std::vector<int> ids;
+	std::vector<float> values;
+	for (std::size_t id = 0; id < ranks.size(); ++id)
 	{
-		SearchResult r;
-		r.url = row["url"].as<std::string>();
-		r.relevance = row["relevance"].as<int>();
-		results.push_back(r);
+		if (ranks[id] > 0)
+		{
+			ids.push_back(static_cast<int>(id));
+			values.push_back(ranks[id]);
+		}
 	}
+	if (ids.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		pqxx::work w(conn);
+		w.exec("UPDATE documents d SET static_rank = r.rank FROM unnest('" + intArray(ids) + "'::int[], '" +
+			   realArray(values) + "'::real[]) AS r(id, rank) WHERE d.id = r.id;");
+		w.commit();
+	}
+	// Cached results were scored with the old ranks.
+	++generation_;
+}
 
-	return results;
-}
\ No newline at end of file
+std::vector<float> Database::loadStaticRanks()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+
+	auto res = w.exec("SELECT id, static_rank FROM documents WHERE static_rank IS NOT NULL;");
+	std::vector<float> ranks;
+	for (auto row : res)
+	{
+		auto id = static_cast<std::size_t>(row[0].as<int>());
+		if (id >= ranks.size())
+			ranks.resize(id + 1, 0.0f);
+		ranks[id] = row[1].as<float>();
+	}
+	return ranks;
+}
@@ -1,26 +1,121 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
 #include <pqxx/pqxx>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <stdexcept>
+#include <functional>
+#include <limits>
+
+#include "PostingSource.h"
+
+struct DocumentMeta
+{
+	int id = 0;
+	std::string url;
+	std::string etag;
+	std::string lastModified;
+	std::uint64_t contentHash = 0;
+	std::uint64_t simhash = 0;
+	int canonicalId = 0; // set when the page is a near-duplicate of another document
+	int depth = 1;
+};
 
 struct SearchResult
 {
 	std::string url;
 	int relevance;
+	int docId = 0;
+	std::vector<int> termFrequencies; // per query word, in the order the words were given
+};
+
+// Keyset position: results strictly after (relevance DESC, docId ASC).
+struct SearchCursor
+{
+	int relevance = 0;
+	int docId = 0; // 0 = from the first result
 };
 
-class Database
+// The deadline set with Database::setDeadline passed before a statement could run.
+class DeadlineExceeded : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+class Database : public PostingSource
 {
 public:
 	Database(const std::string &connStr) : conn(connStr) {}
 
+	bool connected() const { return conn.is_open(); }
+	// Search reads started after this throw DeadlineExceeded once it has
+	// passed, and get the remaining time as statement_timeout, so Postgres
+	// cancels them (pqxx::query_canceled) instead of finishing late. A
+	// default-constructed time point removes the deadline.
+	void setDeadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; }
 	void ensureSchema();
 	int insertDocument(const std::string &url);
+	// Inserts or updates a document with its fetch metadata; sets fetched_at.
+	int upsertDocument(const DocumentMeta &meta);
+	// Marks a document as re-validated (HTTP 304) without touching its content.
+	void touchDocument(const std::string &url);
+	std::vector<DocumentMeta> loadDocumentMeta();
 	int insertWord(const std::string &word);
-	void insertWordFrequency(int docId, const std::unordered_map<std::string, int> &freq);
-	std::vector<SearchResult> searchDocuments(const std::vector<std::string> &words);
+	// Replaces the postings of a document. positions (word -> offsets) is
+	// stored for phrase queries; words missing from it get no positions.
+	void insertWordFrequency(int docId, const std::unordered_map<std::string, int> &freq,
+							 const std::unordered_map<std::string, std::vector<int>> &positions = {});
+
+	std::unordered_map<std::string, int> documentFrequencies(const std::vector<std::string> &words) override;
+	std::vector<Posting> postings(const std::string &word, const std::vector<int> *documents = nullptr,
+								  bool positions = false) override;
+	// Calls fn for every posting of the documents with ids in (afterDocId,
+	// upToDocId], in document id order, reading batchRows rows per statement.
+	// Returns the largest document id seen, or afterDocId if there was none.
+	int scanPostings(int afterDocId, int upToDocId, std::size_t batchRows,
+					 const std::function<void(int docId, const std::string &word, int frequency, std::vector<int> positions)> &fn);
+	// Largest id of the documents fetched at least settle ago, 0 if there
+	// are none. A page's postings are written right after its document row,
+	// so every document up to this id is fully indexed unless a write took
+	// longer than settle.
+	int maxDocumentId(std::chrono::seconds settle = std::chrono::seconds(0));
+	// The database server's clock, which stamps documents.indexed_at.
+	std::chrono::system_clock::time_point serverTime();
+	// Whether the postings of any document with id <= upToDocId were
+	// written at or after since (serverTime()), as when a page is re-crawled.
+	bool reindexedSince(std::chrono::system_clock::time_point since, int upToDocId);
+	std::unordered_map<int, std::string> documentUrls(const std::vector<int> &ids);
+	// Every word of the documents with ids in (afterDocId, upToDocId], with
+	// the number of those documents it occurs in; by default every document.
+	std::vector<std::pair<std::string, int>> loadVocabulary(int afterDocId = 0,
+															int upToDocId = std::numeric_limits<int>::max());
+
+	// Replaces the outgoing links of a document. A target is the
+	// LinkGraph::urlHash of the linked URL, which need not be crawled yet.
+	void replaceLinks(int docId, std::vector<std::uint64_t> targets);
+	// Every link as (source document id, target URL hash).
+	std::vector<std::pair<int, std::uint64_t>> loadLinks();
+	// Sets documents.static_rank from ranks indexed by document id; ids
+	// with rank 0 are left alone.
+	void storeStaticRanks(const std::vector<float> &ranks);
+	// Static rank indexed by document id, 0 where none is stored.
+	std::vector<float> loadStaticRanks();
+
+	// Bumped after every postings change made through this process;
+	// search results cached at an older generation are stale.
+	static std::uint64_t generation() { return generation_.load(); }
 
 private:
+	static std::atomic<std::uint64_t> generation_;
+	std::chrono::steady_clock::time_point deadline_{};
+	// "SET LOCAL statement_timeout = ...; " for the current deadline, or "" without one.
+	std::string deadlinePrefix() const;
 	pqxx::connection conn;
 	std::mutex mtx_;
 };
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "PgFrontier.h"
+#include <algorithm>
+#include <sstream>
+#include <random>
+#include <unistd.h>
+#include "../spider/VisitedSet.h"
+
+namespace
+{
+	std::string hostOf(const std::string &url)
+	{
+		auto begin = url.find("://");
+		begin = (begin == std::string::npos) ? 0 : begin + 3;
+		return url.substr(begin, url.find('/', begin) - begin);
+	}
+
+	std::string leaseExpiry(int seconds)
+	{
+		return "now() + interval '1 second' * " + std::to_string(seconds);
+	}
+}
+
+PgFrontier::PgFrontier(const std::string &connStr, const FrontierOptions &options)
+		: conn(connStr), options_(options)
+{
+	options_.partitions = std::max(1, options_.partitions);
+	options_.slotsPerHost = std::max(1, options_.slotsPerHost);
+
+	char host[256] = {};
+	::gethostname(host, sizeof(host) - 1);
+	std::ostringstream owner;
+	owner << host << ':' << ::getpid() << ':' << std::hex << std::random_device{}();
+	owner_ = owner.str();
+}
+
+void PgFrontier::ensureSchema()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	w.exec(R"(
+			CREATE TABLE IF NOT EXISTS frontier (
+				url TEXT PRIMARY KEY,
+				depth INT NOT NULL,
+				partition INT NOT NULL,
+				state SMALLINT NOT NULL DEFAULT 0,
+				owner TEXT,
+				lease_until TIMESTAMPTZ
+			);
+			CREATE INDEX IF NOT EXISTS frontier_open ON frontier (partition, depth) WHERE state < 2;
+			CREATE TABLE IF NOT EXISTS frontier_partitions (
+				id INT PRIMARY KEY,
+				owner TEXT,
+				lease_until TIMESTAMPTZ
+			);
+		)");
+	w.exec("INSERT INTO frontier_partitions (id) SELECT generate_series(0, " + std::to_string(options_.partitions - 1) +
+				 ") ON CONFLICT (id) DO NOTHING;");
+	w.commit();
+}
+
+void PgFrontier::reset()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	w.exec("TRUNCATE frontier; UPDATE frontier_partitions SET owner = NULL, lease_until = NULL;");
+	w.commit();
+}
+
+int PgFrontier::partitionOf(const std::string &url) const
+{
+	// Seeded hashes so every process, on every machine, agrees.
+	std::uint64_t slot = options_.slotsPerHost > 1 ? VisitedSet::hash(url, 1) % options_.slotsPerHost : 0;
+	return static_cast<int>((VisitedSet::hash(hostOf(url)) + slot) % options_.partitions);
+}
+
+void PgFrontier::insertTasks(pqxx::work &w, std::vector<CrawlTask> tasks)
+{
+	if (tasks.empty())
+		return;
+	// A fixed key order keeps concurrent reporters from deadlocking on the
+	// primary key.
+	std::sort(tasks.begin(), tasks.end(), [](const CrawlTask &a, const CrawlTask &b)
+						{ return a.url < b.url; });
+
+	std::stringstream query;
+	query << "INSERT INTO frontier (url, depth, partition) VALUES ";
+	for (std::size_t i = 0; i < tasks.size(); ++i)
+	{
+		if (i > 0)
+			query << ", ";
+		query << "('" << w.esc(tasks[i].url) << "', " << tasks[i].depth << ", " << partitionOf(tasks[i].url) << ")";
+	}
+	query << " ON CONFLICT (url) DO NOTHING;";
+	w.exec(query.str());
+}
+
+void PgFrontier::seed(const std::vector<CrawlTask> &tasks)
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	insertTasks(w, tasks);
+	w.commit();
+}
+
+std::vector<CrawlTask> PgFrontier::lease(std::size_t max)
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	std::string me = "'" + w.esc(owner_) + "'";
+	std::string open = "(f.state = 0 OR (f.state = 1 AND (f.owner = " + me + " OR f.lease_until < now())))";
+
+	// Keep (and extend) the partitions we hold that still have work, take
+	// free or expired ones up to the limit and let go of the rest.
+	std::stringstream claim;
+	claim << "WITH wanted AS (SELECT p.id FROM frontier_partitions p "
+				<< "WHERE p.id < " << options_.partitions
+				<< " AND (p.owner = " << me << " OR p.lease_until IS NULL OR p.lease_until < now()) "
+				<< "AND EXISTS (SELECT 1 FROM frontier f WHERE f.partition = p.id AND " << open << ") "
+				<< "ORDER BY p.owner IS NOT DISTINCT FROM " << me << " DESC, p.id "
+				<< "LIMIT " << options_.maxPartitions << " FOR UPDATE SKIP LOCKED) "
+				<< "UPDATE frontier_partitions p SET owner = " << me << ", lease_until = " << leaseExpiry(options_.leaseSec)
+				<< " FROM wanted WHERE p.id = wanted.id RETURNING p.id;";
+	auto held = w.exec(claim.str());
+
+	std::stringstream ids;
+	for (auto row : held)
+		ids << (ids.tellp() > 0 ? ", " : "") << row[0].as<int>();
+
+	std::stringstream release;
+	release << "UPDATE frontier_partitions SET owner = NULL, lease_until = NULL WHERE owner = " << me;
+	if (!held.empty())
+		release << " AND id NOT IN (" << ids.str() << ")";
+	w.exec(release.str() + ";");
+
+	std::vector<CrawlTask> tasks;
+	if (held.empty())
+	{
+		w.commit();
+		return tasks;
+	}
+
+	// Old state 1 means the row was leased by a process whose lease expired.
+	std::stringstream pick;
+	pick << "WITH picked AS (SELECT f.url, f.state FROM frontier f "
+			 << "WHERE f.partition IN (" << ids.str() << ") AND (f.state = 0 OR (f.state = 1 AND f.lease_until < now())) "
+			 << "ORDER BY f.depth LIMIT " << max << " FOR UPDATE SKIP LOCKED) "
+			 << "UPDATE frontier f SET state = 1, owner = " << me << ", lease_until = " << leaseExpiry(options_.leaseSec)
+			 << " FROM picked WHERE f.url = picked.url RETURNING f.url, f.depth, picked.state;";
+	auto res = w.exec(pick.str());
+	w.commit();
+
+	tasks.reserve(res.size());
+	for (auto row : res)
+	{
+		tasks.push_back({row[0].as<std::string>(), row[1].as<int>()});
+		if (row[2].as<int>() == 1)
+			++reclaimed_;
+	}
+	return tasks;
+}
+
+void PgFrontier::report(const std::vector<std::string> &done, const std::vector<CrawlTask> &discovered)
+{
+	if (done.empty() && discovered.empty())
+		return;
+
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	insertTasks(w, discovered);
+
+	if (!done.empty())
+	{
+		std::vector<std::string> urls(done);
+		std::sort(urls.begin(), urls.end());
+		std::stringstream query;
+		query << "UPDATE frontier SET state = 2, owner = NULL, lease_until = NULL WHERE url IN (";
+		for (std::size_t i = 0; i < urls.size(); ++i)
+			query << (i > 0 ? ", " : "") << "'" << w.esc(urls[i]) << "'";
+		query << ");";
+		w.exec(query.str());
+	}
+	w.commit();
+}
+
+void PgFrontier::renew()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	std::string me = "'" + w.esc(owner_) + "'";
+	std::string until = leaseExpiry(options_.leaseSec);
+	w.exec("UPDATE frontier_partitions SET lease_until = " + until + " WHERE owner = " + me + ";");
+	// Leased rows are only ever in partitions we hold, which keeps this on the frontier_open index.
+	w.exec("UPDATE frontier SET lease_until = " + until + " WHERE state = 1 AND owner = " + me +
+		   " AND partition IN (SELECT id FROM frontier_partitions WHERE owner = " + me + ");");
+	w.commit();
+}
+
+std::chrono::milliseconds PgFrontier::renewInterval() const
+{
+	return std::chrono::milliseconds(std::max(1, options_.leaseSec) * 1000 / 3);
+}
+
+bool PgFrontier::drained()
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	pqxx::work w(conn);
+	auto res = w.exec("SELECT NOT EXISTS (SELECT 1 FROM frontier WHERE state < 2);");
+	w.commit();
+	return res[0][0].as<bool>();
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <pqxx/pqxx>
+#include "../spider/Frontier.h"
+
+struct FrontierOptions
+{
+	int partitions = 64;   // must be the same in every process sharing the table
+	int slotsPerHost = 1;  // partitions one host is spread over: >1 lets that many processes crawl it at once
+	int maxPartitions = 8; // partitions one process may hold
+	int leaseSec = 60;	   // after this, leases of a silent process are reclaimed; renewed every third of it
+};
+
+// Frontier in PostgreSQL, shared by crawler processes on any machine.
+//
+// Every URL falls into a partition chosen by host hash. A process first
+// leases whole partitions, so one host is only fetched by one process at a
+// time and its politeness delay still holds, then leases URLs from them with
+// SELECT ... FOR UPDATE SKIP LOCKED. Leases carry an expiry that a live
+// process keeps pushing back with renew(); rows and partitions of a crashed
+// process become free again once it passes.
+class PgFrontier : public Frontier
+{
+public:
+	PgFrontier(const std::string &connStr, const FrontierOptions &options = {});
+
+	void ensureSchema();
+	// Forgets every URL. Only one process may do this, before the others start.
+	void reset();
+
+	void seed(const std::vector<CrawlTask> &tasks) override;
+	std::vector<CrawlTask> lease(std::size_t max) override;
+	void report(const std::vector<std::string> &done, const std::vector<CrawlTask> &discovered) override;
+	bool drained() override;
+	void renew() override;
+	std::chrono::milliseconds renewInterval() const override;
+
+	const std::string &owner() const { return owner_; }
+	// URLs taken over from expired leases of other processes.
+	std::uint64_t reclaimed() const { return reclaimed_; }
+
+private:
+	pqxx::connection conn;
+	std::mutex mtx_;
+	FrontierOptions options_;
+	std::string owner_;
+	std::atomic<std::uint64_t> reclaimed_{0};
+
+	int partitionOf(const std::string &url) const;
+	void insertTasks(pqxx::work &w, std::vector<CrawlTask> tasks);
+};
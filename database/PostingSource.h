@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// One document of a word's posting list.
+struct Posting
+{
+	int docId = 0;
+	int frequency = 0;
+	std::vector<int> positions; // word offsets in the document, ascending; filled on request
+};
+
+// Where QueryPlan reads document frequencies and posting lists from: the
+// word_freq table through Database, or an in-memory IndexShard.
+class PostingSource
+{
+public:
+	virtual ~PostingSource() = default;
+
+	// Number of documents containing each word; words not indexed are absent.
+	virtual std::unordered_map<std::string, int> documentFrequencies(const std::vector<std::string> &words) = 0;
+	// Posting list of a word ordered by document id, restricted to documents
+	// (sorted ids) when given so that rare terms bound the work for common ones.
+	virtual std::vector<Posting> postings(const std::string &word, const std::vector<int> *documents = nullptr,
+										  bool positions = false) = 0;
+};
@@ -0,0 +1,222 @@
+#include "HtmlTokenizer.h"
+#include "Indexer.h"
+#include <algorithm>
+#include <cctype>
+
+namespace
+{
+	const std::size_t max_tag_size = 4096;
+	const std::size_t max_entity_size = 32;
+
+	bool isWordByte(unsigned char c)
+	{
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	}
+}
+
+HtmlTokenizer::HtmlTokenizer(const std::string &baseUrl) : baseUrl_(baseUrl) {}
+
+void HtmlTokenizer::put(char c)
+{
+	text_.push_back(c);
+}
+
+void HtmlTokenizer::space()
+{
+	if (!text_.empty() && text_.back() != ' ')
+		text_.push_back(' ');
+}
+
+void HtmlTokenizer::feed(const char *data, std::size_t size)
+{
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(data[i]);
+		switch (state_)
+		{
+		case State::text:
+			if (lead_)
+			{
+				// Cyrillic (U+0400..U+04FF) is the only non-ASCII script kept,
+				// same as cleanHTML.
+				if ((c >> 6) == 0x2)
+				{
+					put(static_cast<char>(lead_));
+					put(static_cast<char>(c));
+					lead_ = 0;
+					break;
+				}
+				lead_ = 0;
+				space();
+			}
+			if (c == '<')
+			{
+				space();
+				state_ = State::tag;
+				tag_.clear();
+				tagOverflow_ = false;
+			}
+			else if (c == '&')
+			{
+				state_ = State::entity;
+				entity_.clear();
+			}
+			else if (isWordByte(c))
+				put(static_cast<char>(c));
+			else if (c == 0xD0 || c == 0xD1)
+				lead_ = c;
+			else
+				space();
+			break;
+
+		case State::entity:
+			if ((isWordByte(c) || c == '#') && entity_.size() < max_entity_size)
+				entity_.push_back(static_cast<char>(c));
+			else
+			{
+				if (c == ';' && !entity_.empty())
+				{
+					space();
+					state_ = State::text;
+				}
+				else
+				{
+					flushEntity();
+					--i; // reprocess this byte as text
+				}
+			}
+			break;
+
+		case State::tag:
+			if (c == '>')
+			{
+				onTag();
+				break;
+			}
+			if (tag_.size() < max_tag_size)
+				tag_.push_back(static_cast<char>(c));
+			else
+				tagOverflow_ = true;
+			if (tag_.size() == 3 && tag_ == "!--")
+			{
+				state_ = State::comment;
+				commentDashes_ = 0;
+			}
+			break;
+
+		case State::comment:
+			if (c == '-')
+				++commentDashes_;
+			else
+			{
+				if (c == '>' && commentDashes_ >= 2)
+					state_ = State::text;
+				commentDashes_ = 0;
+			}
+			break;
+
+		case State::rawText:
+			if (std::tolower(c) == static_cast<unsigned char>(rawEnd_[rawMatch_]))
+			{
+				if (++rawMatch_ == rawEnd_.size())
+				{
+					state_ = State::tag;
+					tag_ = rawEnd_.substr(1);
+					tagOverflow_ = false;
+				}
+			}
+			else
+				rawMatch_ = (c == '<') ? 1 : 0;
+			break;
+		}
+	}
+}
+
+void HtmlTokenizer::flushEntity()
+{
+	// Not an entity after all ("AT&T"): '&' is a separator, the rest is text.
+	space();
+	state_ = State::text;
+	for (char ch : entity_)
+	{
+		if (isWordByte(static_cast<unsigned char>(ch)))
+			put(ch);
+		else
+			space();
+	}
+	entity_.clear();
+}
+
+void HtmlTokenizer::onTag()
+{
+	state_ = State::text;
+
+	std::size_t pos = 0;
+	bool closing = false;
+	if (pos < tag_.size() && tag_[pos] == '/')
+	{
+		closing = true;
+		++pos;
+	}
+	std::size_t nameEnd = pos;
+	while (nameEnd < tag_.size() && std::isalnum(static_cast<unsigned char>(tag_[nameEnd])))
+		++nameEnd;
+	std::string name = tag_.substr(pos, nameEnd - pos);
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+	if (closing)
+		return;
+
+	if (name == "script" || name == "style")
+	{
+		bool selfClosing = !tag_.empty() && tag_.back() == '/';
+		if (!selfClosing)
+		{
+			state_ = State::rawText;
+			rawEnd_ = "</" + name;
+			rawMatch_ = 0;
+		}
+		return;
+	}
+
+	if (name != "a" || tagOverflow_)
+		return;
+
+	std::string lower = tag_;
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	for (std::size_t p = lower.find("href", nameEnd); p != std::string::npos; p = lower.find("href", p + 4))
+	{
+		if (!std::isspace(static_cast<unsigned char>(lower[p - 1])))
+			continue;
+		std::size_t q = p + 4;
+		while (q < lower.size() && std::isspace(static_cast<unsigned char>(lower[q])))
+			++q;
+		if (q >= lower.size() || lower[q] != '=')
+			continue;
+		++q;
+		while (q < lower.size() && std::isspace(static_cast<unsigned char>(lower[q])))
+			++q;
+		if (q >= lower.size() || (lower[q] != '"' && lower[q] != '\''))
+			continue;
+		char quote = lower[q];
+		std::size_t end = lower.find(quote, q + 1);
+		if (end == std::string::npos)
+			return;
+
+		std::string link = Indexer::resolveLink(baseUrl_, tag_.substr(q + 1, end - q - 1));
+		if (!link.empty())
+			links_.push_back(link);
+		return;
+	}
+}
+
+void HtmlTokenizer::finish()
+{
+	if (state_ == State::entity)
+		flushEntity();
+	state_ = State::text;
+	lead_ = 0;
+
+	std::sort(links_.begin(), links_.end());
+	links_.erase(std::unique(links_.begin(), links_.end()), links_.end());
+}
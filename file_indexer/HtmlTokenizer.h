@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Incremental counterpart of Indexer::cleanHTML + Indexer::extractLinks.
+// Body chunks are fed as they come off the socket; tag markup, comments,
+// <script>/<style> contents and entities are dropped, and <a href> targets
+// are resolved against the page URL. Chunk boundaries may fall anywhere,
+// including inside a tag or a multi-byte character.
+class HtmlTokenizer
+{
+public:
+	explicit HtmlTokenizer(const std::string &baseUrl);
+
+	void feed(const char *data, std::size_t size);
+	void finish();
+
+	const std::string &text() const { return text_; }
+	std::string takeText() { return std::move(text_); }
+	std::vector<std::string> takeLinks() { return std::move(links_); }
+
+private:
+	enum class State
+	{
+		text,
+		tag,
+		comment,
+		rawText,
+		entity
+	};
+
+	std::string baseUrl_;
+	State state_ = State::text;
+	std::string text_;
+	std::string tag_;
+	std::string entity_;
+	std::string rawEnd_;	 // "</script" or "</style" while in rawText
+	std::size_t rawMatch_ = 0;
+	std::size_t commentDashes_ = 0;
+	unsigned char lead_ = 0; // pending UTF-8 lead byte
+	bool tagOverflow_ = false;
+	std::vector<std::string> links_;
+
+	void put(char c);
+	void space();
+	void onTag();
+	void flushEntity();
+};
@@ -1,4 +1,5 @@
 #include "Indexer.h"
+#include "../logger/Logger.h"
 
 std::string Indexer::cleanHTML(const std::string &html)
 {
@@ -25,9 +26,9 @@ std::string Indexer::cleanHTML(const std::string &html)
 	return text;
 }
 
-std::unordered_map<std::string, int> Indexer::analyzeText(const std::string &text)
+std::vector<std::string> Indexer::tokenize(const std::string &text)
 {
-	std::unordered_map<std::string, int> freq;
+	std::vector<std::string> words;
 	std::string safe = sanitizeUTF8(text);
 	std::string lower;
 	try
@@ -46,11 +47,60 @@ std::unordered_map<std::string, int> Indexer::analyzeText(const std::string &tex
 	{
 		if (word.size() < 3 || word.size() > 32)
 			continue;
-		freq[word]++;
+		words.push_back(word);
+	}
+	return words;
+}
+
+std::unordered_map<std::string, int> Indexer::analyzeText(const std::string &text, Positions *positions)
+{
+	std::unordered_map<std::string, int> freq;
+	auto words = tokenize(text);
+	for (std::size_t i = 0; i < words.size(); ++i)
+	{
+		freq[words[i]]++;
+		if (positions)
+			(*positions)[words[i]].push_back(static_cast<int>(i));
 	}
 	return freq;
 }
 
+std::uint64_t Indexer::contentHash(const std::string &text)
+{
+	std::uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::uint64_t Indexer::simhash(const std::unordered_map<std::string, int> &freq)
+{
+	int weights[64] = {};
+	for (const auto &entry : freq)
+	{
+		// FNV alone leaves the high bits poorly mixed for short words.
+		std::uint64_t h = contentHash(entry.first);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+
+		int weight = std::min(entry.second, 64);
+		for (int bit = 0; bit < 64; ++bit)
+			weights[bit] += ((h >> bit) & 1) ? weight : -weight;
+	}
+
+	std::uint64_t fingerprint = 0;
+	for (int bit = 0; bit < 64; ++bit)
+		if (weights[bit] > 0)
+			fingerprint |= 1ULL << bit;
+	return fingerprint;
+}
+
 void Indexer::parseUrl(const std::string &url, std::string &protocol, std::string &host, std::string &path)
 {
 	protocol.clear();
@@ -137,6 +187,28 @@ std::string Indexer::resolveRelative(const std::string &baseUrl, const std::stri
 	return protocol + "://" + host + final_path;
 }
 
+std::string Indexer::resolveLink(const std::string &baseUrl, const std::string &href)
+{
+	if (href.empty())
+		return "";
+	std::string low = href;
+	std::transform(low.begin(), low.end(), low.begin(), ::tolower);
+	if (low.rfind("mailto:", 0) == 0)
+		return "";
+	if (low.rfind("javascript:", 0) == 0)
+		return "";
+	if (low.rfind("tel:", 0) == 0)
+		return "";
+	if (href[0] == '#')
+		return "";
+
+	std::string abs = resolveRelative(baseUrl, href);
+
+	if (abs.rfind("http://", 0) == 0 || abs.rfind("https://", 0) == 0)
+		return abs;
+	return "";
+}
+
 std::vector<std::string> Indexer::extractLinks(const std::string &html, const std::string &baseUrl)
 {
 	std::vector<std::string> links;
@@ -151,34 +223,18 @@ std::vector<std::string> Indexer::extractLinks(const std::string &html, const st
 		for (auto it = begin; it != end; ++it)
 		{
 			std::smatch m = *it;
-			std::string href = m[2].str();
-
-			if (href.empty())
-				continue;
-			std::string low = href;
-			std::transform(low.begin(), low.end(), low.begin(), ::tolower);
-			if (low.rfind("mailto:", 0) == 0)
-				continue;
-			if (low.rfind("javascript:", 0) == 0)
-				continue;
-			if (low.rfind("tel:", 0) == 0)
-				continue;
-			if (href[0] == '#')
-				continue;
-
-			std::string abs = resolveRelative(baseUrl, href);
-
-			if (abs.rfind("http://", 0) == 0 || abs.rfind("https://", 0) == 0)
+			std::string abs = resolveLink(baseUrl, m[2].str());
+			if (!abs.empty())
 				links.push_back(abs);
 		}
 	}
 	catch (const std::regex_error &e)
 	{
-		std::cerr << "Regex error in extractLinks: " << e.what() << std::endl;
+		LOG_WARN("INDEXER") << "Regex error in extractLinks: " << e.what();
 	}
 	catch (const std::exception &e)
 	{
-		std::cerr << "Exception in extractLinks: " << e.what() << std::endl;
+		LOG_WARN("INDEXER") << "Exception in extractLinks: " << e.what();
 	}
 
 	std::sort(links.begin(), links.end());
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 #include <regex>
 #include <unordered_map>
+#include <vector>
 #include <boost/locale.hpp>
 #include <sstream>
 #include <iostream>
@@ -10,10 +12,24 @@
 class Indexer
 {
 public:
+	// Word -> its positions in the text, counted in indexed words.
+	using Positions = std::unordered_map<std::string, std::vector<int>>;
+
 	static std::string cleanHTML(const std::string &html);
-	static std::unordered_map<std::string, int> analyzeText(const std::string &text);
+	// Lowercased words of cleaned text in order, without those too short or
+	// too long to index. Queries are split the same way.
+	static std::vector<std::string> tokenize(const std::string &text);
+	static std::unordered_map<std::string, int> analyzeText(const std::string &text, Positions *positions = nullptr);
+	// 64-bit FNV-1a of the cleaned text, used to skip re-indexing unchanged pages.
+	static std::uint64_t contentHash(const std::string &text);
+	// 64-bit SimHash over the analyzed terms, weighted by frequency. Pages
+	// with mostly the same vocabulary land within a few bits of each other.
+	static std::uint64_t simhash(const std::unordered_map<std::string, int> &freq);
 
 	static std::vector<std::string> extractLinks(const std::string &html, const std::string &baseUrl);
+	// Absolute http(s) URL for an <a href> value, or "" for anchors,
+	// mailto:/javascript:/tel: links and unsupported schemes.
+	static std::string resolveLink(const std::string &baseUrl, const std::string &href);
 
 private:
 	static void parseUrl(const std::string &url, std::string &protocol, std::string &host, std::string &path);
@@ -0,0 +1,106 @@
+#include "NearDuplicateIndex.h"
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+NearDuplicateIndex::NearDuplicateIndex(int maxDistance) : maxDistance_(maxDistance)
+{
+	static_assert(maxSupportedDistance == blocks - 1, "pigeonhole: one block must match");
+	if (maxDistance < 0 || maxDistance > maxSupportedDistance)
+		throw std::invalid_argument("near-duplicate distance must be between 0 and " +
+									std::to_string(maxSupportedDistance));
+	for (auto &table : tables_)
+		table.resize(1u << blockBits);
+}
+
+int NearDuplicateIndex::distance(std::uint64_t a, std::uint64_t b)
+{
+	return __builtin_popcountll(a ^ b);
+}
+
+int NearDuplicateIndex::find(std::uint64_t fingerprint, int exclude) const
+{
+	std::shared_lock<std::shared_mutex> lk(mtx_);
+	for (int b = 0; b < blocks; ++b)
+	{
+		for (std::uint32_t idx : tables_[b][block(fingerprint, b)])
+		{
+			const Entry &e = entries_[idx];
+			if (e.docId != exclude && distance(e.fingerprint, fingerprint) <= maxDistance_)
+				return e.docId;
+		}
+	}
+	return 0;
+}
+
+void NearDuplicateIndex::insert(std::uint64_t fingerprint, int docId)
+{
+	std::unique_lock<std::shared_mutex> lk(mtx_);
+	auto known = byDocument_.find(docId);
+	if (known != byDocument_.end())
+	{
+		if (entries_[known->second].fingerprint == fingerprint)
+			return;
+		unlink(known->second);
+		free_.push_back(known->second);
+	}
+
+	std::uint32_t idx;
+	if (!free_.empty())
+	{
+		idx = free_.back();
+		free_.pop_back();
+		entries_[idx] = {fingerprint, docId};
+	}
+	else
+	{
+		idx = static_cast<std::uint32_t>(entries_.size());
+		entries_.push_back({fingerprint, docId});
+	}
+	byDocument_[docId] = idx;
+	for (int b = 0; b < blocks; ++b)
+		tables_[b][block(fingerprint, b)].push_back(idx);
+}
+
+void NearDuplicateIndex::remove(int docId)
+{
+	std::unique_lock<std::shared_mutex> lk(mtx_);
+	auto known = byDocument_.find(docId);
+	if (known == byDocument_.end())
+		return;
+	unlink(known->second);
+	free_.push_back(known->second);
+	byDocument_.erase(known);
+}
+
+void NearDuplicateIndex::unlink(std::uint32_t idx)
+{
+	for (int b = 0; b < blocks; ++b)
+	{
+		auto &bucket = tables_[b][block(entries_[idx].fingerprint, b)];
+		auto it = std::find(bucket.begin(), bucket.end(), idx);
+		*it = bucket.back();
+		bucket.pop_back();
+	}
+}
+
+std::size_t NearDuplicateIndex::size() const
+{
+	std::shared_lock<std::shared_mutex> lk(mtx_);
+	return byDocument_.size();
+}
+
+std::size_t NearDuplicateIndex::memoryBytes() const
+{
+	std::shared_lock<std::shared_mutex> lk(mtx_);
+	std::size_t bytes = entries_.capacity() * sizeof(Entry) + free_.capacity() * sizeof(std::uint32_t) +
+						byDocument_.size() * (sizeof(std::pair<const int, std::uint32_t>) + 2 * sizeof(void *));
+	for (const auto &table : tables_)
+	{
+		bytes += table.size() * sizeof(table[0]);
+		for (const auto &bucket : table)
+			bytes += bucket.capacity() * sizeof(std::uint32_t);
+	}
+	return bytes;
+}
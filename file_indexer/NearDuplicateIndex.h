@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <shared_mutex>
+#include <unordered_map>
+
+// In-memory index of 64-bit SimHash fingerprints answering "is there an
+// indexed document within maxDistance bits of this one?".
+//
+// The fingerprint is split into four 16-bit blocks and every document is
+// filed under each block value (one table per block, i.e. four rotations
+// of the classic permuted-table scheme). Two fingerprints at Hamming
+// distance <= 3 agree on at least one block, so a lookup only compares
+// against the documents sharing a block with the query.
+class NearDuplicateIndex
+{
+public:
+	// Distances above this are not guaranteed to share a block.
+	static const int maxSupportedDistance = 3;
+
+	// Throws std::invalid_argument unless 0 <= maxDistance <= maxSupportedDistance.
+	explicit NearDuplicateIndex(int maxDistance = 3);
+
+	// Document id of an indexed near-duplicate other than exclude, or 0 if
+	// there is none. Two copies racing through find() before either is
+	// inserted are both kept; that is rare and only costs the space this
+	// index saves.
+	int find(std::uint64_t fingerprint, int exclude = 0) const;
+	// Files docId under fingerprint, replacing the fingerprint it had, so
+	// a page re-indexed with new content is no longer matched by its old one.
+	void insert(std::uint64_t fingerprint, int docId);
+	void remove(int docId);
+
+	std::size_t size() const;
+	std::size_t memoryBytes() const;
+
+	static int distance(std::uint64_t a, std::uint64_t b);
+
+private:
+	static const int blocks = 4;
+	static const int blockBits = 16;
+
+	struct Entry
+	{
+		std::uint64_t fingerprint;
+		int docId;
+	};
+
+	int maxDistance_;
+	std::vector<Entry> entries_;
+	std::vector<std::uint32_t> free_; // slots of removed entries, reused by insert()
+	std::unordered_map<int, std::uint32_t> byDocument_;
+	// tables_[b][v] lists indices into entries_ whose block b equals v.
+	std::array<std::vector<std::vector<std::uint32_t>>, blocks> tables_;
+	mutable std::shared_mutex mtx_;
+
+	void unlink(std::uint32_t idx);
+
+	static std::uint32_t block(std::uint64_t fingerprint, int b)
+	{
+		return static_cast<std::uint32_t>((fingerprint >> (b * blockBits)) & 0xFFFF);
+	}
+};
@@ -0,0 +1,182 @@
+#include "IndexShard.h"
+#include <algorithm>
+
+namespace
+{
+	// What a built shard's view points into.
+	struct Arrays
+	{
+		std::vector<IndexShard::Term> terms;
+		std::string text;
+		std::vector<int> docIds;
+		std::vector<int> frequencies;
+		std::vector<std::uint32_t> positionStart{0};
+		std::vector<int> positions;
+	};
+
+	const std::uint32_t kNoPositions = 0;
+}
+
+void IndexShard::Builder::add(int docId, const std::string &word, int frequency, const std::vector<int> &positions)
+{
+	auto [it, added] = wordIds_.emplace(word, static_cast<std::uint32_t>(words_.size()));
+	if (added)
+		words_.push_back(word);
+	rows_.push_back({it->second, docId, frequency, static_cast<std::uint32_t>(positions_.size()),
+					 static_cast<std::uint32_t>(positions.size())});
+	positions_.insert(positions_.end(), positions.begin(), positions.end());
+}
+
+void IndexShard::Builder::add(const IndexShard &shard)
+{
+	const View &v = shard.view_;
+	std::vector<int> positions;
+	for (std::size_t t = 0; t < v.termCount; ++t)
+	{
+		std::string word(shard.text(v.terms[t]));
+		for (std::uint32_t i = v.terms[t].first; i < v.terms[t].first + v.terms[t].count; ++i)
+		{
+			positions.assign(v.positions + v.positionStart[i], v.positions + v.positionStart[i + 1]);
+			add(v.docIds[i], word, v.frequencies[i], positions);
+		}
+	}
+}
+
+IndexShard IndexShard::Builder::build()
+{
+	// Words in text order, so that the dictionary can be binary searched.
+	std::vector<std::uint32_t> order(words_.size()), rank(words_.size());
+	for (std::uint32_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b)
+			  { return words_[a] < words_[b]; });
+	for (std::uint32_t i = 0; i < order.size(); ++i)
+		rank[order[i]] = i;
+	std::sort(rows_.begin(), rows_.end(), [&](const Row &a, const Row &b)
+			  { return a.word != b.word ? rank[a.word] < rank[b.word] : a.docId < b.docId; });
+
+	auto arrays = std::make_shared<Arrays>();
+	arrays->terms.reserve(words_.size());
+	arrays->docIds.reserve(rows_.size());
+	arrays->frequencies.reserve(rows_.size());
+	arrays->positionStart.reserve(rows_.size() + 1);
+	arrays->positions.reserve(positions_.size());
+
+	std::vector<int> docs;
+	for (std::size_t i = 0; i < rows_.size(); ++i)
+	{
+		const Row &row = rows_[i];
+		if (i == 0 || rows_[i - 1].word != row.word)
+		{
+			const std::string &word = words_[row.word];
+			arrays->terms.push_back({static_cast<std::uint32_t>(arrays->text.size()), static_cast<std::uint32_t>(word.size()),
+									 static_cast<std::uint32_t>(arrays->docIds.size()), 0});
+			arrays->text += word;
+		}
+		// A repeated (word, document) row would break the ascending order.
+		else if (rows_[i - 1].docId == row.docId)
+			continue;
+		++arrays->terms.back().count;
+		arrays->docIds.push_back(row.docId);
+		arrays->frequencies.push_back(row.frequency);
+		arrays->positions.insert(arrays->positions.end(), positions_.begin() + row.positionStart,
+								 positions_.begin() + row.positionStart + row.positionCount);
+		arrays->positionStart.push_back(static_cast<std::uint32_t>(arrays->positions.size()));
+		docs.push_back(row.docId);
+	}
+	std::sort(docs.begin(), docs.end());
+
+	View view;
+	view.terms = arrays->terms.data();
+	view.termCount = arrays->terms.size();
+	view.text = arrays->text.data();
+	view.textSize = arrays->text.size();
+	view.docIds = arrays->docIds.data();
+	view.frequencies = arrays->frequencies.data();
+	view.postingCount = arrays->docIds.size();
+	view.positionStart = arrays->positionStart.data();
+	view.positions = arrays->positions.data();
+	view.positionCount = arrays->positions.size();
+	view.documents = static_cast<std::size_t>(std::unique(docs.begin(), docs.end()) - docs.begin());
+
+	*this = Builder();
+	return IndexShard(view, std::move(arrays));
+}
+
+IndexShard::IndexShard()
+{
+	view_.positionStart = &kNoPositions;
+}
+
+IndexShard::IndexShard(const View &view, std::shared_ptr<const void> storage)
+	: view_(view), storage_(std::move(storage)) {}
+
+const IndexShard::Term *IndexShard::find(std::string_view word) const
+{
+	const Term *end = view_.terms + view_.termCount;
+	const Term *it = std::lower_bound(view_.terms, end, word, [&](const Term &term, std::string_view w)
+									  { return text(term) < w; });
+	return it != end && text(*it) == word ? it : nullptr;
+}
+
+std::unordered_map<std::string, int> IndexShard::documentFrequencies(const std::vector<std::string> &words)
+{
+	std::unordered_map<std::string, int> frequencies;
+	for (const auto &word : words)
+		if (const Term *term = find(word))
+			frequencies[word] = static_cast<int>(term->count);
+	return frequencies;
+}
+
+std::vector<Posting> IndexShard::postings(const std::string &word, const std::vector<int> *documents, bool positions)
+{
+	std::vector<Posting> list;
+	const Term *term = find(word);
+	if (!term || (documents && documents->empty()))
+		return list;
+
+	auto emit = [&](std::size_t i)
+	{
+		Posting p;
+		p.docId = view_.docIds[i];
+		p.frequency = view_.frequencies[i];
+		if (positions)
+			p.positions.assign(view_.positions + view_.positionStart[i], view_.positions + view_.positionStart[i + 1]);
+		list.push_back(std::move(p));
+	};
+
+	const int *first = view_.docIds + term->first;
+	const int *last = first + term->count;
+	if (!documents)
+	{
+		list.reserve(term->count);
+		for (const int *it = first; it != last; ++it)
+			emit(static_cast<std::size_t>(it - view_.docIds));
+		return list;
+	}
+
+	// A few candidates against a long list are looked up by binary search,
+	// otherwise both lists are walked side by side.
+	list.reserve(std::min<std::size_t>(documents->size(), term->count));
+	bool search = documents->size() * 16 < term->count;
+	const int *it = first;
+	for (int doc : *documents)
+	{
+		if (search)
+			it = std::lower_bound(it, last, doc);
+		else
+			while (it != last && *it < doc)
+				++it;
+		if (it == last)
+			break;
+		if (*it == doc)
+			emit(static_cast<std::size_t>(it - view_.docIds));
+	}
+	return list;
+}
+
+std::size_t IndexShard::memoryBytes() const
+{
+	return view_.termCount * sizeof(Term) + view_.textSize + view_.postingCount * 2 * sizeof(int) +
+		   (view_.postingCount + 1) * sizeof(std::uint32_t) + view_.positionCount * sizeof(int);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../database/PostingSource.h"
+
+// Posting lists of some of one shard's documents, held in flat arrays:
+// the dictionary is sorted by word, the postings of a word are entries
+// [first, first + count) of docIds and frequencies, ascending by document
+// id, and the positions of entry i are positions[positionStart[i] ..
+// positionStart[i + 1]).
+//
+// The arrays are either owned (built from the database) or point into a
+// mapped snapshot file (IndexSnapshot), where only the pages a search
+// touches are ever read. Immutable once built, so any number of threads
+// may read it at once.
+class IndexShard : public PostingSource
+{
+public:
+	struct Term
+	{
+		std::uint32_t textOffset; // into View::text
+		std::uint32_t textLength;
+		std::uint32_t first;	  // into the posting arrays
+		std::uint32_t count;
+	};
+
+	// The arrays of a shard, as written to and mapped from a snapshot.
+	struct View
+	{
+		const Term *terms = nullptr; // sorted by text
+		std::size_t termCount = 0;
+		const char *text = nullptr;
+		std::size_t textSize = 0;
+		const int *docIds = nullptr;
+		const int *frequencies = nullptr;
+		std::size_t postingCount = 0;
+		const std::uint32_t *positionStart = nullptr; // postingCount + 1 entries
+		const int *positions = nullptr;
+		std::size_t positionCount = 0;
+		std::size_t documents = 0;
+	};
+
+	// Takes postings in any order and sorts them once into an IndexShard.
+	class Builder
+	{
+	public:
+		void add(int docId, const std::string &word, int frequency, const std::vector<int> &positions);
+		// Every posting of shard, to merge several into one.
+		void add(const IndexShard &shard);
+		IndexShard build();
+
+	private:
+		struct Row
+		{
+			std::uint32_t word;
+			int docId;
+			int frequency;
+			std::uint32_t positionStart;
+			std::uint32_t positionCount;
+		};
+		std::unordered_map<std::string, std::uint32_t> wordIds_;
+		std::vector<std::string> words_;
+		std::vector<Row> rows_;
+		std::vector<int> positions_;
+	};
+
+	IndexShard();
+	// storage keeps the memory view points into alive.
+	IndexShard(const View &view, std::shared_ptr<const void> storage);
+
+	std::unordered_map<std::string, int> documentFrequencies(const std::vector<std::string> &words) override;
+	std::vector<Posting> postings(const std::string &word, const std::vector<int> *documents = nullptr,
+								  bool positions = false) override;
+
+	const View &view() const { return view_; }
+	std::size_t documents() const { return view_.documents; }
+	std::size_t postingCount() const { return view_.postingCount; }
+	// Size of the arrays, whether in memory or mapped.
+	std::size_t memoryBytes() const;
+
+private:
+	View view_;
+	std::shared_ptr<const void> storage_;
+
+	const Term *find(std::string_view word) const;
+	std::string_view text(const Term &term) const { return {view_.text + term.textOffset, term.textLength}; }
+};
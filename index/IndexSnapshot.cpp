@@ -0,0 +1,353 @@
+#include "IndexSnapshot.h"
+#include "../logger/Logger.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	const char kMagic[8] = {'D', 'I', 'P', 'L', 'I', 'D', 'X', '\0'};
+	constexpr std::uint32_t kByteOrder = 0x01020304;
+
+	struct Header
+	{
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t byteOrder; // kByteOrder as written by the saving machine
+		std::uint32_t shards;
+		std::int32_t highWater;
+		std::int64_t loadedAt; // ShardedIndex::loadedAt(), microseconds since the epoch
+		std::uint64_t fileSize;
+		std::uint64_t payloadChecksum; // the arrays: bytes from the end of the table to fileSize
+		std::uint64_t tableChecksum;   // the header, with this field 0, and the shard table
+	};
+
+	struct Section
+	{
+		std::uint64_t offset;
+		std::uint64_t count; // elements, not bytes
+	};
+
+	struct ShardEntry
+	{
+		std::uint64_t documents;
+		Section terms;
+		Section text;
+		Section docIds;
+		Section frequencies;
+		Section positionStart;
+		Section positions;
+	};
+
+	static_assert(sizeof(Header) == 56 && sizeof(ShardEntry) == 104, "snapshot layout must not depend on the compiler");
+	static_assert(sizeof(IndexShard::Term) == 16, "snapshot layout must not depend on the compiler");
+
+	// 64-bit running checksum, 8 bytes at a time; catches torn and
+	// corrupted files, not tampering.
+	class Checksum
+	{
+	public:
+		void update(const void *data, std::size_t size)
+		{
+			auto *p = static_cast<const unsigned char *>(data);
+			length_ += size;
+			while (size > 0 && filled_ > 0)
+			{
+				pending_[filled_++] = *p++;
+				--size;
+				if (filled_ == 8)
+					flush();
+			}
+			for (; size >= 8; p += 8, size -= 8)
+			{
+				std::uint64_t word;
+				std::memcpy(&word, p, 8);
+				mix(word);
+			}
+			// Fewer than 8 bytes left, and pending_ is empty if there are any.
+			std::memcpy(pending_ + filled_, p, size);
+			filled_ += size;
+		}
+
+		std::uint64_t value() const
+		{
+			Checksum copy = *this;
+			if (copy.filled_ > 0)
+			{
+				std::memset(copy.pending_ + copy.filled_, 0, 8 - copy.filled_);
+				copy.flush();
+			}
+			copy.mix(length_);
+			return copy.hash_;
+		}
+
+	private:
+		std::uint64_t hash_ = 0xcbf29ce484222325ULL;
+		std::uint64_t length_ = 0;
+		unsigned char pending_[8];
+		std::size_t filled_ = 0;
+
+		void mix(std::uint64_t word)
+		{
+			hash_ = (hash_ ^ word) * 0x9e3779b97f4a7c15ULL;
+			hash_ ^= hash_ >> 32;
+		}
+
+		void flush()
+		{
+			std::uint64_t word;
+			std::memcpy(&word, pending_, 8);
+			mix(word);
+			filled_ = 0;
+		}
+	};
+
+	std::uint64_t tableChecksum(Header header, const std::vector<ShardEntry> &table)
+	{
+		header.tableChecksum = 0;
+		Checksum sum;
+		sum.update(&header, sizeof(header));
+		sum.update(table.data(), table.size() * sizeof(ShardEntry));
+		return sum.value();
+	}
+
+	class Writer
+	{
+	public:
+		Writer(const std::string &path, std::uint64_t start) : out_(path, std::ios::binary | std::ios::trunc), offset_(start)
+		{
+			if (!out_)
+				throw std::runtime_error("cannot create " + path + ": " + std::strerror(errno));
+			std::string zeros(start, '\0'); // header and table, written last
+			out_.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+		}
+
+		template <class T>
+		Section write(const T *data, std::size_t count)
+		{
+			Section section{offset_, count};
+			append(data, count * sizeof(T));
+			static const char padding[8] = {};
+			append(padding, (8 - offset_ % 8) % 8);
+			return section;
+		}
+
+		void finish(const Header &header, const std::vector<ShardEntry> &table)
+		{
+			out_.seekp(0);
+			out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+			out_.write(reinterpret_cast<const char *>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(ShardEntry)));
+			out_.close();
+			if (!out_)
+				throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+		}
+
+		std::uint64_t size() const { return offset_; }
+		std::uint64_t checksum() const { return payload_.value(); }
+
+	private:
+		std::ofstream out_;
+		std::uint64_t offset_;
+		Checksum payload_;
+
+		void append(const void *data, std::size_t bytes)
+		{
+			out_.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+			payload_.update(data, bytes);
+			offset_ += bytes;
+		}
+	};
+
+	// A read-only mapping of a whole file, unmapped with the last shard using it.
+	class Mapping
+	{
+	public:
+		explicit Mapping(const std::string &path)
+		{
+			int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+			struct stat st;
+			if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header)))
+			{
+				::close(fd);
+				throw std::runtime_error(path + " is too short to be an index snapshot");
+			}
+			size_ = static_cast<std::size_t>(st.st_size);
+			void *data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (data == MAP_FAILED)
+				throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+			data_ = static_cast<const char *>(data);
+		}
+		~Mapping() { ::munmap(const_cast<char *>(data_), size_); }
+		Mapping(const Mapping &) = delete;
+		Mapping &operator=(const Mapping &) = delete;
+
+		const char *data() const { return data_; }
+		std::size_t size() const { return size_; }
+
+		// Asks the kernel to start reading a range the load is about to need.
+		void prefetch(std::uint64_t offset, std::uint64_t bytes) const
+		{
+			std::uint64_t page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+			std::uint64_t start = offset / page * page;
+			::madvise(const_cast<char *>(data_) + start, offset + bytes - start, MADV_WILLNEED);
+		}
+
+	private:
+		const char *data_ = nullptr;
+		std::size_t size_ = 0;
+	};
+
+	template <class T>
+	const T *sectionData(const Mapping &mapping, const Section &section, std::uint64_t payloadStart, const char *name)
+	{
+		if (section.offset < payloadStart || section.offset % 8 != 0 || section.offset > mapping.size() ||
+			section.count > (mapping.size() - section.offset) / sizeof(T))
+			throw std::runtime_error(std::string("index snapshot section ") + name + " lies outside the file");
+		return reinterpret_cast<const T *>(mapping.data() + section.offset);
+	}
+}
+
+void IndexSnapshot::save(const ShardedIndex &index, const std::string &path)
+{
+	auto start = std::chrono::steady_clock::now();
+	const auto &shards = index.shards();
+	std::uint64_t payloadStart = sizeof(Header) + shards.size() * sizeof(ShardEntry);
+	std::string temporary = path + ".tmp";
+
+	std::vector<ShardEntry> table(shards.size());
+	Writer writer(temporary, payloadStart);
+	for (std::size_t i = 0; i < shards.size(); ++i)
+	{
+		std::shared_ptr<IndexShard> merged = shards[i].segments.front();
+		if (shards[i].segments.size() > 1)
+		{
+			IndexShard::Builder builder;
+			for (const auto &segment : shards[i].segments)
+				builder.add(*segment);
+			merged = std::make_shared<IndexShard>(builder.build());
+		}
+
+		const IndexShard::View &v = merged->view();
+		ShardEntry &entry = table[i];
+		entry.documents = v.documents;
+		entry.terms = writer.write(v.terms, v.termCount);
+		entry.text = writer.write(v.text, v.textSize);
+		entry.docIds = writer.write(v.docIds, v.postingCount);
+		entry.frequencies = writer.write(v.frequencies, v.postingCount);
+		entry.positionStart = writer.write(v.positionStart, v.postingCount + 1);
+		entry.positions = writer.write(v.positions, v.positionCount);
+	}
+
+	Header header{};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.byteOrder = kByteOrder;
+	header.shards = static_cast<std::uint32_t>(shards.size());
+	header.highWater = index.highWater();
+	header.loadedAt = std::chrono::duration_cast<std::chrono::microseconds>(index.loadedAt().time_since_epoch()).count();
+	header.fileSize = writer.size();
+	header.payloadChecksum = writer.checksum();
+	header.tableChecksum = tableChecksum(header, table);
+	writer.finish(header, table);
+
+	// The data must be on disk before the rename makes it the snapshot.
+	int fd = ::open(temporary.c_str(), O_RDONLY | O_CLOEXEC);
+	bool synced = fd >= 0 && ::fsync(fd) == 0;
+	if (fd >= 0)
+		::close(fd);
+	if (!synced || std::rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error("cannot replace " + path + ": " + std::strerror(errno));
+	}
+
+	LOG_INFO("MEMINDEX") << "Snapshot " << path << " saved: " << index.documents() << " documents up to id "
+						 << index.highWater() << ", " << header.fileSize / 1024 << " KB in "
+						 << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+						 << " ms";
+}
+
+std::shared_ptr<ShardedIndex> IndexSnapshot::load(const std::string &path, std::shared_ptr<ShardPool> pool,
+												  std::uint64_t generation, bool verifyPayload)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto mapping = std::make_shared<const Mapping>(path);
+
+	Header header;
+	std::memcpy(&header, mapping->data(), sizeof(header));
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+		throw std::runtime_error(path + " is not an index snapshot");
+	if (header.byteOrder != kByteOrder)
+		throw std::runtime_error(path + " was written on a machine of another byte order");
+	if (header.version != kVersion)
+		throw std::runtime_error(path + " has format version " + std::to_string(header.version) + ", expected " +
+								 std::to_string(kVersion));
+	if (header.fileSize != mapping->size())
+		throw std::runtime_error(path + " is " + std::to_string(mapping->size()) + " bytes, the header says " +
+								 std::to_string(header.fileSize));
+	std::uint64_t payloadStart = sizeof(Header) + std::uint64_t(header.shards) * sizeof(ShardEntry);
+	if (header.shards == 0 || payloadStart > mapping->size())
+		throw std::runtime_error(path + " has a damaged shard table");
+
+	std::vector<ShardEntry> table(header.shards);
+	std::memcpy(table.data(), mapping->data() + sizeof(Header), table.size() * sizeof(ShardEntry));
+	if (tableChecksum(header, table) != header.tableChecksum)
+		throw std::runtime_error(path + " fails the checksum of its header");
+	if (verifyPayload)
+	{
+		Checksum sum;
+		sum.update(mapping->data() + payloadStart, mapping->size() - payloadStart);
+		if (sum.value() != header.payloadChecksum)
+			throw std::runtime_error(path + " fails the checksum of its postings");
+	}
+
+	std::vector<ShardedIndex::Shard> shards(header.shards);
+	for (std::size_t i = 0; i < table.size(); ++i)
+	{
+		const ShardEntry &entry = table[i];
+		IndexShard::View v;
+		v.terms = sectionData<IndexShard::Term>(*mapping, entry.terms, payloadStart, "terms");
+		v.termCount = entry.terms.count;
+		v.text = sectionData<char>(*mapping, entry.text, payloadStart, "text");
+		v.textSize = entry.text.count;
+		v.docIds = sectionData<int>(*mapping, entry.docIds, payloadStart, "docIds");
+		v.frequencies = sectionData<int>(*mapping, entry.frequencies, payloadStart, "frequencies");
+		v.postingCount = entry.docIds.count;
+		v.positionStart = sectionData<std::uint32_t>(*mapping, entry.positionStart, payloadStart, "positionStart");
+		v.positions = sectionData<int>(*mapping, entry.positions, payloadStart, "positions");
+		v.positionCount = entry.positions.count;
+		v.documents = entry.documents;
+		if (entry.frequencies.count != v.postingCount || entry.positionStart.count != v.postingCount + 1 ||
+			v.positionStart[v.postingCount] != v.positionCount)
+			throw std::runtime_error(path + " has inconsistent posting arrays in shard " + std::to_string(i));
+
+		// The dictionaries are read by every search; the postings only as needed.
+		mapping->prefetch(entry.text.offset, entry.text.count);
+		for (std::size_t t = 0; t < v.termCount; ++t)
+		{
+			const IndexShard::Term &term = v.terms[t];
+			if (std::uint64_t(term.textOffset) + term.textLength > v.textSize ||
+				std::uint64_t(term.first) + term.count > v.postingCount)
+				throw std::runtime_error(path + " has a damaged dictionary in shard " + std::to_string(i));
+		}
+		shards[i].segments.push_back(std::make_shared<IndexShard>(v, mapping));
+	}
+
+	std::chrono::system_clock::time_point loadedAt{std::chrono::microseconds(header.loadedAt)};
+	auto index = std::make_shared<ShardedIndex>(std::move(shards), std::move(pool), generation, header.highWater, loadedAt);
+	LOG_INFO("MEMINDEX") << "Snapshot " << path << " mapped: " << index->documents() << " documents up to id "
+						 << header.highWater << " in " << header.shards << " shards, " << mapping->size() / 1024
+						 << " KB, in "
+						 << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+						 << " ms";
+	return index;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "ShardedIndex.h"
+
+// Binary image of a ShardedIndex, so that a server starts from a file
+// instead of reading the whole word_freq table through libpq.
+//
+// The file holds a header (magic, format version, byte order, shard count,
+// high-water document id, load time, checksums), a table with the
+// offsets of every shard's arrays, and the arrays themselves, 8-byte
+// aligned, exactly as IndexShard::View reads them. Loading maps the file
+// read-only and points the shards into it: startup reads the header, the
+// table and the dictionaries, and the postings are paged in by the
+// searches that need them.
+//
+// The header and table are covered by one checksum, checked on every load;
+// the arrays by another, checked on request since that reads the whole file.
+class IndexSnapshot
+{
+public:
+	static constexpr std::uint32_t kVersion = 2;
+
+	// Writes index to path atomically: a temporary file, synced and renamed
+	// over path. Shards with several segments are merged into one. Throws
+	// std::runtime_error.
+	static void save(const ShardedIndex &index, const std::string &path);
+
+	// Maps path as an index of its own shard count, with the given
+	// generation and the high-water mark and load time it was saved with.
+	// Throws std::runtime_error when the file is missing, of another version
+	// or byte order, truncated, or fails a checksum; verifyPayload checks the
+	// arrays' checksum too.
+	static std::shared_ptr<ShardedIndex> load(const std::string &path, std::shared_ptr<ShardPool> pool,
+											  std::uint64_t generation, bool verifyPayload = false);
+};
@@ -0,0 +1,102 @@
+#include "ShardPool.h"
+#include <algorithm>
+
+ShardPool::ShardPool(int threads)
+{
+	if (threads <= 0)
+		threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	for (int i = 0; i < threads; ++i)
+		threads_.emplace_back([this]
+													{ work(); });
+}
+
+ShardPool::~ShardPool()
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (auto &t : threads_)
+		t.join();
+}
+
+void ShardPool::run(std::size_t n, const std::function<void(std::size_t)> &fn)
+{
+	if (n == 0)
+		return;
+	auto batch = std::make_shared<Batch>();
+	batch->fn = &fn;
+	batch->n = n;
+
+	// The caller takes a part itself, so n - 1 helpers at most.
+	std::size_t helpers = std::min(n - 1, threads_.size());
+	if (helpers > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lk(mtx_);
+			batches_.insert(batches_.end(), helpers, batch);
+		}
+		if (helpers == 1)
+			cv_.notify_one();
+		else
+			cv_.notify_all();
+	}
+
+	drain(*batch);
+	std::unique_lock<std::mutex> lk(batch->mtx);
+	batch->finished.wait(lk, [&]
+											 { return batch->done == batch->n; });
+	// Helpers that come to the batch later find nothing left to take; fn
+	// is not touched after done reaches n, so it may go out of scope now.
+	if (batch->error)
+		std::rethrow_exception(batch->error);
+}
+
+void ShardPool::work()
+{
+	for (;;)
+	{
+		std::shared_ptr<Batch> batch;
+		{
+			std::unique_lock<std::mutex> lk(mtx_);
+			cv_.wait(lk, [this]
+							 { return stop_ || !batches_.empty(); });
+			if (batches_.empty())
+				return;
+			batch = std::move(batches_.front());
+			batches_.pop_front();
+		}
+		drain(*batch);
+	}
+}
+
+void ShardPool::drain(Batch &batch)
+{
+	for (;;)
+	{
+		std::size_t i;
+		{
+			std::lock_guard<std::mutex> lk(batch.mtx);
+			if (batch.next == batch.n)
+				return;
+			i = batch.next++;
+		}
+
+		std::exception_ptr error;
+		try
+		{
+			(*batch.fn)(i);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lk(batch.mtx);
+		if (error && !batch.error)
+			batch.error = error;
+		if (++batch.done == batch.n)
+			batch.finished.notify_all();
+	}
+}
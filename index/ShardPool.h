@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+// Fork-join pool for fanning one search out over the index shards. Any
+// number of query threads may call run() at once; their batches share the
+// workers, and each caller works through its own batch as well, so a
+// search never waits in the queue behind others while it could be running.
+class ShardPool
+{
+public:
+	// threads <= 0: one per core.
+	explicit ShardPool(int threads);
+	~ShardPool();
+
+	// Calls fn(i) for every i in [0, n) and returns once all have finished.
+	// The first exception thrown by fn is rethrown here.
+	void run(std::size_t n, const std::function<void(std::size_t)> &fn);
+	int threads() const { return static_cast<int>(threads_.size()); }
+
+private:
+	struct Batch
+	{
+		const std::function<void(std::size_t)> *fn;
+		std::size_t n;
+		std::size_t next = 0; // first index nobody has taken yet
+		std::size_t done = 0;
+		std::exception_ptr error;
+		std::mutex mtx;
+		std::condition_variable finished;
+	};
+
+	std::deque<std::shared_ptr<Batch>> batches_; // one entry per helper wanted
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	bool stop_ = false;
+	std::vector<std::thread> threads_;
+
+	void work();
+	// Takes indexes of batch until there are none left.
+	static void drain(Batch &batch);
+};
@@ -0,0 +1,236 @@
+#include "ShardedIndex.h"
+#include "../logger/Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <queue>
+
+namespace
+{
+	// Pages fetched more recently may still be having their postings written;
+	// the high-water mark stays below them.
+	constexpr std::chrono::seconds kSettle{30};
+}
+
+std::unordered_map<std::string, int> ShardedIndex::Shard::documentFrequencies(const std::vector<std::string> &words)
+{
+	if (segments.size() == 1)
+		return segments.front()->documentFrequencies(words);
+	std::unordered_map<std::string, int> total;
+	for (auto &segment : segments)
+		for (const auto &[word, frequency] : segment->documentFrequencies(words))
+			total[word] += frequency;
+	return total;
+}
+
+std::vector<Posting> ShardedIndex::Shard::postings(const std::string &word, const std::vector<int> *documents,
+												   bool positions)
+{
+	if (segments.size() == 1)
+		return segments.front()->postings(word, documents, positions);
+	std::vector<Posting> list;
+	for (auto &segment : segments)
+	{
+		auto part = segment->postings(word, documents, positions);
+		list.insert(list.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+	}
+	return list;
+}
+
+ShardedIndex::ShardedIndex(std::vector<Shard> shards, std::shared_ptr<ShardPool> pool, std::uint64_t generation,
+						   int highWater, std::chrono::system_clock::time_point loadedAt)
+	: shards_(std::move(shards)), pool_(std::move(pool)), generation_(generation), highWater_(highWater),
+	  loadedAt_(loadedAt)
+{
+	if (shards_.empty())
+		shards_.emplace_back();
+	for (auto &shard : shards_)
+		if (shard.segments.empty())
+			shard.segments.push_back(std::make_shared<IndexShard>());
+}
+
+std::vector<std::shared_ptr<IndexShard>> ShardedIndex::read(Database &db, int afterDocId, int upToDocId,
+															 std::size_t shards, ShardPool &pool, std::size_t batchRows)
+{
+	std::vector<IndexShard::Builder> builders(shards);
+	db.scanPostings(afterDocId, upToDocId, batchRows, [&](int docId, const std::string &word, int frequency, std::vector<int> positions)
+					{ builders[shardOf(docId, shards)].add(docId, word, frequency, positions); });
+
+	// Sorting each shard into place is independent work.
+	std::vector<std::shared_ptr<IndexShard>> built(shards);
+	pool.run(shards, [&](std::size_t i)
+			 { built[i] = std::make_shared<IndexShard>(builders[i].build()); });
+	return built;
+}
+
+std::shared_ptr<ShardedIndex> ShardedIndex::load(Database &db, std::size_t shards, std::shared_ptr<ShardPool> pool,
+												 std::uint64_t generation, std::size_t batchRows)
+{
+	auto start = std::chrono::steady_clock::now();
+	shards = std::max<std::size_t>(1, shards);
+
+	// Documents added while the table is read are left to the next catch-up,
+	// documents re-indexed meanwhile to the next full load.
+	auto loadedAt = db.serverTime();
+	int upTo = db.maxDocumentId(kSettle);
+	std::vector<Shard> loaded(shards);
+	auto segments = read(db, 0, upTo, shards, *pool, batchRows);
+	for (std::size_t i = 0; i < shards; ++i)
+		loaded[i].segments.push_back(std::move(segments[i]));
+
+	auto index = std::make_shared<ShardedIndex>(std::move(loaded), std::move(pool), generation, upTo, loadedAt);
+	LOG_INFO("MEMINDEX") << "Loaded " << index->documents() << " documents, " << index->postingCount() << " postings into "
+						 << shards << " shards, " << index->memoryBytes() / 1024 << " KB, in "
+						 << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+						 << " ms";
+	return index;
+}
+
+std::shared_ptr<ShardedIndex> ShardedIndex::catchUp(Database &db, std::uint64_t generation, std::size_t batchRows) const
+{
+	auto start = std::chrono::steady_clock::now();
+	int upTo = db.maxDocumentId(kSettle);
+	if (upTo <= highWater_)
+		return std::make_shared<ShardedIndex>(shards_, pool_, generation, highWater_, loadedAt_);
+
+	auto added = read(db, highWater_, upTo, shards_.size(), *pool_, batchRows);
+	std::size_t documents = 0;
+	for (const auto &segment : added)
+		documents += segment->documents();
+
+	std::vector<Shard> shards = shards_;
+	pool_->run(shards.size(), [&](std::size_t i)
+			   {
+		auto &segments = shards[i].segments;
+		if (added[i]->postingCount() == 0)
+			return;
+		if (segments.size() < 2)
+		{
+			segments.push_back(std::move(added[i]));
+			return;
+		}
+		// Base segment, then everything caught up since merged into one.
+		IndexShard::Builder merged;
+		for (std::size_t s = 1; s < segments.size(); ++s)
+			merged.add(*segments[s]);
+		merged.add(*added[i]);
+		segments.resize(1);
+		segments.push_back(std::make_shared<IndexShard>(merged.build())); });
+
+	LOG_INFO("MEMINDEX") << "Caught up " << documents << " documents with ids " << highWater_ + 1 << ".." << upTo << " in "
+						 << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+						 << " ms";
+	return std::make_shared<ShardedIndex>(std::move(shards), pool_, generation, upTo, loadedAt_);
+}
+
+std::unordered_map<std::string, int> ShardedIndex::documentFrequencies(const std::vector<std::string> &words)
+{
+	std::unordered_map<std::string, int> total;
+	for (auto &shard : shards_)
+		for (const auto &[word, frequency] : shard.documentFrequencies(words))
+			total[word] += frequency;
+	return total;
+}
+
+std::vector<Posting> ShardedIndex::postings(const std::string &word, const std::vector<int> *documents, bool positions)
+{
+	std::vector<Posting> list;
+	if (!documents)
+	{
+		for (auto &shard : shards_)
+		{
+			auto part = shard.postings(word, nullptr, positions);
+			list.insert(list.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+		}
+	}
+	else
+	{
+		// The candidates stay sorted within each shard.
+		std::vector<std::vector<int>> byShard(shards_.size());
+		for (int doc : *documents)
+			byShard[shardOf(doc, shards_.size())].push_back(doc);
+		for (std::size_t i = 0; i < shards_.size(); ++i)
+		{
+			if (byShard[i].empty())
+				continue;
+			auto part = shards_[i].postings(word, &byShard[i], positions);
+			list.insert(list.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+		}
+	}
+	if (shards_.size() > 1)
+		std::sort(list.begin(), list.end(), [](const Posting &a, const Posting &b)
+				  { return a.docId < b.docId; });
+	return list;
+}
+
+QueryPlan::Matches ShardedIndex::top(const QueryPlan &plan, std::size_t limit, const SearchCursor &after,
+									 const StaticRank *ranks)
+{
+	if (shards_.size() == 1)
+		return plan.top(shards_.front(), limit, after, ranks);
+
+	std::vector<QueryPlan::Matches> local(shards_.size());
+	pool_->run(shards_.size(), [&](std::size_t i)
+			   { local[i] = plan.top(shards_[i], limit, after, ranks); });
+
+	// k-way merge: the heap holds the next match of every shard not yet used up.
+	struct Head
+	{
+		std::size_t shard;
+		std::size_t next;
+	};
+	auto later = [&](const Head &a, const Head &b)
+	{ return QueryPlan::before(local[b.shard][b.next], local[a.shard][a.next]); };
+	std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+	std::size_t total = 0;
+	for (std::size_t i = 0; i < local.size(); ++i)
+	{
+		if (!local[i].empty())
+			heads.push({i, 0});
+		total += local[i].size();
+	}
+
+	QueryPlan::Matches merged;
+	merged.reserve(std::min(limit, total));
+	while (merged.size() < limit && !heads.empty())
+	{
+		Head head = heads.top();
+		heads.pop();
+		merged.push_back(local[head.shard][head.next]);
+		if (++head.next < local[head.shard].size())
+			heads.push(head);
+	}
+	return merged;
+}
+
+std::vector<SearchResult> ShardedIndex::execute(const QueryPlan &plan, Database &db, std::size_t limit,
+												const SearchCursor &after, bool termFrequencies, const StaticRank *ranks)
+{
+	return plan.results(top(plan, limit, after, ranks), *this, db, termFrequencies);
+}
+
+std::size_t ShardedIndex::documents() const
+{
+	std::size_t total = 0;
+	for (const auto &shard : shards_)
+		for (const auto &segment : shard.segments)
+			total += segment->documents();
+	return total;
+}
+
+std::size_t ShardedIndex::postingCount() const
+{
+	std::size_t total = 0;
+	for (const auto &shard : shards_)
+		for (const auto &segment : shard.segments)
+			total += segment->postingCount();
+	return total;
+}
+
+std::size_t ShardedIndex::memoryBytes() const
+{
+	std::size_t total = 0;
+	for (const auto &shard : shards_)
+		for (const auto &segment : shard.segments)
+			total += segment->memoryBytes();
+	return total;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "IndexShard.h"
+#include "ShardPool.h"
+#include "../database/Database.h"
+#include "../query/QueryPlan.h"
+#include "../ranking/StaticRank.h"
+
+// The postings of every document, split into shards by document id
+// (docId % shards), held in memory.
+//
+// A search evaluates its QueryPlan on every shard at once on the shared
+// ShardPool; each shard keeps only its own top limit matches, and the
+// sorted lists are merged through a heap of the shards' heads, so no more
+// than limit matches are compared after the fan-out. Term statistics are
+// summed across shards, so a plan's costs and relevance are the same as
+// over the word_freq table.
+//
+// Every document up to highWater() is loaded; load and catchUp stop below
+// pages fetched in the last 30 s, whose postings may still be being
+// written, so the database can be ahead of the index. catchUp adds the documents
+// above it as one more segment per shard; their ids are all larger, so a
+// word's postings in a shard are its segments' lists one after another.
+// Documents re-indexed under an id already loaded keep their old postings
+// until the next full load; loadedAt() tells which writes that load saw.
+//
+// Immutable once built; catchUp returns a new index sharing the segments.
+class ShardedIndex : public PostingSource
+{
+public:
+	// The segments of one shard, oldest (lowest document ids) first.
+	class Shard : public PostingSource
+	{
+	public:
+		std::vector<std::shared_ptr<IndexShard>> segments;
+
+		std::unordered_map<std::string, int> documentFrequencies(const std::vector<std::string> &words) override;
+		std::vector<Posting> postings(const std::string &word, const std::vector<int> *documents = nullptr,
+									  bool positions = false) override;
+	};
+
+	ShardedIndex(std::vector<Shard> shards, std::shared_ptr<ShardPool> pool, std::uint64_t generation, int highWater,
+				 std::chrono::system_clock::time_point loadedAt);
+
+	// Reads the postings of every document in db. generation should be the
+	// Database::generation() read before the load started.
+	static std::shared_ptr<ShardedIndex> load(Database &db, std::size_t shards, std::shared_ptr<ShardPool> pool,
+											  std::uint64_t generation, std::size_t batchRows = 100000);
+	// This index plus the documents added to db since it was loaded. At most
+	// two segments are kept per shard: what came later is merged into one.
+	std::shared_ptr<ShardedIndex> catchUp(Database &db, std::uint64_t generation, std::size_t batchRows = 100000) const;
+
+	static std::size_t shardOf(int docId, std::size_t shards) { return static_cast<std::size_t>(docId) % shards; }
+
+	std::unordered_map<std::string, int> documentFrequencies(const std::vector<std::string> &words) override;
+	// Gathered from the shards owning the documents and merged by id.
+	std::vector<Posting> postings(const std::string &word, const std::vector<int> *documents = nullptr,
+								  bool positions = false) override;
+
+	// QueryPlan::top over all shards, fanned out on the pool.
+	QueryPlan::Matches top(const QueryPlan &plan, std::size_t limit, const SearchCursor &after = {},
+						   const StaticRank *ranks = nullptr);
+	// QueryPlan::execute against this index; only the URLs come from db.
+	std::vector<SearchResult> execute(const QueryPlan &plan, Database &db, std::size_t limit,
+									  const SearchCursor &after = {}, bool termFrequencies = false,
+									  const StaticRank *ranks = nullptr);
+
+	const std::vector<Shard> &shards() const { return shards_; }
+	const std::shared_ptr<ShardPool> &pool() const { return pool_; }
+	std::size_t documents() const;
+	std::size_t postingCount() const;
+	std::size_t memoryBytes() const;
+	// Database::generation() the index was loaded or caught up at, or one
+	// before it when the index was known to lack documents.
+	std::uint64_t generation() const { return generation_; }
+	// Largest document id the index has read up to.
+	int highWater() const { return highWater_; }
+	// Database::serverTime() when the last full load began; postings
+	// written since then to documents up to highWater() are missing.
+	std::chrono::system_clock::time_point loadedAt() const { return loadedAt_; }
+
+private:
+	std::vector<Shard> shards_;
+	std::shared_ptr<ShardPool> pool_;
+	std::uint64_t generation_;
+	int highWater_;
+	std::chrono::system_clock::time_point loadedAt_;
+
+	// Postings of the documents in (afterDocId, upToDocId], one segment per shard.
+	static std::vector<std::shared_ptr<IndexShard>> read(Database &db, int afterDocId, int upToDocId, std::size_t shards,
+														 ShardPool &pool, std::size_t batchRows);
+};
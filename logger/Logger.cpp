@@ -0,0 +1,377 @@
+#include "Logger.h"
+#include "../metrics/Metrics.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	constexpr std::size_t kLevels = static_cast<std::size_t>(LogLevel::off);
+	constexpr std::uint8_t kPadding = 0xff; // fills the end of the ring when a record does not fit before the wrap
+	constexpr std::size_t kMaxTag = 64;
+	constexpr std::size_t kMaxText = 0xffff;
+
+	const char *levelName(std::size_t level)
+	{
+		static const char *names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+		return names[level];
+	}
+
+	// A record is this header, the tag and the text, padded to a multiple
+	// of the header size so a padding header always fits before the wrap.
+	struct Header
+	{
+		std::uint32_t size;
+		std::uint16_t textLength;
+		std::uint8_t tagLength;
+		std::uint8_t level;
+		std::int64_t time; // nanoseconds since the epoch
+	};
+	static_assert(sizeof(Header) == 16, "records are aligned to the header size");
+
+	std::size_t alignRecord(std::size_t n)
+	{
+		return (n + sizeof(Header) - 1) & ~(sizeof(Header) - 1);
+	}
+
+	struct Line
+	{
+		std::int64_t time;
+		unsigned thread;
+		std::size_t level;
+		std::string tag;
+		std::string text;
+	};
+
+	// Single producer (the owning thread), single consumer (the flusher).
+	// head and tail only grow; a position is taken modulo the capacity.
+	class Ring
+	{
+	public:
+		Ring(std::size_t bytes, unsigned thread) : thread_(thread)
+		{
+			std::size_t capacity = 4096;
+			while (capacity < bytes)
+				capacity <<= 1;
+			data_.resize(capacity);
+		}
+
+		bool push(LogLevel level, const char *tag, const std::string &text)
+		{
+			std::size_t capacity = data_.size();
+			std::size_t tagLength = std::min(std::strlen(tag), kMaxTag);
+			// A line may take a quarter of the ring at most; longer ones are cut.
+			std::size_t textLength = std::min({text.size(), kMaxText, capacity / 4 - sizeof(Header) - tagLength});
+			std::size_t need = alignRecord(sizeof(Header) + tagLength + textLength);
+
+			std::uint64_t head = head_.load(std::memory_order_relaxed);
+			std::uint64_t used = head - tail_.load(std::memory_order_acquire);
+			std::size_t offset = head & (capacity - 1);
+			std::size_t skip = capacity - offset < need ? capacity - offset : 0;
+			std::size_t limit = level < LogLevel::warn ? capacity / 4 * 3 : capacity;
+			if (used + skip + need > limit)
+			{
+				dropped_[static_cast<std::size_t>(level)].fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			if (skip)
+			{
+				Header pad{static_cast<std::uint32_t>(skip), 0, 0, kPadding, 0};
+				std::memcpy(&data_[offset], &pad, sizeof(pad));
+				offset = 0;
+			}
+			Header header{static_cast<std::uint32_t>(need), static_cast<std::uint16_t>(textLength),
+						  static_cast<std::uint8_t>(tagLength), static_cast<std::uint8_t>(level),
+						  std::chrono::duration_cast<std::chrono::nanoseconds>(
+							  std::chrono::system_clock::now().time_since_epoch())
+							  .count()};
+			std::memcpy(&data_[offset], &header, sizeof(header));
+			std::memcpy(&data_[offset + sizeof(header)], tag, tagLength);
+			std::memcpy(&data_[offset + sizeof(header) + tagLength], text.data(), textLength);
+			head_.store(head + skip + need, std::memory_order_release);
+			return true;
+		}
+
+		void drain(std::vector<Line> &out)
+		{
+			std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+			std::uint64_t head = head_.load(std::memory_order_acquire);
+			while (tail != head)
+			{
+				const char *record = &data_[tail & (data_.size() - 1)];
+				Header header;
+				std::memcpy(&header, record, sizeof(header));
+				if (header.level != kPadding)
+				{
+					const char *tag = record + sizeof(header);
+					out.push_back({header.time, thread_, header.level, std::string(tag, header.tagLength),
+								   std::string(tag + header.tagLength, header.textLength)});
+				}
+				tail += header.size;
+			}
+			tail_.store(tail, std::memory_order_release);
+		}
+
+		bool fillingUp() const
+		{
+			return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed) > data_.size() / 2;
+		}
+
+		std::uint64_t takeDropped(std::size_t level) { return dropped_[level].exchange(0, std::memory_order_relaxed); }
+
+		std::atomic<bool> orphaned{false}; // the owning thread has exited
+
+	private:
+		std::vector<char> data_;
+		unsigned thread_;
+		alignas(64) std::atomic<std::uint64_t> head_{0};
+		alignas(64) std::atomic<std::uint64_t> tail_{0};
+		std::array<std::atomic<std::uint64_t>, kLevels> dropped_{};
+	};
+
+	struct State
+	{
+		std::mutex mtx; // rings, options and the flusher's lifecycle; producers only take it once per thread
+		std::condition_variable cv;
+		std::vector<std::shared_ptr<Ring>> rings;
+		LogOptions options;
+		unsigned nextThread = 0;
+		std::thread flusher;
+		bool stopping = false;
+		std::atomic<bool> stopped{false};
+		std::atomic<bool> wake{false};
+
+		std::mutex outMtx; // out; held by the flusher while writing
+		std::FILE *out = stderr;
+
+		std::atomic<std::uint64_t> dropped{0};
+	};
+
+	// Never destroyed: threads may still log while statics are torn down.
+	State &state()
+	{
+		static State *instance = []
+		{
+			auto *s = new State;
+			Metrics::callback("log_dropped_total", "Log lines dropped because their thread's ring buffer was full.", "counter",
+							  []
+							  { return static_cast<double>(Logger::dropped()); });
+			return s;
+		}();
+		return *instance;
+	}
+
+	void appendLine(std::string &buf, const Line &line)
+	{
+		std::time_t seconds = static_cast<std::time_t>(line.time / 1000000000);
+		std::tm tm{};
+		localtime_r(&seconds, &tm);
+		char stamp[64];
+		std::size_t n = std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+		std::snprintf(stamp + n, sizeof(stamp) - n, ".%03d %-5s %u ", static_cast<int>(line.time / 1000000 % 1000),
+					  levelName(line.level), line.thread);
+		buf += stamp;
+		if (!line.tag.empty())
+			buf += "[" + line.tag + "] ";
+		buf += line.text;
+		if (buf.empty() || buf.back() != '\n')
+			buf += '\n';
+	}
+
+	// Drains every ring and writes the lines out in time order. Only the
+	// flusher calls this.
+	void flush(State &s)
+	{
+		std::vector<std::shared_ptr<Ring>> rings;
+		{
+			std::lock_guard<std::mutex> lk(s.mtx);
+			rings = s.rings;
+		}
+
+		std::vector<Line> lines;
+		std::array<std::uint64_t, kLevels> dropped{};
+		std::vector<Ring *> finished;
+		for (auto &ring : rings)
+		{
+			// Read before draining: an orphaned ring gets no more lines.
+			bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+			ring->drain(lines);
+			for (std::size_t level = 0; level < kLevels; ++level)
+				dropped[level] += ring->takeDropped(level);
+			if (orphaned)
+				finished.push_back(ring.get());
+		}
+		if (!finished.empty())
+		{
+			std::lock_guard<std::mutex> lk(s.mtx);
+			s.rings.erase(std::remove_if(s.rings.begin(), s.rings.end(), [&](const std::shared_ptr<Ring> &ring)
+										 { return std::find(finished.begin(), finished.end(), ring.get()) != finished.end(); }),
+						  s.rings.end());
+		}
+
+		// Each ring is in order already; this interleaves the threads.
+		std::stable_sort(lines.begin(), lines.end(), [](const Line &a, const Line &b)
+						 { return a.time < b.time; });
+		std::string buf;
+		for (const auto &line : lines)
+			appendLine(buf, line);
+
+		std::uint64_t total = 0;
+		std::string summary;
+		for (std::size_t level = 0; level < kLevels; ++level)
+		{
+			if (!dropped[level])
+				continue;
+			total += dropped[level];
+			summary += (summary.empty() ? "" : ", ") + std::to_string(dropped[level]) + " " + levelName(level);
+		}
+		if (total)
+		{
+			s.dropped.fetch_add(total, std::memory_order_relaxed);
+			appendLine(buf, {std::chrono::duration_cast<std::chrono::nanoseconds>(
+								 std::chrono::system_clock::now().time_since_epoch())
+								 .count(),
+							 0, static_cast<std::size_t>(LogLevel::warn), "LOG",
+							 "ring buffers full, dropped " + std::to_string(total) + " lines (" + summary + ")"});
+		}
+
+		if (buf.empty())
+			return;
+		std::lock_guard<std::mutex> lk(s.outMtx);
+		std::fwrite(buf.data(), 1, buf.size(), s.out);
+		std::fflush(s.out);
+	}
+
+	void runFlusher(State &s)
+	{
+		std::unique_lock<std::mutex> lk(s.mtx);
+		while (!s.stopping)
+		{
+			s.cv.wait_for(lk, s.options.flushInterval, [&s]
+						  { return s.stopping || s.wake.load(std::memory_order_relaxed); });
+			s.wake.store(false, std::memory_order_relaxed);
+			lk.unlock();
+			flush(s);
+			lk.lock();
+		}
+		lk.unlock();
+		flush(s);
+	}
+
+	// The calling thread's ring, registered on its first line and left for
+	// the flusher to drain and remove when the thread exits.
+	Ring *threadRing()
+	{
+		struct Owner
+		{
+			std::shared_ptr<Ring> ring;
+			~Owner()
+			{
+				if (ring)
+					ring->orphaned.store(true, std::memory_order_release);
+			}
+		};
+		thread_local Owner owner;
+		if (owner.ring)
+			return owner.ring.get();
+
+		auto &s = state();
+		std::lock_guard<std::mutex> lk(s.mtx);
+		if (s.stopped.load())
+			return nullptr;
+		owner.ring = std::make_shared<Ring>(s.options.ringBytes, ++s.nextThread);
+		s.rings.push_back(owner.ring);
+		if (!s.flusher.joinable())
+		{
+			s.flusher = std::thread(runFlusher, std::ref(s));
+			static bool registered = (std::atexit(Logger::shutdown), true);
+			(void)registered;
+		}
+		return owner.ring.get();
+	}
+}
+
+LogLevel parseLogLevel(const std::string &name)
+{
+	if (name == "debug")
+		return LogLevel::debug;
+	if (name == "warn")
+		return LogLevel::warn;
+	if (name == "error")
+		return LogLevel::error;
+	if (name == "off")
+		return LogLevel::off;
+	return LogLevel::info;
+}
+
+void Logger::configure(const LogOptions &options)
+{
+	auto &s = state();
+	threshold_.store(options.level, std::memory_order_relaxed);
+
+	std::FILE *out = stderr;
+	if (!options.file.empty())
+	{
+		out = std::fopen(options.file.c_str(), "a");
+		if (!out)
+		{
+			std::fprintf(stderr, "Cannot open log file %s: %s\n", options.file.c_str(), std::strerror(errno));
+			out = stderr;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lk(s.outMtx);
+		if (s.out != stderr)
+			std::fclose(s.out);
+		s.out = out;
+	}
+	{
+		std::lock_guard<std::mutex> lk(s.mtx);
+		s.options = options;
+	}
+	s.cv.notify_one();
+}
+
+void Logger::shutdown()
+{
+	auto &s = state();
+	std::thread flusher;
+	{
+		std::lock_guard<std::mutex> lk(s.mtx);
+		s.stopped.store(true);
+		if (!s.flusher.joinable())
+			return;
+		s.stopping = true;
+		flusher = std::move(s.flusher);
+	}
+	s.cv.notify_one();
+	flusher.join();
+}
+
+bool Logger::write(LogLevel level, const char *tag, const std::string &text)
+{
+	if (level >= LogLevel::off)
+		return false;
+	Ring *ring = threadRing();
+	if (!ring || !ring->push(level, tag, text))
+		return false;
+	auto &s = state();
+	if (ring->fillingUp() && !s.wake.exchange(true, std::memory_order_relaxed))
+		s.cv.notify_one();
+	return true;
+}
+
+std::uint64_t Logger::dropped()
+{
+	return state().dropped.load(std::memory_order_relaxed);
+}
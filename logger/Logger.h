@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+enum class LogLevel
+{
+	debug,
+	info,
+	warn,
+	error,
+	off
+};
+
+// "debug", "info", "warn", "error" or "off"; anything else is info.
+LogLevel parseLogLevel(const std::string &name);
+
+struct LogOptions
+{
+	LogLevel level = LogLevel::info;
+	std::string file;						   // appended to; empty for stderr
+	std::size_t ringBytes = 64 * 1024;		   // per logging thread, rounded up to a power of two
+	std::chrono::milliseconds flushInterval{100}; // the flusher also wakes early when a ring fills up
+};
+
+// Asynchronous logger. Every thread writes into its own single-producer
+// ring buffer and a background thread drains all of them, orders the lines
+// by time and writes them out, so a logging call costs one formatted
+// string and a copy, never a lock or a write(2).
+//
+// A full ring drops the line instead of waiting. Lines below warn are
+// dropped once a ring is three-quarters full, so errors still find room
+// when a crawler floods it with per-page lines; the flusher reports what
+// was dropped as one summary line per flush and as log_dropped_total.
+//
+//   LOG_INFO("WORKER") << "downloading: " << url;
+//
+// The stream expression is only evaluated when the level is enabled.
+class Logger
+{
+public:
+	// May be called again; rings already created keep their size.
+	static void configure(const LogOptions &options);
+	// Writes out everything logged so far and stops the flusher; lines
+	// logged after that are lost. Also run at exit.
+	static void shutdown();
+
+	static bool enabled(LogLevel level) { return level >= threshold_.load(std::memory_order_relaxed); }
+	// Never blocks; false when the line was dropped.
+	static bool write(LogLevel level, const char *tag, const std::string &text);
+	static std::uint64_t dropped();
+
+private:
+	inline static std::atomic<LogLevel> threshold_{LogLevel::info};
+};
+
+// One line, handed to Logger::write when the statement ends.
+class LogLine
+{
+public:
+	LogLine(LogLevel level, const char *tag) : level_(level), tag_(tag) {}
+	~LogLine() { Logger::write(level_, tag_, out_.str()); }
+	LogLine(const LogLine &) = delete;
+	LogLine &operator=(const LogLine &) = delete;
+
+	template <class T>
+	LogLine &operator<<(const T &value)
+	{
+		out_ << value;
+		return *this;
+	}
+
+private:
+	LogLevel level_;
+	const char *tag_;
+	std::ostringstream out_;
+};
+
+// A one-pass loop rather than if/else, so the macro nests under an
+// unbraced if without a dangling else.
+#define LOG_AT(level, tag) \
+	for (bool logEnabled_ = Logger::enabled(level); logEnabled_; logEnabled_ = false) \
+	LogLine(level, tag)
+
+#define LOG_DEBUG(tag) LOG_AT(LogLevel::debug, tag)
+#define LOG_INFO(tag) LOG_AT(LogLevel::info, tag)
+#define LOG_WARN(tag) LOG_AT(LogLevel::warn, tag)
+#define LOG_ERROR(tag) LOG_AT(LogLevel::error, tag)
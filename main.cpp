@@ -10,7 +10,48 @@
 #include "spider/Spider.h"
 #include "server/Server.h"
 #include "file_indexer/Indexer.h"
+#include "file_indexer/NearDuplicateIndex.h"
 #include "database/Database.h"
+#include "database/PgFrontier.h"
+#include "metrics/Metrics.h"
+#include "logger/Logger.h"
+#include "ranking/PageRank.h"
+#include "ranking/StaticRank.h"
+#include "index/IndexSnapshot.h"
+
+enum class DedupMode
+{
+    off,
+    skip,      // near-duplicates are not stored at all
+    canonical  // stored as a document pointing at its canonical copy, without postings
+};
+
+struct IndexOptions
+{
+    bool incremental = false;
+    DedupMode dedup = DedupMode::off;
+    int maxDistance = 3;
+};
+
+struct RankingOptions
+{
+    bool afterCrawl = true;    // recompute PageRank when a crawl ends
+    double staticWeight = 0.5; // of StaticRank::boost; 0 ranks by term score alone
+    PageRankOptions pageRank;
+};
+
+// Ranks the crawled link graph, switches search over to the new ranks and stores them.
+void updateStaticRanks(Database &db, const RankingOptions &options)
+{
+    PageRankStats stats;
+    auto ranks = PageRank::rankDocuments(db, options.pageRank, &stats);
+    // Published before storing: storing invalidates the result cache, which
+    // must not refill with results scored by the old ranks.
+    StaticRank::publish(std::make_shared<const StaticRank>(ranks, options.staticWeight));
+    db.storeStaticRanks(ranks);
+    std::cout << "PageRank: " << stats.nodes << " документов, " << stats.edges << " ссылок, "
+              << stats.iterations << " итераций, " << stats.elapsed.count() << " мс.\n";
+}
 
 std::vector<std::string> splitQuery(const std::string &query)
 {
@@ -56,25 +97,166 @@ std::string generateResultsPage(const std::vector<SearchResult> &results, const
     return html.str();
 }
 
-void runSpider(Database& db, const std::string& startUrl, int maxDepth, int numThreads, std::atomic<bool>& spiderRunning)
+void runSpider(Database& db, const SpiderOptions& options, const IndexOptions& indexOptions, const RankingOptions& rankingOptions, PgFrontier* frontier, const std::string& startUrl, int maxDepth, int numThreads, std::atomic<bool>& spiderRunning)
 {
     try
     {
-        Spider spider;
-        spider.crawl(startUrl, maxDepth, numThreads,
-                     [&](const std::string &url, const std::string &html, int depth)
-                     {
-                         std::cout << "Page: " << url << " (depth " << depth << ")\n";
-
-                         std::string clean = Indexer::cleanHTML(html);
-                         auto words = Indexer::analyzeText(clean);
-
-                         int docId = db.insertDocument(url);
-                         db.insertWordFrequency(docId, words);
-                     });
-        
+        Spider spider(options);
+
+        // Documents from earlier crawls. On an incremental re-crawl they are
+        // all revisited with conditional requests, and pages whose cleaned
+        // text hashes the same as last time are not re-indexed.
+        std::unordered_map<std::string, DocumentMeta> known;
+        NearDuplicateIndex duplicates(indexOptions.maxDistance);
+        if (indexOptions.incremental || indexOptions.dedup != DedupMode::off)
+        {
+            for (auto &meta : db.loadDocumentMeta())
+            {
+                if (meta.simhash && !meta.canonicalId)
+                    duplicates.insert(meta.simhash, meta.id);
+                known.emplace(meta.url, std::move(meta));
+            }
+        }
+
+        if (indexOptions.incremental)
+        {
+            for (const auto &entry : known)
+                spider.addSeed(entry.first, entry.second.depth);
+            std::cout << "Инкрементальный обход: " << known.size() << " известных документов\n";
+
+            spider.setValidatorLookup([&known](const std::string &url, Spider::Validators &validators)
+                                      {
+                                          auto it = known.find(url);
+                                          if (it == known.end())
+                                              return false;
+                                          validators.etag = it->second.etag;
+                                          validators.lastModified = it->second.lastModified;
+                                          return true;
+                                      });
+        }
+
+        std::atomic<int> notModified{0};
+        std::atomic<int> unchanged{0};
+        std::atomic<int> indexed{0};
+        std::atomic<int> nearDuplicates{0};
+        std::atomic<std::size_t> rowsSaved{0};
+
+        Histogram &analyzeTime = Metrics::histogram("index_stage_seconds", "Time per page spent in each indexing stage.", 1e6,
+                                                    "stage=\"analyze\"", 60);
+        Histogram &storeTime = Metrics::histogram("index_stage_seconds", "Time per page spent in each indexing stage.", 1e6,
+                                                  "stage=\"store\"", 60);
+        Counter &indexedPages = Metrics::counter("index_pages_total", "Pages written to the index.");
+
+        // Outgoing links by target URL hash, for PageRank.
+        auto storeLinks = [&db](int docId, const Spider::Page &page)
+        {
+            std::vector<std::uint64_t> targets;
+            targets.reserve(page.links.size());
+            for (const auto &link : page.links)
+                targets.push_back(LinkGraph::urlHash(link));
+            db.replaceLinks(docId, std::move(targets));
+        };
+
+        auto onPage = [&](const Spider::Page &page)
+        {
+            if (page.notModified)
+            {
+                db.touchDocument(page.url);
+                ++notModified;
+                return;
+            }
+
+            DocumentMeta meta;
+            meta.url = page.url;
+            meta.etag = page.validators.etag;
+            meta.lastModified = page.validators.lastModified;
+            meta.contentHash = Indexer::contentHash(page.text);
+            meta.depth = page.depth;
+
+            auto it = known.find(page.url);
+            if (it != known.end() && it->second.contentHash == meta.contentHash)
+            {
+                meta.simhash = it->second.simhash;
+                meta.canonicalId = it->second.canonicalId;
+                storeLinks(db.upsertDocument(meta), page);
+                ++unchanged;
+                return;
+            }
+
+            Indexer::Positions positions;
+            std::unordered_map<std::string, int> words;
+            {
+                ScopedTimer timer(analyzeTime);
+                words = Indexer::analyzeText(page.text, &positions);
+            }
+            meta.simhash = Indexer::simhash(words);
+
+            int ownId = (it != known.end()) ? it->second.id : 0;
+            int canonicalId = 0;
+            if (indexOptions.dedup != DedupMode::off && !words.empty())
+                canonicalId = duplicates.find(meta.simhash, ownId);
+
+            if (canonicalId)
+            {
+                // The content the old fingerprint stood for is gone.
+                if (ownId)
+                    duplicates.remove(ownId);
+                ++nearDuplicates;
+                rowsSaved += words.size();
+                LOG_INFO("INDEX") << "Near-duplicate: " << page.url << " (of document " << canonicalId << ")";
+                // A skipped page that was indexed before still loses its old
+                // postings, or its stale text would stay searchable.
+                if (indexOptions.dedup == DedupMode::canonical || ownId)
+                {
+                    if (indexOptions.dedup == DedupMode::canonical)
+                        meta.canonicalId = canonicalId;
+                    int docId = db.upsertDocument(meta);
+                    db.insertWordFrequency(docId, {});
+                    storeLinks(docId, page);
+                }
+                return;
+            }
+
+            LOG_INFO("INDEX") << "Page: " << page.url << " (depth " << page.depth << ")";
+
+            int docId;
+            {
+                ScopedTimer timer(storeTime);
+                docId = db.upsertDocument(meta);
+                db.insertWordFrequency(docId, words, positions);
+                storeLinks(docId, page);
+            }
+            indexedPages.add();
+            if (indexOptions.dedup != DedupMode::off)
+                duplicates.insert(meta.simhash, docId);
+            ++indexed;
+        };
+
+        if (frontier)
+        {
+            std::cout << "Общая очередь обхода, процесс " << frontier->owner() << "\n";
+            spider.crawl(*frontier, startUrl, maxDepth, numThreads, onPage);
+            std::cout << "Перехвачено просроченных аренд: " << frontier->reclaimed() << "\n";
+        }
+        else
+        {
+            spider.crawl(startUrl, maxDepth, numThreads, onPage);
+        }
+
         spiderRunning = false;
-        std::cout << "Индексирование завершено.\n";
+        std::cout << "Индексирование завершено: проиндексировано " << indexed
+                  << ", без изменений " << unchanged
+                  << ", не изменено (304) " << notModified << ".\n";
+        if (indexOptions.dedup != DedupMode::off)
+        {
+            // ~40 bytes per word_freq row: tuple header, three ints and the primary key entry.
+            std::cout << "Почти-дубликатов: " << nearDuplicates << ", не записано строк word_freq: " << rowsSaved
+                      << " (~" << rowsSaved * 40 / 1024 << " KiB), индекс отпечатков: "
+                      << duplicates.size() << " документов, " << duplicates.memoryBytes() / 1024 << " KiB.\n";
+        }
+
+        if (rankingOptions.afterCrawl)
+            updateStaticRanks(db, rankingOptions);
     }
     catch (const std::exception& e)
     {
@@ -83,18 +265,31 @@ void runSpider(Database& db, const std::string& startUrl, int maxDepth, int numT
     }
 }
 
-void runServer(unsigned short port, std::atomic<bool>& spiderRunning)
+void runServer(unsigned short port, int ioThreads, ServerOptions options, std::shared_ptr<QueryExecutor> executor,
+               std::shared_ptr<SearchCache> cache, std::shared_ptr<StaticAssets> assets, std::shared_ptr<Suggester> suggester,
+               std::shared_ptr<MemoryIndex> memoryIndex, std::atomic<bool>& spiderRunning)
 {
     try
     {
-        boost::asio::io_context ioc;
-        auto server = std::make_shared<Server>(ioc, port);
+        if (ioThreads <= 0)
+            ioThreads = std::max(1u, std::thread::hardware_concurrency());
+        options.acceptors = ioThreads;
+
+        boost::asio::io_context ioc(ioThreads);
+        auto server = std::make_shared<Server>(ioc, port, executor, cache, assets, suggester, memoryIndex, options);
         server->run();
         
-        std::cout << "Сервер запущен: http://localhost:" << port << std::endl;
+        std::cout << "Сервер запущен: http://localhost:" << port << " (потоков ввода-вывода: " << ioThreads
+                  << ", потоков запросов: " << executor->workers() << ")" << std::endl;
         std::cout << "Паук " << (spiderRunning ? "запущен" : "завершил работу") << std::endl;
         
+        std::vector<std::thread> pool;
+        pool.reserve(ioThreads - 1);
+        for (int i = 1; i < ioThreads; ++i)
+            pool.emplace_back([&ioc] { ioc.run(); });
         ioc.run();
+        for (auto &t : pool)
+            t.join();
     }
     catch (const std::exception& e)
     {
@@ -102,8 +297,18 @@ void runServer(unsigned short port, std::atomic<bool>& spiderRunning)
     }
 }
 
-int main()
+// diploma            crawl and serve
+// diploma pagerank   recompute the static ranks of the crawled documents and exit
+// diploma snapshot   write the index snapshot the server starts from and exit
+int main(int argc, char **argv)
 {
+    std::string command = argc > 1 ? argv[1] : "";
+    if (!command.empty() && command != "pagerank" && command != "snapshot")
+    {
+        std::cerr << "Неизвестная команда: " << command << " (доступны: pagerank, snapshot)" << std::endl;
+        return 2;
+    }
+
     // Locale
     boost::locale::generator gen;
     std::locale::global(gen("en_US.UTF-8"));
@@ -119,6 +324,15 @@ int main()
             return 1;
         }
 
+        // Crawler and server threads log through per-thread ring buffers;
+        // a background thread writes the lines out every flush_ms.
+        LogOptions logOptions;
+        logOptions.level = parseLogLevel(parser.get("Log", "level", "info"));
+        logOptions.file = parser.get("Log", "file", "");
+        logOptions.ringBytes = std::stoul(parser.get("Log", "ring_kb", "64")) * 1024;
+        logOptions.flushInterval = std::chrono::milliseconds(std::stoi(parser.get("Log", "flush_ms", "100")));
+        Logger::configure(logOptions);
+
         std::string dbname = parser.get("Database", "dbname");
         std::string user = parser.get("Database", "user");
         std::string pass = parser.get("Database", "password");
@@ -137,23 +351,152 @@ int main()
         std::string startUrl = parser.get("Spider", "start_url");
         int maxDepth = std::stoi(parser.get("Spider", "max_depth", "2"));
         int numThreads = std::stoi(parser.get("Spider", "threads", "2"));
+
+        SpiderOptions spiderOptions;
+        spiderOptions.compression = parser.get("Spider", "compression", "true") == "true";
+        spiderOptions.maxBodySize = std::stoul(parser.get("Spider", "max_body_size", "5242880"));
+        spiderOptions.streamTokenize = parser.get("Spider", "stream_tokenize", "false") == "true";
+        spiderOptions.visited.backend = parser.get("Spider", "visited_backend", "fingerprint64");
+        spiderOptions.visited.bloom = parser.get("Spider", "visited_bloom", "false") == "true";
+        spiderOptions.visited.spillDir = parser.get("Spider", "visited_spill_dir", "");
+        spiderOptions.checkpointDir = parser.get("Spider", "checkpoint_dir", "");
+        spiderOptions.resume = parser.get("Spider", "resume", "false") == "true";
+        spiderOptions.snapshotIntervalSec = std::stoi(parser.get("Spider", "snapshot_interval", "60"));
+        spiderOptions.maxDuration = std::chrono::seconds(std::stoi(parser.get("Spider", "max_duration", "600")));
+        spiderOptions.politenessDelayMs = std::stoi(parser.get("Spider", "politeness_delay_ms", "100"));
+
+        IndexOptions indexOptions;
+        indexOptions.incremental = parser.get("Spider", "incremental", "false") == "true";
+        std::string dedup = parser.get("Indexer", "dedup", "off");
+        indexOptions.dedup = dedup == "skip" ? DedupMode::skip : dedup == "canonical" ? DedupMode::canonical : DedupMode::off;
+        indexOptions.maxDistance = std::stoi(parser.get("Indexer", "max_distance", "3"));
+        if (indexOptions.maxDistance < 0 || indexOptions.maxDistance > NearDuplicateIndex::maxSupportedDistance)
+        {
+            std::cerr << "max_distance в [Indexer] должно быть от 0 до " << NearDuplicateIndex::maxSupportedDistance
+                      << std::endl;
+            return 1;
+        }
+
+        RankingOptions rankingOptions;
+        rankingOptions.afterCrawl = parser.get("Ranking", "after_crawl", "true") == "true";
+        rankingOptions.staticWeight = std::stod(parser.get("Ranking", "static_weight", "0.5"));
+        rankingOptions.pageRank.damping = std::stod(parser.get("Ranking", "damping", "0.85"));
+        rankingOptions.pageRank.tolerance = std::stod(parser.get("Ranking", "tolerance", "0.000001"));
+        rankingOptions.pageRank.maxIterations = std::stoi(parser.get("Ranking", "max_iterations", "100"));
+        rankingOptions.pageRank.threads = std::stoi(parser.get("Ranking", "threads", "0"));
+
+        // Posting lists held in memory, split into index_shards shards searched in parallel; refreshed
+        // at most every index_rebuild seconds while the crawler adds pages.
+        bool memoryIndexEnabled = parser.get("SearchServer", "memory_index", "true") == "true";
+        MemoryIndexOptions memoryIndexOptions;
+        memoryIndexOptions.shards = std::stoul(parser.get("SearchServer", "index_shards", "4"));
+        memoryIndexOptions.threads = std::stoi(parser.get("SearchServer", "index_threads", "0"));
+        memoryIndexOptions.rebuildInterval = std::chrono::seconds(std::stoi(parser.get("SearchServer", "index_rebuild", "60")));
+        // Mapped at startup instead of reading word_freq; only pages added since it was written are read.
+        memoryIndexOptions.snapshotPath = parser.get("SearchServer", "index_snapshot", "index.snapshot");
+        memoryIndexOptions.verifySnapshot = parser.get("SearchServer", "index_snapshot_verify", "false") == "true";
+        memoryIndexOptions.fullReloadInterval = std::chrono::seconds(std::stoi(parser.get("SearchServer", "index_full_reload", "3600")));
+
+        if (command == "pagerank")
+        {
+            updateStaticRanks(db, rankingOptions);
+            Logger::shutdown();
+            return 0;
+        }
+        if (command == "snapshot")
+        {
+            if (memoryIndexOptions.snapshotPath.empty())
+            {
+                std::cerr << "Не задан путь снимка индекса (index_snapshot в [SearchServer])" << std::endl;
+                return 1;
+            }
+            auto pool = std::make_shared<ShardPool>(memoryIndexOptions.threads);
+            auto index = ShardedIndex::load(db, memoryIndexOptions.shards, pool, Database::generation(), memoryIndexOptions.batchRows);
+            IndexSnapshot::save(*index, memoryIndexOptions.snapshotPath);
+            std::cout << "Снимок индекса записан в " << memoryIndexOptions.snapshotPath << ": " << index->documents()
+                      << " документов (до id " << index->highWater() << "), " << index->postingCount() << " записей." << std::endl;
+            Logger::shutdown();
+            return 0;
+        }
+        // Ranks from the last PageRank run until the next one replaces them.
+        StaticRank::publish(std::make_shared<const StaticRank>(db.loadStaticRanks(), rankingOptions.staticWeight));
         
+        // Several processes (on any machines) crawl together from one frontier table.
+        std::unique_ptr<PgFrontier> frontier;
+        if (parser.get("Frontier", "shared", "false") == "true")
+        {
+            FrontierOptions frontierOptions;
+            frontierOptions.partitions = std::stoi(parser.get("Frontier", "partitions", "64"));
+            frontierOptions.slotsPerHost = std::stoi(parser.get("Frontier", "slots_per_host", "1"));
+            frontierOptions.maxPartitions = std::stoi(parser.get("Frontier", "max_partitions", "8"));
+            frontierOptions.leaseSec = std::stoi(parser.get("Frontier", "lease_seconds", "60"));
+            spiderOptions.frontierBatch = std::stoi(parser.get("Frontier", "batch", "16"));
+            // Renewed every third of it, so it has to leave room for a renewal that is late.
+            if (frontierOptions.leaseSec < 3)
+            {
+                std::cerr << "lease_seconds в [Frontier] должно быть не меньше 3" << std::endl;
+                return 1;
+            }
+
+            frontier = std::make_unique<PgFrontier>(connStr, frontierOptions);
+            frontier->ensureSchema();
+            if (parser.get("Frontier", "reset", "false") == "true")
+                frontier->reset();
+        }
+
         unsigned short port = static_cast<unsigned short>(std::stoi(parser.get("SearchServer", "port", "8080")));
+        int ioThreads = std::stoi(parser.get("SearchServer", "io_threads", "0"));
+        ServerOptions serverOptions;
+        serverOptions.idleTimeout = std::chrono::seconds(std::stoi(parser.get("SearchServer", "idle_timeout", "30")));
+        serverOptions.readTimeout = std::chrono::seconds(std::stoi(parser.get("SearchServer", "read_timeout", "10")));
+        serverOptions.writeTimeout = std::chrono::seconds(std::stoi(parser.get("SearchServer", "write_timeout", "10")));
+        serverOptions.maxRequests = std::stoul(parser.get("SearchServer", "max_requests", "1000"));
+        serverOptions.maxPipeline = std::stoul(parser.get("SearchServer", "max_pipeline", "16"));
+        serverOptions.queryTimeout = std::chrono::milliseconds(std::stoi(parser.get("SearchServer", "query_timeout_ms", "2000")));
+        serverOptions.maxClientQueries = std::stoul(parser.get("SearchServer", "client_queries", "8"));
+        // Queries estimated to read more postings than this are refused instead of stalling a query thread.
+        serverOptions.queryLimits.maxTerms = std::stoul(parser.get("SearchServer", "query_max_terms", "32"));
+        serverOptions.queryLimits.maxPostings = std::stoul(parser.get("SearchServer", "query_max_postings", "500000"));
+        // Searches run here, each worker with its own connection, not on the I/O threads.
+        auto executor = std::make_shared<QueryExecutor>(connStr,
+                                                        std::stoi(parser.get("SearchServer", "query_threads", "4")),
+                                                        std::stoul(parser.get("SearchServer", "query_queue", "256")));
+        // cache_mb = 0 turns the result cache off.
+        auto cache = std::make_shared<SearchCache>(std::stoul(parser.get("SearchServer", "cache_mb", "64")) << 20,
+                                                   std::chrono::seconds(std::stoi(parser.get("SearchServer", "cache_ttl", "300"))));
+        // Preloaded (and pre-gzipped) once; static_reload > 0 re-scans the directory every that many seconds.
+        auto assets = std::make_shared<StaticAssets>(parser.get("SearchServer", "static_dir", "templates"),
+                                                     std::chrono::seconds(std::stoi(parser.get("SearchServer", "static_reload", "0"))));
+        // Background rebuilds get their own workers and connections, one per
+        // rebuilder, so they neither hold up searches nor get turned away by a full query queue.
+        auto loader = std::make_shared<QueryExecutor>(connStr, 2, 8);
+        // Autocomplete dictionary, updated in the background at most every suggest_rebuild seconds while the
+        // index grows, and re-read in full every suggest_full_rebuild seconds.
+        auto suggester = std::make_shared<Suggester>(loader,
+                                                     std::chrono::seconds(std::stoi(parser.get("SearchServer", "suggest_rebuild", "30"))),
+                                                     std::chrono::seconds(std::stoi(parser.get("SearchServer", "suggest_full_rebuild", "3600"))));
+        std::shared_ptr<MemoryIndex> memoryIndex;
+        if (memoryIndexEnabled)
+        {
+            memoryIndex = std::make_shared<MemoryIndex>(loader, memoryIndexOptions);
+            memoryIndex->refresh();
+        }
 
         std::atomic<bool> spiderRunning{true};
 
-        std::thread spiderThread([&db, startUrl, maxDepth, numThreads, &spiderRunning]() {
-            runSpider(db, startUrl, maxDepth, numThreads, spiderRunning);
+        std::thread spiderThread([&db, spiderOptions, indexOptions, rankingOptions, &frontier, startUrl, maxDepth, numThreads, &spiderRunning]() {
+            runSpider(db, spiderOptions, indexOptions, rankingOptions, frontier.get(), startUrl, maxDepth, numThreads, spiderRunning);
         });
 
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-        runServer(port, spiderRunning);
+        runServer(port, ioThreads, serverOptions, executor, cache, assets, suggester, memoryIndex, spiderRunning);
 
         if (spiderThread.joinable()) {
             spiderThread.join();
         }
 
+        Logger::shutdown();
         std::cout << "Приложение завершено." << std::endl;
     }
     catch (std::exception &e)
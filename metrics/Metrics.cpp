@@ -0,0 +1,260 @@
+#include "Metrics.h"
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/resource.h>
+
+namespace
+{
+	struct Series
+	{
+		std::string labels;
+		std::unique_ptr<Counter> counter;
+		std::unique_ptr<Gauge> gauge;
+		std::unique_ptr<Histogram> histogram;
+		double scale = 1;
+		double max = 0; // histograms: largest bucket bound exported
+		std::function<double()> read;
+	};
+
+	struct Family
+	{
+		std::string name;
+		std::string help;
+		std::string type;
+		std::vector<std::unique_ptr<Series>> series;
+	};
+
+	struct Registry
+	{
+		std::mutex mtx;
+		std::vector<std::unique_ptr<Family>> families;
+
+		// Caller holds mtx.
+		Series &find(const std::string &name, const std::string &help, const std::string &type, const std::string &labels)
+		{
+			Family *family = nullptr;
+			for (auto &f : families)
+				if (f->name == name)
+					family = f.get();
+			if (!family)
+			{
+				families.push_back(std::make_unique<Family>(Family{name, help, type, {}}));
+				family = families.back().get();
+			}
+			else if (family->type != type)
+				throw std::logic_error("metric " + name + " registered as " + family->type + " and " + type);
+
+			for (auto &s : family->series)
+				if (s->labels == labels)
+					return *s;
+			family->series.push_back(std::make_unique<Series>());
+			family->series.back()->labels = labels;
+			return *family->series.back();
+		}
+	};
+
+	// Never destroyed: worker threads may still record while statics are torn down.
+	Registry &registry()
+	{
+		static Registry *instance = []
+		{
+			auto *r = new Registry;
+			// The standard process metric, so a load test can tell the server's CPU time apart from its own.
+			r->find("process_cpu_seconds_total", "User and system CPU time spent by the process.", "counter", "").read = []
+			{
+				rusage usage{};
+				::getrusage(RUSAGE_SELF, &usage);
+				return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+					   static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+			};
+			return r;
+		}();
+		return *instance;
+	}
+
+	std::string number(double value)
+	{
+		if (std::isinf(value))
+			return value > 0 ? "+Inf" : "-Inf";
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "%.9g", value);
+		return buf;
+	}
+
+	std::string seriesName(const std::string &name, const std::string &labels, const std::string &extra = "")
+	{
+		if (labels.empty() && extra.empty())
+			return name;
+		return name + "{" + labels + (!labels.empty() && !extra.empty() ? "," : "") + extra + "}";
+	}
+}
+
+std::size_t metricShard()
+{
+	static std::atomic<std::size_t> next{0};
+	thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kMetricShards;
+	return shard;
+}
+
+std::uint64_t Counter::value() const
+{
+	std::uint64_t total = 0;
+	for (const auto &cell : cells_)
+		total += cell.value.load(std::memory_order_relaxed);
+	return total;
+}
+
+std::size_t Histogram::bucketOf(std::uint64_t value)
+{
+	constexpr std::uint64_t sub = 1ULL << kSubBits;
+	if (value < sub)
+		return static_cast<std::size_t>(value);
+	if (value >> kMaxBits)
+		value = (1ULL << kMaxBits) - 1;
+	int exponent = 63 - __builtin_clzll(value);
+	int shift = exponent - kSubBits;
+	return (static_cast<std::size_t>(shift + 1) << kSubBits) + static_cast<std::size_t>((value >> shift) & (sub - 1));
+}
+
+std::uint64_t Histogram::upperBound(std::size_t bucket)
+{
+	constexpr std::size_t sub = 1u << kSubBits;
+	if (bucket < sub)
+		return bucket;
+	int shift = static_cast<int>(bucket >> kSubBits) - 1;
+	std::uint64_t lower = static_cast<std::uint64_t>(sub + (bucket & (sub - 1))) << shift;
+	return lower + (1ULL << shift) - 1;
+}
+
+void Histogram::record(std::uint64_t value)
+{
+	auto &shard = shards_[metricShard()];
+	shard.counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+	shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+	Snapshot snap;
+	snap.counts.assign(kBuckets, 0);
+	for (const auto &shard : shards_)
+	{
+		for (std::size_t b = 0; b < kBuckets; ++b)
+			snap.counts[b] += shard.counts[b].load(std::memory_order_relaxed);
+		snap.sum += shard.sum.load(std::memory_order_relaxed);
+	}
+	for (auto c : snap.counts)
+		snap.count += c;
+	return snap;
+}
+
+std::uint64_t Histogram::Snapshot::percentile(double q) const
+{
+	if (count == 0)
+		return 0;
+	auto target = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count)));
+	target = std::max<std::uint64_t>(1, std::min(target, count));
+	std::uint64_t seen = 0;
+	for (std::size_t b = 0; b < counts.size(); ++b)
+	{
+		seen += counts[b];
+		if (seen >= target)
+			return upperBound(b);
+	}
+	return upperBound(counts.size() - 1);
+}
+
+ScopedTimer::~ScopedTimer()
+{
+	histogram_.record(static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count()));
+}
+
+Counter &Metrics::counter(const std::string &name, const std::string &help, const std::string &labels)
+{
+	auto &r = registry();
+	std::lock_guard<std::mutex> lk(r.mtx);
+	auto &series = r.find(name, help, "counter", labels);
+	if (!series.counter)
+		series.counter = std::make_unique<Counter>();
+	return *series.counter;
+}
+
+Gauge &Metrics::gauge(const std::string &name, const std::string &help, const std::string &labels)
+{
+	auto &r = registry();
+	std::lock_guard<std::mutex> lk(r.mtx);
+	auto &series = r.find(name, help, "gauge", labels);
+	if (!series.gauge)
+		series.gauge = std::make_unique<Gauge>();
+	return *series.gauge;
+}
+
+Histogram &Metrics::histogram(const std::string &name, const std::string &help, double scale, const std::string &labels,
+							  double max)
+{
+	auto &r = registry();
+	std::lock_guard<std::mutex> lk(r.mtx);
+	auto &series = r.find(name, help, "histogram", labels);
+	if (!series.histogram)
+	{
+		series.histogram = std::make_unique<Histogram>();
+		series.scale = scale;
+		series.max = max;
+	}
+	return *series.histogram;
+}
+
+void Metrics::callback(const std::string &name, const std::string &help, const std::string &type,
+					   std::function<double()> read, const std::string &labels)
+{
+	auto &r = registry();
+	std::lock_guard<std::mutex> lk(r.mtx);
+	r.find(name, help, type, labels).read = std::move(read);
+}
+
+std::string Metrics::prometheus()
+{
+	auto &r = registry();
+	std::lock_guard<std::mutex> lk(r.mtx);
+	std::string out;
+	for (const auto &family : r.families)
+	{
+		out += "# HELP " + family->name + " " + family->help + "\n";
+		out += "# TYPE " + family->name + " " + family->type + "\n";
+		for (const auto &series : family->series)
+		{
+			if (series->counter)
+				out += seriesName(family->name, series->labels) + " " + std::to_string(series->counter->value()) + "\n";
+			else if (series->gauge)
+				out += seriesName(family->name, series->labels) + " " + std::to_string(series->gauge->value()) + "\n";
+			else if (series->read)
+				out += seriesName(family->name, series->labels) + " " + number(series->read()) + "\n";
+			else if (series->histogram)
+			{
+				// Cumulative buckets at every power of two up to max, whatever was recorded.
+				auto snap = series->histogram->snapshot();
+				constexpr std::size_t sub = 1u << Histogram::kSubBits;
+				std::uint64_t cumulative = 0;
+				for (std::size_t b = 0; b < snap.counts.size(); ++b)
+				{
+					cumulative += snap.counts[b];
+					if ((b & (sub - 1)) != sub - 1)
+						continue;
+					double le = static_cast<double>(Histogram::upperBound(b) + 1) / series->scale;
+					out += seriesName(family->name + "_bucket", series->labels, "le=\"" + number(le) + "\"") + " " +
+						   std::to_string(cumulative) + "\n";
+					if (series->max > 0 && le >= series->max)
+						break;
+				}
+				out += seriesName(family->name + "_bucket", series->labels, "le=\"+Inf\"") + " " + std::to_string(snap.count) + "\n";
+				out += seriesName(family->name + "_sum", series->labels) + " " + number(snap.sum / series->scale) + "\n";
+				out += seriesName(family->name + "_count", series->labels) + " " + std::to_string(snap.count) + "\n";
+			}
+		}
+	}
+	return out;
+}
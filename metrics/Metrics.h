@@ -0,0 +1,123 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Sharded metrics are split in this many cache-line-sized cells; each
+// thread updates its own cell and readers sum them, so hot counters do not
+// bounce a cache line between cores.
+constexpr std::size_t kMetricShards = 16;
+
+// Cell index of the calling thread, assigned round-robin on first use.
+std::size_t metricShard();
+
+class Counter
+{
+public:
+	void add(std::uint64_t n = 1) { cells_[metricShard()].value.fetch_add(n, std::memory_order_relaxed); }
+	std::uint64_t value() const;
+
+private:
+	struct alignas(64) Cell
+	{
+		std::atomic<std::uint64_t> value{0};
+	};
+	std::array<Cell, kMetricShards> cells_;
+};
+
+class Gauge
+{
+public:
+	void set(std::int64_t value) { value_.store(value, std::memory_order_relaxed); }
+	void add(std::int64_t delta) { value_.fetch_add(delta, std::memory_order_relaxed); }
+	std::int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<std::int64_t> value_{0};
+};
+
+// Log-linear buckets in the manner of HdrHistogram: values below 8 are
+// exact, above that every power of two is split into 8 buckets, so a value
+// is known to within 12.5% over the whole range at a fixed ~3 KB per shard.
+// Values are non-negative integers (microseconds, bytes) up to 2^48.
+class Histogram
+{
+public:
+	static constexpr int kSubBits = 3;
+	static constexpr int kMaxBits = 48;
+	static constexpr std::size_t kBuckets = static_cast<std::size_t>(kMaxBits - kSubBits + 1) << kSubBits;
+
+	struct Snapshot
+	{
+		std::vector<std::uint64_t> counts; // per bucket
+		std::uint64_t count = 0;
+		std::uint64_t sum = 0;
+
+		// Upper bound of the bucket holding the q-th quantile (0 <= q <= 1).
+		std::uint64_t percentile(double q) const;
+	};
+
+	void record(std::uint64_t value);
+	Snapshot snapshot() const;
+
+	static std::size_t bucketOf(std::uint64_t value);
+	// Largest value that falls into bucket.
+	static std::uint64_t upperBound(std::size_t bucket);
+
+private:
+	struct alignas(64) Shard
+	{
+		std::array<std::atomic<std::uint64_t>, kBuckets> counts{};
+		std::atomic<std::uint64_t> sum{0};
+	};
+	std::array<Shard, kMetricShards> shards_;
+};
+
+// Adds the time between construction and destruction, in microseconds.
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(Histogram &histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+	~ScopedTimer();
+	ScopedTimer(const ScopedTimer &) = delete;
+	ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+	Histogram &histogram_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+// Process-wide registry, rendered in the Prometheus text format.
+//
+// Metrics live as long as the process, so call sites keep a reference,
+// typically in a function-local static:
+//
+//   static Counter &pages = Metrics::counter("spider_pages_total", "Pages fetched.");
+//   pages.add();
+//
+// labels is the inside of the braces, e.g. stage="clean"; series of one
+// name share its help text and type.
+class Metrics
+{
+public:
+	static Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "");
+	static Gauge &gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+	// scale converts recorded units to exported ones: 1e6 for microseconds
+	// exported as seconds (the Prometheus convention). Buckets are exported
+	// at every power of two up to the first one reaching max (in exported
+	// units; 0 for the histogram's whole range), always the same set, so
+	// that rate() and histogram_quantile() work across scrapes.
+	static Histogram &histogram(const std::string &name, const std::string &help, double scale = 1,
+								const std::string &labels = "", double max = 0);
+	// Read at scrape time, for values owned elsewhere (queue depths, cache
+	// statistics). type is "counter" or "gauge"; registering the same series
+	// again replaces the function.
+	static void callback(const std::string &name, const std::string &help, const std::string &type,
+						 std::function<double()> read, const std::string &labels = "");
+
+	static std::string prometheus();
+};
@@ -0,0 +1,298 @@
+#include "QueryParser.h"
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+#include "../file_indexer/Indexer.h"
+
+namespace
+{
+	constexpr int kMaxDepth = 32;
+
+	bool isSpace(char c)
+	{
+		return std::isspace(static_cast<unsigned char>(c)) != 0;
+	}
+
+	// Operands of the same kind are merged into one node and repeated ones
+	// dropped, so "a (b a)" is the same AND of two words as "a b".
+	QueryNode combine(QueryNode::Kind kind, std::vector<QueryNode> operands)
+	{
+		QueryNode node;
+		node.kind = kind;
+		std::unordered_set<std::string> seen;
+		for (auto &operand : operands)
+		{
+			std::vector<QueryNode> parts;
+			if (operand.kind == kind)
+				parts = std::move(operand.children);
+			else
+				parts.push_back(std::move(operand));
+			for (auto &part : parts)
+				if (seen.insert(QueryParser::canonical(part)).second)
+					node.children.push_back(std::move(part));
+		}
+		if (node.children.size() == 1)
+			return std::move(node.children.front());
+		return node;
+	}
+
+	void collectTerms(const QueryNode &node, std::vector<std::string> &out, std::unordered_set<std::string> &seen)
+	{
+		if (node.kind == QueryNode::Kind::Not)
+			return;
+		for (const auto &term : node.terms)
+			if (seen.insert(term).second)
+				out.push_back(term);
+		for (const auto &child : node.children)
+			collectTerms(child, out, seen);
+	}
+}
+
+QueryNode QueryParser::parse(const std::string &query, std::size_t maxTerms)
+{
+	QueryParser parser(query, maxTerms);
+	parser.next();
+	if (parser.token_ == Token::End)
+		throw QueryError("the query is empty");
+	QueryNode root;
+	bool found = parser.parseOr(root);
+	if (parser.token_ != Token::End)
+		throw QueryError("unbalanced ')'");
+	if (!found)
+		throw QueryError("the query has no searchable words");
+	validate(root);
+	return root;
+}
+
+void QueryParser::next()
+{
+	while (pos_ < query_.size() && isSpace(query_[pos_]))
+		++pos_;
+	text_.clear();
+	if (pos_ == query_.size())
+	{
+		token_ = Token::End;
+		return;
+	}
+
+	char c = query_[pos_];
+	if (c == '(' || c == ')')
+	{
+		token_ = c == '(' ? Token::Open : Token::Close;
+		++pos_;
+		return;
+	}
+	if (c == '"')
+	{
+		auto close = query_.find('"', pos_ + 1);
+		if (close == std::string::npos)
+			throw QueryError("unterminated quote");
+		text_ = query_.substr(pos_ + 1, close - pos_ - 1);
+		pos_ = close + 1;
+		token_ = Token::Phrase;
+		return;
+	}
+	if (c == '-' && pos_ + 1 < query_.size() && !isSpace(query_[pos_ + 1]))
+	{
+		token_ = Token::Not;
+		++pos_;
+		return;
+	}
+
+	std::size_t start = pos_;
+	while (pos_ < query_.size() && !isSpace(query_[pos_]) && query_[pos_] != '(' && query_[pos_] != ')' && query_[pos_] != '"')
+		++pos_;
+	text_ = query_.substr(start, pos_ - start);
+	if (text_ == "AND" || text_ == "И")
+		token_ = Token::And;
+	else if (text_ == "OR" || text_ == "ИЛИ")
+		token_ = Token::Or;
+	else if (text_ == "NOT" || text_ == "НЕ")
+		token_ = Token::Not;
+	else
+		token_ = Token::Word;
+}
+
+bool QueryParser::parseOr(QueryNode &out)
+{
+	std::vector<QueryNode> operands;
+	QueryNode operand;
+	if (parseAnd(operand))
+		operands.push_back(std::move(operand));
+	while (token_ == Token::Or)
+	{
+		next();
+		if (parseAnd(operand))
+			operands.push_back(std::move(operand));
+	}
+	if (operands.empty())
+		return false;
+	out = combine(QueryNode::Kind::Or, std::move(operands));
+	return true;
+}
+
+bool QueryParser::parseAnd(QueryNode &out)
+{
+	std::vector<QueryNode> operands;
+	QueryNode operand;
+	if (parseUnary(operand))
+		operands.push_back(std::move(operand));
+	for (;;)
+	{
+		if (token_ == Token::And)
+			next();
+		else if (token_ != Token::Word && token_ != Token::Phrase && token_ != Token::Not && token_ != Token::Open)
+			break;
+		if (parseUnary(operand))
+			operands.push_back(std::move(operand));
+	}
+	if (operands.empty())
+		return false;
+	out = combine(QueryNode::Kind::And, std::move(operands));
+	return true;
+}
+
+bool QueryParser::parseUnary(QueryNode &out)
+{
+	// A chain of negations is read in a loop, not by recursion: only its
+	// parity matters, and a long one must not exhaust the stack.
+	bool negated = false;
+	for (; token_ == Token::Not; next())
+		negated = !negated;
+
+	QueryNode operand;
+	if (!parsePrimary(operand))
+		return false;
+	if (operand.kind == QueryNode::Kind::Not)
+	{
+		operand = std::move(operand.children.front());
+		negated = !negated;
+	}
+	if (!negated)
+	{
+		out = std::move(operand);
+		return true;
+	}
+	out = QueryNode{};
+	out.kind = QueryNode::Kind::Not;
+	out.children.push_back(std::move(operand));
+	return true;
+}
+
+bool QueryParser::parsePrimary(QueryNode &out)
+{
+	switch (token_)
+	{
+	case Token::Open:
+	{
+		if (++depth_ > kMaxDepth)
+			throw QueryError("too many nested parentheses");
+		next();
+		bool found = parseOr(out);
+		if (token_ != Token::Close)
+			throw QueryError("missing ')'");
+		next();
+		--depth_;
+		return found;
+	}
+	case Token::Word:
+	case Token::Phrase:
+	{
+		std::string text = std::move(text_);
+		next();
+		return words(text, out);
+	}
+	case Token::End:
+		throw QueryError("the query ends where a word was expected");
+	case Token::Close:
+		throw QueryError("unexpected ')'");
+	default:
+		throw QueryError("an operator is missing its operand");
+	}
+}
+
+bool QueryParser::words(const std::string &text, QueryNode &out)
+{
+	// Punctuation separates words in indexed text too (see Indexer::cleanHTML).
+	std::string cleaned = text;
+	for (char &c : cleaned)
+	{
+		unsigned char u = static_cast<unsigned char>(c);
+		if (u < 0x80 && !std::isalnum(u))
+			c = ' ';
+	}
+
+	auto words = Indexer::tokenize(cleaned);
+	termCount_ += words.size();
+	if (termCount_ > maxTerms_)
+		throw QueryError("the query has more than " + std::to_string(maxTerms_) + " words");
+	if (words.empty())
+		return false;
+
+	out = QueryNode{};
+	out.kind = words.size() == 1 ? QueryNode::Kind::Term : QueryNode::Kind::Phrase;
+	out.terms = std::move(words);
+	return true;
+}
+
+bool QueryParser::positive(const QueryNode &node)
+{
+	switch (node.kind)
+	{
+	case QueryNode::Kind::Term:
+	case QueryNode::Kind::Phrase:
+		return true;
+	case QueryNode::Kind::Not:
+		return false;
+	case QueryNode::Kind::And:
+		return std::any_of(node.children.begin(), node.children.end(), positive);
+	case QueryNode::Kind::Or:
+		return std::all_of(node.children.begin(), node.children.end(), positive);
+	}
+	return false;
+}
+
+void QueryParser::validate(const QueryNode &node)
+{
+	if (!positive(node))
+		throw QueryError("NOT can only exclude documents matched by other words, as in \"a -b\"");
+	for (const auto &child : node.children)
+		validate(child.kind == QueryNode::Kind::Not ? child.children.front() : child);
+}
+
+std::string QueryParser::canonical(const QueryNode &node)
+{
+	switch (node.kind)
+	{
+	case QueryNode::Kind::Term:
+		return node.terms.front();
+	case QueryNode::Kind::Phrase:
+	{
+		std::string out = "\"";
+		for (std::size_t i = 0; i < node.terms.size(); ++i)
+			out += (i ? " " : "") + node.terms[i];
+		return out + "\"";
+	}
+	case QueryNode::Kind::Not:
+		return "-" + canonical(node.children.front());
+	default:
+	{
+		std::vector<std::string> parts;
+		for (const auto &child : node.children)
+			parts.push_back(canonical(child));
+		std::sort(parts.begin(), parts.end());
+		std::string out = "(";
+		for (std::size_t i = 0; i < parts.size(); ++i)
+			out += (i ? (node.kind == QueryNode::Kind::Or ? " OR " : " ") : "") + parts[i];
+		return out + ")";
+	}
+	}
+}
+
+std::vector<std::string> QueryParser::terms(const QueryNode &node)
+{
+	std::vector<std::string> out;
+	std::unordered_set<std::string> seen;
+	collectTerms(node, out, seen);
+	return out;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdexcept>
+
+// Malformed, unsupported or too expensive query; the message is shown to the user.
+class QueryError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+struct QueryNode
+{
+	enum class Kind
+	{
+		Term,
+		Phrase,
+		And,
+		Or,
+		Not
+	};
+
+	Kind kind = Kind::Term;
+	std::vector<std::string> terms;	 // Term: one word; Phrase: its words in order
+	std::vector<QueryNode> children; // And, Or: two or more; Not: one
+};
+
+// Search query language:
+//
+//   query   := or
+//   or      := and ("OR" and)*
+//   and     := unary (["AND"] unary)*      adjacent operands are ANDed
+//   unary   := ("NOT" | "-") unary | primary
+//   primary := "(" or ")" | '"' words '"' | word
+//
+// Operators are upper case (ИЛИ, И and НЕ work too). Words are split and
+// lowercased exactly as the indexer does, so ones it never indexes (too
+// short or too long) drop out of the query instead of matching nothing.
+class QueryParser
+{
+public:
+	// Throws QueryError on syntax errors, on more than maxTerms words, when
+	// no indexable word is left and when a part of the query could only be
+	// answered by listing every document (NOT alone, x OR NOT y).
+	static QueryNode parse(const std::string &query, std::size_t maxTerms = 32);
+	// Same text for queries that differ only in operand order or spacing; the cache key.
+	static std::string canonical(const QueryNode &node);
+	// Words that count towards relevance (those not under NOT), unique, in query order.
+	static std::vector<std::string> terms(const QueryNode &node);
+
+private:
+	enum class Token
+	{
+		Word,
+		Phrase,
+		And,
+		Or,
+		Not,
+		Open,
+		Close,
+		End
+	};
+
+	const std::string &query_;
+	std::size_t maxTerms_;
+	std::size_t pos_ = 0;
+	std::size_t termCount_ = 0;
+	int depth_ = 0;
+	Token token_ = Token::End;
+	std::string text_; // of the current Word or Phrase token
+
+	QueryParser(const std::string &query, std::size_t maxTerms) : query_(query), maxTerms_(maxTerms) {}
+
+	void next();
+	// Each returns false when its part had no indexable words.
+	bool parseOr(QueryNode &out);
+	bool parseAnd(QueryNode &out);
+	bool parseUnary(QueryNode &out);
+	bool parsePrimary(QueryNode &out);
+	bool words(const std::string &text, QueryNode &out);
+	static void validate(const QueryNode &node);
+	static bool positive(const QueryNode &node);
+};
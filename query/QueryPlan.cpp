@@ -0,0 +1,349 @@
+#include "QueryPlan.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+	constexpr std::size_t kUnbounded = std::numeric_limits<std::size_t>::max();
+
+	std::size_t saturatingAdd(std::size_t a, std::size_t b)
+	{
+		return a > kUnbounded - b ? kUnbounded : a + b;
+	}
+
+	std::vector<int> offsetPositions(const std::vector<int> &positions, int offset)
+	{
+		std::vector<int> out;
+		out.reserve(positions.size());
+		for (int p : positions)
+			out.push_back(p - offset);
+		return out;
+	}
+}
+
+QueryPlan::QueryPlan(const QueryNode &query, PostingSource &source, const QueryLimits &limits)
+		: terms_(QueryParser::terms(query))
+{
+	// Every word, excluded ones included: they are probed too.
+	std::vector<std::string> words;
+	std::vector<const QueryNode *> stack{&query};
+	while (!stack.empty())
+	{
+		const QueryNode *node = stack.back();
+		stack.pop_back();
+		words.insert(words.end(), node->terms.begin(), node->terms.end());
+		for (const auto &child : node->children)
+			stack.push_back(&child);
+	}
+	std::sort(words.begin(), words.end());
+	words.erase(std::unique(words.begin(), words.end()), words.end());
+
+	root_ = build(query, source.documentFrequencies(words));
+	cost_ = costOf(root_, kUnbounded);
+	if (cost_ > limits.maxPostings)
+		throw QueryError("the query is too broad: about " + std::to_string(cost_) + " postings to read, at most " +
+										 std::to_string(limits.maxPostings) + " allowed; add rarer words or a phrase");
+}
+
+QueryPlan::Node QueryPlan::build(const QueryNode &query, const std::unordered_map<std::string, int> &df)
+{
+	Node node;
+	node.kind = query.kind;
+	node.terms = query.terms;
+	for (const auto &term : query.terms)
+	{
+		auto it = df.find(term);
+		node.frequencies.push_back(it != df.end() ? static_cast<std::size_t>(it->second) : 0);
+	}
+	for (const auto &child : query.children)
+		node.children.push_back(build(child, df));
+
+	switch (node.kind)
+	{
+	case QueryNode::Kind::Term:
+	case QueryNode::Kind::Phrase:
+		node.estimate = *std::min_element(node.frequencies.begin(), node.frequencies.end());
+		break;
+	case QueryNode::Kind::Not:
+		node.estimate = node.children.front().estimate;
+		break;
+	case QueryNode::Kind::And:
+	{
+		// Rarest positive operand first, exclusions after every positive one.
+		std::stable_sort(node.children.begin(), node.children.end(), [](const Node &a, const Node &b)
+										 {
+			bool aNot = a.kind == QueryNode::Kind::Not, bNot = b.kind == QueryNode::Kind::Not;
+			return aNot != bNot ? bNot : a.estimate < b.estimate; });
+		node.estimate = node.children.front().estimate;
+		break;
+	}
+	case QueryNode::Kind::Or:
+		node.estimate = 0;
+		for (const auto &child : node.children)
+			node.estimate = saturatingAdd(node.estimate, child.estimate);
+		break;
+	}
+	return node;
+}
+
+std::size_t QueryPlan::costOf(const Node &node, std::size_t candidates)
+{
+	switch (node.kind)
+	{
+	case QueryNode::Kind::Term:
+		return std::min(node.estimate, candidates);
+	case QueryNode::Kind::Phrase:
+	{
+		auto frequencies = node.frequencies;
+		std::sort(frequencies.begin(), frequencies.end());
+		std::size_t cost = 0;
+		for (std::size_t df : frequencies)
+		{
+			cost = saturatingAdd(cost, std::min(df, candidates));
+			candidates = std::min(candidates, df);
+		}
+		return cost;
+	}
+	case QueryNode::Kind::Not:
+		return costOf(node.children.front(), candidates);
+	case QueryNode::Kind::And:
+	{
+		std::size_t cost = 0;
+		for (const auto &child : node.children)
+		{
+			cost = saturatingAdd(cost, costOf(child, candidates));
+			if (child.kind != QueryNode::Kind::Not)
+				candidates = std::min(candidates, child.estimate);
+		}
+		return cost;
+	}
+	case QueryNode::Kind::Or:
+	{
+		std::size_t cost = 0;
+		for (const auto &child : node.children)
+			cost = saturatingAdd(cost, costOf(child, candidates));
+		return cost;
+	}
+	}
+	return 0;
+}
+
+QueryPlan::Matches QueryPlan::evaluate(const Node &node, PostingSource &source, const std::vector<int> *candidates) const
+{
+	Matches matches;
+	switch (node.kind)
+	{
+	case QueryNode::Kind::Term:
+	{
+		if (node.estimate == 0)
+			break;
+		auto postings = source.postings(node.terms.front(), candidates);
+		matches.reserve(postings.size());
+		for (const auto &p : postings)
+			matches.push_back({p.docId, p.frequency});
+		break;
+	}
+	case QueryNode::Kind::Phrase:
+		matches = phrase(node, source, candidates);
+		break;
+	case QueryNode::Kind::And:
+	{
+		bool first = true;
+		for (const auto &child : node.children)
+		{
+			if (!first && matches.empty())
+				break;
+
+			std::vector<int> docs;
+			if (!first)
+			{
+				docs.reserve(matches.size());
+				for (const auto &m : matches)
+					docs.push_back(m.docId);
+			}
+
+			if (child.kind == QueryNode::Kind::Not)
+			{
+				// Skip filter: only the survivors are probed.
+				auto excluded = evaluate(child.children.front(), source, &docs);
+				auto ex = excluded.begin();
+				auto kept = std::remove_if(matches.begin(), matches.end(), [&](const Match &m)
+																	 {
+					while (ex != excluded.end() && ex->docId < m.docId)
+						++ex;
+					return ex != excluded.end() && ex->docId == m.docId; });
+				matches.erase(kept, matches.end());
+			}
+			else if (first)
+			{
+				matches = evaluate(child, source, candidates);
+				first = false;
+			}
+			else
+			{
+				auto next = evaluate(child, source, &docs);
+				Matches both;
+				auto it = next.begin();
+				for (const auto &m : matches)
+				{
+					while (it != next.end() && it->docId < m.docId)
+						++it;
+					if (it != next.end() && it->docId == m.docId)
+						both.push_back({m.docId, m.score + it->score});
+				}
+				matches = std::move(both);
+			}
+		}
+		break;
+	}
+	case QueryNode::Kind::Or:
+	{
+		for (const auto &child : node.children)
+		{
+			auto next = evaluate(child, source, candidates);
+			Matches merged;
+			merged.reserve(matches.size() + next.size());
+			auto a = matches.begin(), b = next.begin();
+			while (a != matches.end() || b != next.end())
+			{
+				if (b == next.end() || (a != matches.end() && a->docId < b->docId))
+					merged.push_back(*a++);
+				else if (a == matches.end() || b->docId < a->docId)
+					merged.push_back(*b++);
+				else
+				{
+					merged.push_back({a->docId, a->score + b->score});
+					++a;
+					++b;
+				}
+			}
+			matches = std::move(merged);
+		}
+		break;
+	}
+	case QueryNode::Kind::Not:
+		break; // only evaluated through its AND
+	}
+	return matches;
+}
+
+QueryPlan::Matches QueryPlan::phrase(const Node &node, PostingSource &source, const std::vector<int> *candidates) const
+{
+	// Words rarest first; a document stays while some start position still
+	// has every word read so far at its offset.
+	std::vector<std::size_t> order(node.terms.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b)
+									 { return node.frequencies[a] < node.frequencies[b]; });
+
+	Matches matches;
+	if (node.frequencies[order.front()] == 0)
+		return matches;
+
+	std::vector<int> docs;
+	std::unordered_map<int, std::vector<int>> starts;
+	for (std::size_t i = 0; i < order.size(); ++i)
+	{
+		if (i > 0 && docs.empty())
+			return matches;
+
+		int offset = static_cast<int>(order[i]);
+		auto postings = source.postings(node.terms[order[i]], i == 0 ? candidates : &docs, true);
+		std::unordered_map<int, std::vector<int>> next;
+		docs.clear();
+		for (const auto &p : postings)
+		{
+			auto shifted = offsetPositions(p.positions, offset);
+			if (i > 0)
+			{
+				auto it = starts.find(p.docId);
+				if (it == starts.end())
+					continue;
+				std::vector<int> common;
+				std::set_intersection(it->second.begin(), it->second.end(), shifted.begin(), shifted.end(),
+															std::back_inserter(common));
+				shifted = std::move(common);
+			}
+			if (shifted.empty())
+				continue;
+			docs.push_back(p.docId);
+			next[p.docId] = std::move(shifted);
+		}
+		starts = std::move(next);
+	}
+
+	int words = static_cast<int>(node.terms.size());
+	matches.reserve(docs.size());
+	for (int doc : docs)
+		matches.push_back({doc, static_cast<int>(starts[doc].size()) * words});
+	return matches;
+}
+
+std::vector<SearchResult> QueryPlan::execute(Database &db, std::size_t limit, const SearchCursor &after,
+																						 bool termFrequencies, const StaticRank *ranks) const
+{
+	return results(top(db, limit, after, ranks), db, db, termFrequencies);
+}
+
+QueryPlan::Matches QueryPlan::top(PostingSource &source, std::size_t limit, const SearchCursor &after,
+																	const StaticRank *ranks) const
+{
+	auto matches = evaluate(root_, source, nullptr);
+	if (ranks && !ranks->empty())
+		for (auto &m : matches)
+			m.score = static_cast<int>(std::lround(m.score * ranks->boost(m.docId) * 100));
+
+	if (after.docId)
+	{
+		Match cursor{after.docId, after.relevance};
+		matches.erase(std::remove_if(matches.begin(), matches.end(), [&](const Match &m)
+																 { return !before(cursor, m); }),
+									matches.end());
+	}
+	std::size_t count = std::min(limit, matches.size());
+	std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), before);
+	matches.resize(count);
+	return matches;
+}
+
+std::vector<SearchResult> QueryPlan::results(const Matches &matches, PostingSource &source, Database &db,
+																						 bool termFrequencies) const
+{
+	std::vector<int> ids;
+	ids.reserve(matches.size());
+	for (const auto &m : matches)
+		ids.push_back(m.docId);
+	auto urls = db.documentUrls(ids);
+
+	std::vector<std::unordered_map<int, int>> frequencies;
+	if (termFrequencies)
+	{
+		std::sort(ids.begin(), ids.end());
+		for (const auto &term : terms_)
+		{
+			std::unordered_map<int, int> perDocument;
+			for (const auto &p : source.postings(term, &ids))
+				perDocument[p.docId] = p.frequency;
+			frequencies.push_back(std::move(perDocument));
+		}
+	}
+
+	std::vector<SearchResult> results;
+	results.reserve(matches.size());
+	for (const auto &m : matches)
+	{
+		auto url = urls.find(m.docId);
+		if (url == urls.end())
+			continue;
+		SearchResult r;
+		r.docId = m.docId;
+		r.url = url->second;
+		r.relevance = m.score;
+		for (auto &perDocument : frequencies)
+			r.termFrequencies.push_back(perDocument[m.docId]);
+		results.push_back(std::move(r));
+	}
+	return results;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+
+#include "QueryParser.h"
+#include "../database/Database.h"
+#include "../ranking/StaticRank.h"
+
+struct QueryLimits
+{
+	std::size_t maxTerms = 32;			 // words per query, phrase words included
+	std::size_t maxPostings = 500000; // estimated postings a query may read
+};
+
+// A parsed query bound to the current index statistics.
+//
+// Every AND reads its rarest operand first and probes the others only for
+// the documents still in the running, so its cost is set by the rarest
+// term rather than the most common one; NOT operands are probed last, on
+// the survivors only, and skip what they match. Phrases intersect their
+// words the same way and then check positions. Relevance is the summed
+// frequency of the matched words, as for plain searches.
+class QueryPlan
+{
+public:
+	struct Match
+	{
+		int docId;
+		int score;
+	};
+	using Matches = std::vector<Match>;
+
+	// Reads the document frequencies of the query's words. Throws QueryError
+	// when the estimated number of postings to read exceeds limits.maxPostings.
+	QueryPlan(const QueryNode &query, PostingSource &source, const QueryLimits &limits);
+
+	// Documents ordered by (relevance DESC, docId) after the cursor; with
+	// termFrequencies, per word of QueryParser::terms(query). Given
+	// non-empty ranks, relevance is the term score times the document's
+	// StaticRank::boost, in hundredths so that it stays an integer.
+	std::vector<SearchResult> execute(Database &db, std::size_t limit, const SearchCursor &after = {},
+																		bool termFrequencies = false, const StaticRank *ranks = nullptr) const;
+	// The first limit matches in source after the cursor, in result order;
+	// execute without the URLs. Shards of an index are searched with this
+	// and their lists merged.
+	Matches top(PostingSource &source, std::size_t limit, const SearchCursor &after = {},
+							const StaticRank *ranks = nullptr) const;
+	// Results for matches from top: URLs from db, term frequencies from source.
+	std::vector<SearchResult> results(const Matches &matches, PostingSource &source, Database &db,
+																		bool termFrequencies) const;
+	// Result order: relevance descending, then document id.
+	static bool before(const Match &a, const Match &b)
+	{
+		return a.score != b.score ? a.score > b.score : a.docId < b.docId;
+	}
+	std::size_t cost() const { return cost_; }
+
+private:
+	struct Node
+	{
+		QueryNode::Kind kind;
+		std::vector<std::string> terms;
+		std::vector<std::size_t> frequencies; // document frequency per term
+		std::vector<Node> children;			  // AND: positive operands by estimate, then NOTs
+		std::size_t estimate = 0;			  // matching documents, upper bound
+	};
+
+	Node root_;
+	std::vector<std::string> terms_;
+	std::size_t cost_ = 0;
+
+	static Node build(const QueryNode &query, const std::unordered_map<std::string, int> &df);
+	// Cost when at most candidates documents can still match.
+	static std::size_t costOf(const Node &node, std::size_t candidates);
+	// Matches ascending by document id.
+	Matches evaluate(const Node &node, PostingSource &source, const std::vector<int> *candidates) const;
+	Matches phrase(const Node &node, PostingSource &source, const std::vector<int> *candidates) const;
+};
@@ -0,0 +1,202 @@
+#include "PageRank.h"
+#include "../database/Database.h"
+#include "../logger/Logger.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+	// Runs fn(begin, end, part) over parts of [0, bounds.back()) split at bounds.
+	template <class Fn>
+	void parallelFor(const std::vector<std::size_t> &bounds, Fn fn)
+	{
+		std::vector<std::thread> threads;
+		for (std::size_t part = 1; part + 1 < bounds.size(); ++part)
+			threads.emplace_back(fn, bounds[part], bounds[part + 1], part);
+		fn(bounds[0], bounds[1], 0);
+		for (auto &t : threads)
+			t.join();
+	}
+
+	// Node ranges with about the same number of incoming edges each.
+	std::vector<std::size_t> splitByEdges(const LinkGraph &graph, std::size_t parts)
+	{
+		std::vector<std::size_t> bounds{0};
+		std::size_t n = graph.nodes();
+		// Every node costs a little even without edges.
+		std::size_t total = graph.edges() + n;
+		for (std::size_t part = 1; part < parts; ++part)
+		{
+			std::size_t target = total * part / parts;
+			std::size_t lo = bounds.back(), hi = n;
+			while (lo < hi)
+			{
+				std::size_t mid = (lo + hi) / 2;
+				if (graph.offsets[mid] + mid < target)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			bounds.push_back(lo);
+		}
+		bounds.push_back(n);
+		return bounds;
+	}
+}
+
+std::uint64_t LinkGraph::urlHash(const std::string &url)
+{
+	std::uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : url)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+LinkGraph LinkGraph::build(const std::vector<std::pair<int, std::string>> &documents,
+						   const std::vector<std::pair<int, std::uint64_t>> &links)
+{
+	LinkGraph graph;
+	std::unordered_map<std::uint64_t, std::uint32_t> byUrl;
+	std::unordered_map<int, std::uint32_t> byId;
+	byUrl.reserve(documents.size());
+	byId.reserve(documents.size());
+	for (const auto &[id, url] : documents)
+	{
+		auto node = static_cast<std::uint32_t>(graph.ids.size());
+		graph.ids.push_back(id);
+		byUrl.emplace(urlHash(url), node);
+		byId.emplace(id, node);
+	}
+
+	// (target, source) pairs sorted by target are the rows of the CSR.
+	std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+	edges.reserve(links.size());
+	for (const auto &[sourceId, target] : links)
+	{
+		auto source = byId.find(sourceId);
+		auto dest = byUrl.find(target);
+		if (source != byId.end() && dest != byUrl.end() && source->second != dest->second)
+			edges.emplace_back(dest->second, source->second);
+	}
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	std::size_t n = graph.ids.size();
+	graph.offsets.assign(n + 1, 0);
+	graph.outDegree.assign(n, 0);
+	graph.sources.reserve(edges.size());
+	for (const auto &[target, source] : edges)
+	{
+		++graph.offsets[target + 1];
+		++graph.outDegree[source];
+		graph.sources.push_back(source);
+	}
+	std::partial_sum(graph.offsets.begin(), graph.offsets.end(), graph.offsets.begin());
+	return graph;
+}
+
+std::vector<double> PageRank::compute(const LinkGraph &graph, const PageRankOptions &options, PageRankStats *stats)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::size_t n = graph.nodes();
+	if (n == 0)
+		return {};
+
+	std::size_t threads = options.threads > 0 ? static_cast<std::size_t>(options.threads)
+											  : std::max(1u, std::thread::hardware_concurrency());
+	// Below a few thousand edges per thread, starting the threads costs more than they save.
+	threads = std::max<std::size_t>(1, std::min(threads, (graph.edges() + n) / 4096));
+	auto bounds = splitByEdges(graph, threads);
+
+	const double d = options.damping;
+	std::vector<double> rank(n, 1.0 / static_cast<double>(n)), next(n);
+	std::vector<double> share(n); // rank / out-degree, what a node passes along each link
+	std::vector<double> dangling(threads), delta(threads);
+
+	int iteration = 0;
+	double change = 0;
+	while (iteration < options.maxIterations)
+	{
+		++iteration;
+		parallelFor(bounds, [&](std::size_t begin, std::size_t end, std::size_t part)
+					{
+			double lost = 0;
+			for (std::size_t u = begin; u < end; ++u)
+			{
+				if (graph.outDegree[u])
+					share[u] = rank[u] / graph.outDegree[u];
+				else
+				{
+					share[u] = 0;
+					lost += rank[u];
+				}
+			}
+			dangling[part] = lost; });
+
+		double base = (1 - d) / static_cast<double>(n) +
+					  d * std::accumulate(dangling.begin(), dangling.end(), 0.0) / static_cast<double>(n);
+		parallelFor(bounds, [&](std::size_t begin, std::size_t end, std::size_t part)
+					{
+			double moved = 0;
+			for (std::size_t v = begin; v < end; ++v)
+			{
+				double sum = 0;
+				for (std::size_t e = graph.offsets[v]; e < graph.offsets[v + 1]; ++e)
+					sum += share[graph.sources[e]];
+				next[v] = base + d * sum;
+				moved += std::fabs(next[v] - rank[v]);
+			}
+			delta[part] = moved; });
+
+		rank.swap(next);
+		change = std::accumulate(delta.begin(), delta.end(), 0.0);
+		if (change < options.tolerance)
+			break;
+	}
+
+	if (stats)
+	{
+		stats->iterations = iteration;
+		stats->delta = change;
+		stats->nodes = n;
+		stats->edges = graph.edges();
+		stats->elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+	}
+	return rank;
+}
+
+std::vector<float> PageRank::rankDocuments(Database &db, const PageRankOptions &options, PageRankStats *stats)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::pair<int, std::string>> documents;
+	for (auto &meta : db.loadDocumentMeta())
+		documents.emplace_back(meta.id, std::move(meta.url));
+	auto graph = LinkGraph::build(documents, db.loadLinks());
+	auto loaded = std::chrono::steady_clock::now();
+
+	PageRankStats local;
+	if (!stats)
+		stats = &local;
+	auto rank = compute(graph, options, stats);
+
+	std::vector<float> byId;
+	for (std::size_t v = 0; v < rank.size(); ++v)
+	{
+		auto id = static_cast<std::size_t>(graph.ids[v]);
+		if (id >= byId.size())
+			byId.resize(id + 1, 0.0f);
+		byId[id] = static_cast<float>(rank[v] * static_cast<double>(rank.size()));
+	}
+
+	LOG_INFO("PAGERANK") << graph.nodes() << " documents, " << graph.edges() << " links; " << stats->iterations
+						 << " iterations to an L1 change of " << stats->delta << " in " << stats->elapsed.count()
+						 << " ms; graph loaded in "
+						 << std::chrono::duration_cast<std::chrono::milliseconds>(loaded - start).count() << " ms";
+	return byId;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Database;
+
+// Link graph between crawled documents, stored by incoming edges in
+// compressed sparse row form: the sources linking to node v are
+// sources[offsets[v]] .. sources[offsets[v + 1] - 1].
+struct LinkGraph
+{
+	std::vector<int> ids;				 // document id of each node
+	std::vector<std::size_t> offsets;	 // nodes + 1 entries
+	std::vector<std::uint32_t> sources; // node indexes
+	std::vector<std::uint32_t> outDegree;
+
+	std::size_t nodes() const { return ids.size(); }
+	std::size_t edges() const { return sources.size(); }
+
+	// 64-bit FNV-1a of a normalized URL, the form links are stored in.
+	static std::uint64_t urlHash(const std::string &url);
+	// documents are (id, url); links are (source id, target URL hash).
+	// Links to URLs that are not documents, self links and repeated links
+	// are dropped.
+	static LinkGraph build(const std::vector<std::pair<int, std::string>> &documents,
+						   const std::vector<std::pair<int, std::uint64_t>> &links);
+};
+
+struct PageRankOptions
+{
+	double damping = 0.85;
+	double tolerance = 1e-6; // stop once the L1 change of an iteration is below this
+	int maxIterations = 100;
+	int threads = 0; // 0: one per core
+};
+
+struct PageRankStats
+{
+	int iterations = 0;
+	double delta = 0; // L1 change of the last iteration
+	std::size_t nodes = 0;
+	std::size_t edges = 0;
+	std::chrono::milliseconds elapsed{0};
+};
+
+class PageRank
+{
+public:
+	// Ranks summing to 1, by node. Each iteration is one sparse
+	// matrix-vector product split across threads by ranges of nodes with
+	// about the same number of incoming edges; a node's rank is only written
+	// by the thread owning it, so no atomics are needed. Rank held by pages
+	// without outgoing links is spread evenly over all pages.
+	static std::vector<double> compute(const LinkGraph &graph, const PageRankOptions &options, PageRankStats *stats = nullptr);
+
+	// Loads the link graph from db and ranks every document, scaled so that
+	// the average one has 1; indexed by document id, as stored with
+	// Database::storeStaticRanks.
+	static std::vector<float> rankDocuments(Database &db, const PageRankOptions &options, PageRankStats *stats = nullptr);
+};
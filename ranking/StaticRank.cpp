@@ -0,0 +1,32 @@
+#include "StaticRank.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace
+{
+	std::shared_ptr<const StaticRank> &currentRanks()
+	{
+		static std::shared_ptr<const StaticRank> ranks = std::make_shared<const StaticRank>();
+		return ranks;
+	}
+}
+
+StaticRank::StaticRank(const std::vector<float> &ranks, double weight)
+{
+	if (weight <= 0)
+		return;
+	boosts_.resize(ranks.size());
+	for (std::size_t id = 0; id < ranks.size(); ++id)
+		boosts_[id] = static_cast<float>(1 + weight * std::log1p(std::max(0.0f, ranks[id])));
+}
+
+std::shared_ptr<const StaticRank> StaticRank::current()
+{
+	return std::atomic_load(&currentRanks());
+}
+
+void StaticRank::publish(std::shared_ptr<const StaticRank> ranks)
+{
+	std::atomic_store(&currentRanks(), std::move(ranks));
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+// Query-independent document boosts from the precomputed static rank.
+// A match's term score is multiplied by 1 + weight * ln(1 + rank), so an
+// average page (rank 1) gains weight * 0.69 and the boost grows slowly for
+// heavily linked ones; documents without a rank keep their term score.
+class StaticRank
+{
+public:
+	StaticRank() = default;
+	// ranks indexed by document id, as Database::loadStaticRanks returns them.
+	StaticRank(const std::vector<float> &ranks, double weight);
+
+	double boost(int docId) const
+	{
+		return docId >= 0 && static_cast<std::size_t>(docId) < boosts_.size() ? boosts_[docId] : 1.0;
+	}
+	// No boosts: weight 0 or nothing ranked yet.
+	bool empty() const { return boosts_.empty(); }
+	std::size_t size() const { return boosts_.size(); }
+
+	// The ranks search uses, replaced whole when PageRank is recomputed.
+	static std::shared_ptr<const StaticRank> current();
+	static void publish(std::shared_ptr<const StaticRank> ranks);
+
+private:
+	std::vector<float> boosts_;
+};
@@ -0,0 +1,154 @@
+#include "JsonWriter.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+void JsonWriter::separator()
+{
+	if (afterKey_)
+	{
+		afterKey_ = false;
+		return;
+	}
+	if (!first_.empty())
+	{
+		if (!first_.back())
+			out_ += ',';
+		first_.back() = false;
+	}
+}
+
+void JsonWriter::open(char c)
+{
+	separator();
+	out_ += c;
+	first_.push_back(true);
+}
+
+void JsonWriter::close(char c)
+{
+	out_ += c;
+	first_.pop_back();
+}
+
+JsonWriter &JsonWriter::beginObject()
+{
+	open('{');
+	return *this;
+}
+
+JsonWriter &JsonWriter::endObject()
+{
+	close('}');
+	return *this;
+}
+
+JsonWriter &JsonWriter::beginArray()
+{
+	open('[');
+	return *this;
+}
+
+JsonWriter &JsonWriter::endArray()
+{
+	close(']');
+	return *this;
+}
+
+JsonWriter &JsonWriter::key(const std::string &name)
+{
+	separator();
+	string(name.data(), name.size());
+	out_ += ':';
+	afterKey_ = true;
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(const std::string &s)
+{
+	separator();
+	string(s.data(), s.size());
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *s)
+{
+	separator();
+	string(s, std::strlen(s));
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(std::int64_t n)
+{
+	separator();
+	out_ += std::to_string(n);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(double d)
+{
+	separator();
+	if (!std::isfinite(d))
+	{
+		out_ += "null";
+		return *this;
+	}
+	char buf[32];
+	int len = std::snprintf(buf, sizeof(buf), "%.17g", d);
+	out_.append(buf, len);
+	return *this;
+}
+
+JsonWriter &JsonWriter::value(bool b)
+{
+	separator();
+	out_ += b ? "true" : "false";
+	return *this;
+}
+
+JsonWriter &JsonWriter::null()
+{
+	separator();
+	out_ += "null";
+	return *this;
+}
+
+void JsonWriter::string(const char *s, std::size_t size)
+{
+	static const char hex[] = "0123456789abcdef";
+	out_ += '"';
+	std::size_t run = 0; // bytes that need no escaping are appended in one go
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(s[i]);
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		out_.append(s + run, i - run);
+		run = i + 1;
+		switch (c)
+		{
+		case '"':
+			out_ += "\\\"";
+			break;
+		case '\\':
+			out_ += "\\\\";
+			break;
+		case '\n':
+			out_ += "\\n";
+			break;
+		case '\r':
+			out_ += "\\r";
+			break;
+		case '\t':
+			out_ += "\\t";
+			break;
+		default:
+			out_ += "\\u00";
+			out_ += hex[c >> 4];
+			out_ += hex[c & 0xf];
+		}
+	}
+	out_.append(s + run, size - run);
+	out_ += '"';
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Appends JSON straight into a caller-owned string (usually a response
+// body), so nothing is assembled in a stream and copied afterwards.
+// Commas are inserted automatically; keys are only valid inside objects.
+class JsonWriter
+{
+public:
+	explicit JsonWriter(std::string &out) : out_(out) {}
+
+	JsonWriter &beginObject();
+	JsonWriter &endObject();
+	JsonWriter &beginArray();
+	JsonWriter &endArray();
+	JsonWriter &key(const std::string &name);
+
+	JsonWriter &value(const std::string &s);
+	JsonWriter &value(const char *s);
+	JsonWriter &value(std::int64_t n);
+	JsonWriter &value(int n) { return value(static_cast<std::int64_t>(n)); }
+	JsonWriter &value(double d);
+	JsonWriter &value(bool b);
+	JsonWriter &null();
+
+private:
+	std::string &out_;
+	std::vector<bool> first_; // per open container: nothing written yet
+	bool afterKey_ = false;
+
+	void separator();
+	void open(char c);
+	void close(char c);
+	void string(const char *s, std::size_t size);
+};
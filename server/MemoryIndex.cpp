@@ -0,0 +1,94 @@
+#include "MemoryIndex.h"
+#include "../index/IndexSnapshot.h"
+#include "../logger/Logger.h"
+
+MemoryIndex::MemoryIndex(std::shared_ptr<QueryExecutor> executor, const MemoryIndexOptions &options)
+		: executor_(std::move(executor)), options_(options), pool_(std::make_shared<ShardPool>(options.threads)) {}
+
+std::shared_ptr<ShardedIndex> MemoryIndex::current() const
+{
+	return std::atomic_load(&index_);
+}
+
+void MemoryIndex::refresh()
+{
+	if (loading_)
+		return;
+
+	std::uint64_t generation = Database::generation();
+	auto now = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		if (loaded_ && now - lastLoad_ < options_.rebuildInterval)
+			return;
+		loaded_ = true;
+		lastLoad_ = now;
+	}
+
+	loading_ = true;
+	auto self = shared_from_this();
+	bool queued = executor_->submit([self, generation](Database *db)
+																	{
+		try
+		{
+			if (db)
+				self->reload(*db, generation);
+		}
+		catch (std::exception &e)
+		{
+			LOG_ERROR("MEMINDEX") << "Не удалось загрузить индекс в память: " << e.what();
+		}
+		self->loading_ = false; });
+	if (!queued)
+		loading_ = false; // retried once rebuildInterval has passed
+}
+
+void MemoryIndex::reload(Database &db, std::uint64_t generation)
+{
+	auto index = current();
+	bool mapped = false;
+	if (!index && !options_.snapshotPath.empty())
+	{
+		try
+		{
+			index = IndexSnapshot::load(options_.snapshotPath, pool_, generation, options_.verifySnapshot);
+			mapped = true;
+		}
+		catch (std::exception &e)
+		{
+			LOG_WARN("MEMINDEX") << "Снимок индекса не загружен, индекс будет прочитан из базы: " << e.what();
+		}
+	}
+
+	// An old snapshot is still served first; the full load comes with a later refresh.
+	if (!index || (!mapped && options_.fullReloadInterval.count() > 0 &&
+				   std::chrono::system_clock::now() - index->loadedAt() >= options_.fullReloadInterval))
+		index = loadFull(db, generation);
+	else
+		index = index->catchUp(db, generation, options_.batchRows);
+
+	// Pages still settling, or re-indexed since the full load, are not in
+	// the index: it must not pass for the generation it was loaded at.
+	bool complete = index->highWater() >= db.maxDocumentId() && !db.reindexedSince(index->loadedAt(), index->highWater());
+	if (!complete && generation > 0)
+		index = std::make_shared<ShardedIndex>(index->shards(), index->pool(), generation - 1, index->highWater(),
+											   index->loadedAt());
+	std::atomic_store(&index_, index);
+}
+
+std::shared_ptr<ShardedIndex> MemoryIndex::loadFull(Database &db, std::uint64_t generation)
+{
+	auto index = ShardedIndex::load(db, options_.shards, pool_, generation, options_.batchRows);
+	if (!options_.snapshotPath.empty())
+	{
+		try
+		{
+			IndexSnapshot::save(*index, options_.snapshotPath);
+		}
+		catch (std::exception &e)
+		{
+			LOG_WARN("MEMINDEX") << "Не удалось сохранить снимок индекса: " << e.what();
+		}
+	}
+	return index;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "QueryExecutor.h"
+#include "../index/ShardedIndex.h"
+
+struct MemoryIndexOptions
+{
+	std::size_t shards = 4;
+	int threads = 0;						 // shard pool workers; 0: one per core
+	std::chrono::seconds rebuildInterval{60}; // minimum time between two refreshes
+	std::size_t batchRows = 100000;			 // word_freq rows per statement while loading
+	// Started from and rewritten after every full load; empty for none.
+	std::string snapshotPath;
+	bool verifySnapshot = false; // check the postings' checksum too, reading the whole file
+	// A full load picks up pages re-indexed under an existing id, which
+	// catching up misses; 0 never reloads once loaded.
+	std::chrono::seconds fullReloadInterval{3600};
+};
+
+// The ShardedIndex searches run against instead of the word_freq table.
+// Like the Suggester's dictionary it is refreshed on the loader executor at
+// most every rebuildInterval, from what the database holds then (other
+// crawler processes may have added to it), and swapped in atomically; until
+// the first load has finished current() is null and searches go to SQL.
+//
+// The first load maps the snapshot when there is a usable one and reads
+// only the documents added since it was saved; otherwise it reads every
+// document and saves a snapshot for the next start. Later refreshes catch
+// up from the index's high-water mark, with a full load every
+// fullReloadInterval.
+//
+// An index that lacks documents the database already has (pages fetched
+// too recently to be read, or re-indexed since the full load) carries the
+// generation before the one it was loaded at, so results from it are not
+// cached as current.
+class MemoryIndex : public std::enable_shared_from_this<MemoryIndex>
+{
+public:
+	MemoryIndex(std::shared_ptr<QueryExecutor> executor, const MemoryIndexOptions &options);
+
+	std::shared_ptr<ShardedIndex> current() const;
+	// Schedules a refresh once rebuildInterval has passed since the last one; cheap enough to call per request.
+	void refresh();
+
+private:
+	std::shared_ptr<QueryExecutor> executor_;
+	MemoryIndexOptions options_;
+	std::shared_ptr<ShardPool> pool_;
+	std::shared_ptr<ShardedIndex> index_;
+
+	std::mutex mtx_;
+	bool loaded_ = false; // a refresh was submitted at least once
+	std::chrono::steady_clock::time_point lastLoad_;
+	std::atomic<bool> loading_{false};
+
+	void reload(Database &db, std::uint64_t generation);
+	std::shared_ptr<ShardedIndex> loadFull(Database &db, std::uint64_t generation);
+};
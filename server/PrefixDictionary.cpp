@@ -0,0 +1,236 @@
+#include "PrefixDictionary.h"
+#include <algorithm>
+#include <queue>
+#include <limits>
+
+namespace
+{
+	constexpr std::uint32_t kNone = std::numeric_limits<std::uint32_t>::max();
+
+	void putVarint(std::string &out, std::size_t v)
+	{
+		while (v >= 0x80)
+		{
+			out += static_cast<char>((v & 0x7f) | 0x80);
+			v >>= 7;
+		}
+		out += static_cast<char>(v);
+	}
+
+	std::size_t getVarint(const std::string &in, std::size_t &pos)
+	{
+		std::size_t v = 0;
+		for (int shift = 0;; shift += 7)
+		{
+			unsigned char c = static_cast<unsigned char>(in[pos++]);
+			v |= static_cast<std::size_t>(c & 0x7f) << shift;
+			if (!(c & 0x80))
+				return v;
+		}
+	}
+
+	// Decodes the next term of a block into term (which holds the previous one).
+	void nextTerm(const std::string &data, std::size_t &pos, std::string &term, bool head)
+	{
+		std::size_t shared = head ? 0 : getVarint(data, pos);
+		std::size_t suffix = getVarint(data, pos);
+		term.resize(shared);
+		term.append(data, pos, suffix);
+		pos += suffix;
+	}
+}
+
+PrefixDictionary::PrefixDictionary(std::vector<Entry> entries)
+{
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+						{ return a.term < b.term || (a.term == b.term && a.frequency > b.frequency); });
+	entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+														{ return a.term == b.term; }),
+								entries.end());
+
+	frequency_.reserve(entries.size());
+	blocks_.reserve(entries.size() / kBlock + 1);
+	const std::string *prev = nullptr;
+	for (std::size_t i = 0; i < entries.size(); ++i)
+	{
+		const std::string &term = entries[i].term;
+		if (i % kBlock == 0)
+		{
+			blocks_.push_back(static_cast<std::uint32_t>(data_.size()));
+			putVarint(data_, term.size());
+			data_ += term;
+		}
+		else
+		{
+			std::size_t shared = 0;
+			while (shared < prev->size() && shared < term.size() && (*prev)[shared] == term[shared])
+				++shared;
+			putVarint(data_, shared);
+			putVarint(data_, term.size() - shared);
+			data_.append(term, shared, std::string::npos);
+		}
+		frequency_.push_back(entries[i].frequency);
+		prev = &term;
+	}
+	data_.shrink_to_fit();
+
+	std::size_t n = frequency_.size();
+	tree_.assign(2 * n, kNone);
+	for (std::size_t i = 0; i < n; ++i)
+		tree_[n + i] = static_cast<std::uint32_t>(i);
+	for (std::size_t i = n - 1; i > 0 && n > 0; --i)
+		tree_[i] = better(tree_[2 * i], tree_[2 * i + 1]);
+}
+
+PrefixDictionary PrefixDictionary::merged(std::vector<Entry> added) const
+{
+	std::sort(added.begin(), added.end(), [](const Entry &a, const Entry &b)
+			  { return a.term < b.term; });
+
+	// Both sides in term order: the terms are decoded one block after
+	// another rather than looked up.
+	std::vector<Entry> entries;
+	entries.reserve(size() + added.size());
+	auto add = [&entries](Entry entry)
+	{
+		if (!entries.empty() && entries.back().term == entry.term)
+			entries.back().frequency += entry.frequency;
+		else
+			entries.push_back(std::move(entry));
+	};
+	auto next = added.begin();
+	std::string term;
+	for (std::size_t id = 0, pos = 0; id < size(); ++id)
+	{
+		if (id % kBlock == 0)
+			pos = blocks_[id / kBlock];
+		nextTerm(data_, pos, term, id % kBlock == 0);
+		for (; next != added.end() && next->term < term; ++next)
+			add(std::move(*next));
+		add({term, frequency_[id]});
+		for (; next != added.end() && next->term == term; ++next)
+			add(std::move(*next));
+	}
+	for (; next != added.end(); ++next)
+		add(std::move(*next));
+	return PrefixDictionary(std::move(entries));
+}
+
+std::uint32_t PrefixDictionary::better(std::uint32_t a, std::uint32_t b) const
+{
+	if (a == kNone)
+		return b;
+	if (b == kNone)
+		return a;
+	if (frequency_[a] != frequency_[b])
+		return frequency_[a] > frequency_[b] ? a : b;
+	return std::min(a, b);
+}
+
+std::uint32_t PrefixDictionary::argmax(std::size_t lo, std::size_t hi) const
+{
+	std::uint32_t best = kNone;
+	std::size_t n = frequency_.size();
+	for (lo += n, hi += n; lo < hi; lo >>= 1, hi >>= 1)
+	{
+		if (lo & 1)
+			best = better(best, tree_[lo++]);
+		if (hi & 1)
+			best = better(best, tree_[--hi]);
+	}
+	return best;
+}
+
+std::string PrefixDictionary::blockHead(std::size_t block) const
+{
+	std::size_t pos = blocks_[block];
+	std::string term;
+	nextTerm(data_, pos, term, true);
+	return term;
+}
+
+std::size_t PrefixDictionary::lowerBound(const std::string &key) const
+{
+	// Last block whose first term is <= key; the answer is in it or starts the next one.
+	std::size_t lo = 0, hi = blocks_.size();
+	while (lo < hi)
+	{
+		std::size_t mid = (lo + hi) / 2;
+		if (blockHead(mid) <= key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return 0;
+
+	std::size_t block = lo - 1;
+	std::size_t id = block * kBlock;
+	std::size_t end = std::min(id + kBlock, size());
+	std::size_t pos = blocks_[block];
+	std::string term;
+	for (; id < end; ++id)
+	{
+		nextTerm(data_, pos, term, id % kBlock == 0);
+		if (term >= key)
+			return id;
+	}
+	return end;
+}
+
+std::string PrefixDictionary::term(std::size_t id) const
+{
+	std::size_t pos = blocks_[id / kBlock];
+	std::string term;
+	for (std::size_t i = 0; i <= id % kBlock; ++i)
+		nextTerm(data_, pos, term, i == 0);
+	return term;
+}
+
+std::vector<PrefixDictionary::Entry> PrefixDictionary::complete(const std::string &prefix, std::size_t n) const
+{
+	std::vector<Entry> out;
+	if (n == 0 || size() == 0)
+		return out;
+
+	std::size_t lo = lowerBound(prefix);
+	std::size_t hi = size();
+	std::string upper = prefix;
+	while (!upper.empty() && static_cast<unsigned char>(upper.back()) == 0xff)
+		upper.pop_back();
+	if (!upper.empty())
+	{
+		upper.back() = static_cast<char>(static_cast<unsigned char>(upper.back()) + 1);
+		hi = lowerBound(upper);
+	}
+
+	// Best id of each pending sub-range; taking one splits its range in two.
+	struct Range
+	{
+		std::uint32_t best;
+		std::size_t lo, hi;
+	};
+	auto worse = [this](const Range &a, const Range &b)
+	{ return better(a.best, b.best) == b.best; };
+	std::priority_queue<Range, std::vector<Range>, decltype(worse)> ranges(worse);
+	if (lo < hi)
+		ranges.push({argmax(lo, hi), lo, hi});
+
+	while (!ranges.empty() && out.size() < n)
+	{
+		Range r = ranges.top();
+		ranges.pop();
+		out.push_back({term(r.best), frequency_[r.best]});
+		if (r.lo < r.best)
+			ranges.push({argmax(r.lo, r.best), r.lo, r.best});
+		if (r.best + 1 < r.hi)
+			ranges.push({argmax(r.best + 1, r.hi), r.best + 1, r.hi});
+	}
+	return out;
+}
+
+std::size_t PrefixDictionary::memoryBytes() const
+{
+	return sizeof(*this) + data_.capacity() + blocks_.capacity() * sizeof(std::uint32_t) +
+				 frequency_.capacity() * sizeof(std::uint32_t) + tree_.capacity() * sizeof(std::uint32_t);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Immutable sorted term dictionary for prefix completion.
+//
+// Terms are front-coded in blocks of 16 (the first term of a block in full,
+// the rest as shared-prefix length + suffix), so a vocabulary costs little
+// more than its distinct suffix bytes. All completions of a prefix form one
+// contiguous id range; a max-frequency segment tree over the ids yields the
+// top-N of that range in O(N log n) without touching the rest of it.
+class PrefixDictionary
+{
+public:
+	struct Entry
+	{
+		std::string term;
+		std::uint32_t frequency = 0;
+	};
+
+	PrefixDictionary() = default;
+	// Duplicate terms keep the highest frequency.
+	explicit PrefixDictionary(std::vector<Entry> entries);
+
+	// This dictionary with added merged in: the frequency of a term already
+	// present grows by the added one, new terms are inserted.
+	PrefixDictionary merged(std::vector<Entry> added) const;
+
+	// Most frequent terms starting with prefix, highest first.
+	std::vector<Entry> complete(const std::string &prefix, std::size_t n) const;
+	std::string term(std::size_t id) const;
+	std::uint32_t frequency(std::size_t id) const { return frequency_[id]; }
+	std::size_t size() const { return frequency_.size(); }
+	std::size_t memoryBytes() const;
+
+private:
+	static constexpr std::size_t kBlock = 16;
+
+	std::string data_;
+	std::vector<std::uint32_t> blocks_; // offset of each block in data_
+	std::vector<std::uint32_t> frequency_;
+	std::vector<std::uint32_t> tree_; // tree_[n + id] = id; inner nodes hold the argmax of their children
+
+	std::string blockHead(std::size_t block) const;
+	// First id whose term is >= key.
+	std::size_t lowerBound(const std::string &key) const;
+	std::uint32_t better(std::uint32_t a, std::uint32_t b) const;
+	// Id with the highest frequency in [lo, hi).
+	std::uint32_t argmax(std::size_t lo, std::size_t hi) const;
+};
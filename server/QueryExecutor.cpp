@@ -0,0 +1,82 @@
+#include "QueryExecutor.h"
+#include <algorithm>
+#include "../logger/Logger.h"
+
+QueryExecutor::QueryExecutor(const std::string &connStr, int workers, std::size_t maxQueue)
+		: connStr_(connStr), maxQueue_(maxQueue)
+{
+	for (int i = 0; i < std::max(1, workers); ++i)
+		threads_.emplace_back([this]
+													{ work(); });
+}
+
+QueryExecutor::~QueryExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (auto &t : threads_)
+		t.join();
+}
+
+bool QueryExecutor::submit(Job job)
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		if (stop_ || jobs_.size() >= maxQueue_)
+			return false;
+		jobs_.push_back(std::move(job));
+	}
+	cv_.notify_one();
+	return true;
+}
+
+std::size_t QueryExecutor::queued() const
+{
+	std::lock_guard<std::mutex> lk(mtx_);
+	return jobs_.size();
+}
+
+void QueryExecutor::work()
+{
+	std::unique_ptr<Database> db;
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lk(mtx_);
+			cv_.wait(lk, [this]
+							 { return stop_ || !jobs_.empty(); });
+			if (jobs_.empty())
+				return;
+			job = std::move(jobs_.front());
+			jobs_.pop_front();
+		}
+
+		// Connect lazily and reconnect after the server dropped us.
+		if (db && !db->connected())
+			db.reset();
+		if (!db)
+		{
+			try
+			{
+				db = std::make_unique<Database>(connStr_);
+			}
+			catch (const std::exception &e)
+			{
+				LOG_ERROR("QUERY") << "Ошибка подключения к базе: " << e.what();
+			}
+		}
+
+		try
+		{
+			job(db.get());
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR("QUERY") << "Ошибка в обработчике запроса: " << e.what();
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "../database/Database.h"
+
+// Runs blocking database work off the I/O threads. A fixed pool of workers,
+// each with its own connection, takes jobs from a bounded queue; jobs post
+// their results back to whichever executor they came from.
+class QueryExecutor
+{
+public:
+	// db is null when the worker could not connect.
+	using Job = std::function<void(Database *db)>;
+
+	QueryExecutor(const std::string &connStr, int workers, std::size_t maxQueue);
+	~QueryExecutor();
+
+	// False (and the job is dropped) when maxQueue jobs are already waiting.
+	bool submit(Job job);
+	std::size_t queued() const;
+	int workers() const { return static_cast<int>(threads_.size()); }
+
+private:
+	std::string connStr_;
+	std::size_t maxQueue_;
+	std::deque<Job> jobs_;
+	mutable std::mutex mtx_;
+	std::condition_variable cv_;
+	bool stop_ = false;
+	std::vector<std::thread> threads_;
+
+	void work();
+};
@@ -0,0 +1,100 @@
+#include "SearchCache.h"
+#include <algorithm>
+#include <functional>
+
+SearchCache::SearchCache(std::size_t budgetBytes, std::chrono::seconds ttl, std::size_t shards)
+		: budget_(budgetBytes), ttl_(ttl)
+{
+	shards = std::max<std::size_t>(1, shards);
+	shardBudget_ = budget_ / shards;
+	for (std::size_t i = 0; i < shards; ++i)
+		shards_.push_back(std::make_unique<Shard>());
+}
+
+SearchCache::Shard &SearchCache::shardFor(const std::string &key)
+{
+	return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
+
+void SearchCache::erase(Shard &shard, std::list<Entry>::iterator it)
+{
+	shard.bytes -= it->bytes;
+	shard.index.erase(it->key);
+	shard.lru.erase(it);
+}
+
+SearchCache::Results SearchCache::get(const std::string &key)
+{
+	if (!enabled())
+		return nullptr;
+
+	Shard &shard = shardFor(key);
+	std::lock_guard<std::mutex> lk(shard.mtx);
+	auto found = shard.index.find(key);
+	if (found == shard.index.end())
+	{
+		++misses_;
+		return nullptr;
+	}
+
+	auto it = found->second;
+	bool expired = ttl_.count() > 0 && std::chrono::steady_clock::now() - it->stored > ttl_;
+	if (it->generation != Database::generation() || expired)
+	{
+		erase(shard, it);
+		++invalidations_;
+		++misses_;
+		return nullptr;
+	}
+
+	shard.lru.splice(shard.lru.begin(), shard.lru, it);
+	++hits_;
+	return it->results;
+}
+
+void SearchCache::put(const std::string &key, std::uint64_t generation, std::vector<SearchResult> results)
+{
+	if (!enabled() || generation != Database::generation())
+		return;
+
+	// Strings, list node and hash-map node; close enough to size the budget.
+	std::size_t bytes = sizeof(Entry) + 2 * key.size() + 64 + results.capacity() * sizeof(SearchResult);
+	for (const auto &r : results)
+		bytes += r.url.capacity();
+	if (bytes > shardBudget_)
+		return;
+
+	Shard &shard = shardFor(key);
+	std::lock_guard<std::mutex> lk(shard.mtx);
+	auto found = shard.index.find(key);
+	if (found != shard.index.end())
+		erase(shard, found->second);
+
+	shard.lru.push_front({key, std::make_shared<const std::vector<SearchResult>>(std::move(results)), generation,
+												std::chrono::steady_clock::now(), bytes});
+	shard.index.emplace(key, shard.lru.begin());
+	shard.bytes += bytes;
+
+	while (shard.bytes > shardBudget_)
+	{
+		erase(shard, std::prev(shard.lru.end()));
+		++evictions_;
+	}
+}
+
+SearchCache::Stats SearchCache::stats() const
+{
+	Stats s;
+	s.hits = hits_;
+	s.misses = misses_;
+	s.evictions = evictions_;
+	s.invalidations = invalidations_;
+	s.budgetBytes = budget_;
+	for (const auto &shard : shards_)
+	{
+		std::lock_guard<std::mutex> lk(shard->mtx);
+		s.entries += shard->lru.size();
+		s.bytes += shard->bytes;
+	}
+	return s;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "../database/Database.h"
+
+// Result lists of recent searches, keyed by the canonical query
+// (QueryParser::canonical) plus whatever else shapes the response.
+//
+// Sharded LRU with a total memory budget. Entries remember the index
+// generation (Database::generation()) they were computed at and are treated
+// as misses once it has moved on, or once they are older than the TTL.
+class SearchCache
+{
+public:
+	using Results = std::shared_ptr<const std::vector<SearchResult>>;
+
+	struct Stats
+	{
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t evictions = 0;
+		std::uint64_t invalidations = 0; // stale generation or expired TTL
+		std::size_t entries = 0;
+		std::size_t bytes = 0;
+		std::size_t budgetBytes = 0;
+	};
+
+	SearchCache(std::size_t budgetBytes, std::chrono::seconds ttl, std::size_t shards = 16);
+
+	Results get(const std::string &key);
+	// generation is the one read before the query started, so results
+	// computed while the index changed are never served as fresh.
+	void put(const std::string &key, std::uint64_t generation, std::vector<SearchResult> results);
+	Stats stats() const;
+	bool enabled() const { return budget_ > 0; }
+
+private:
+	struct Entry
+	{
+		std::string key;
+		Results results;
+		std::uint64_t generation;
+		std::chrono::steady_clock::time_point stored;
+		std::size_t bytes;
+	};
+
+	struct Shard
+	{
+		mutable std::mutex mtx;
+		std::list<Entry> lru; // front = most recently used
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;
+		std::size_t bytes = 0;
+	};
+
+	std::size_t budget_;
+	std::size_t shardBudget_;
+	std::chrono::seconds ttl_;
+	std::vector<std::unique_ptr<Shard>> shards_;
+	std::atomic<std::uint64_t> hits_{0};
+	std::atomic<std::uint64_t> misses_{0};
+	std::atomic<std::uint64_t> evictions_{0};
+	std::atomic<std::uint64_t> invalidations_{0};
+
+	Shard &shardFor(const std::string &key);
+	void erase(Shard &shard, std::list<Entry>::iterator it);
+};
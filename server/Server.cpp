@@ -1,27 +1,144 @@
 #include "Server.h"
-#include "../vars.h"
+#include <boost/locale.hpp>
+#include "../metrics/Metrics.h"
 
-Server::Server(net::io_context &ioc, unsigned short port)
-		: acceptor_(ioc, {tcp::v4(), port}), socket_(ioc) {}
+namespace
+{
+	struct SearchMetrics
+	{
+		Histogram &latency = Metrics::histogram("search_seconds", "Admission to result of searches run on the query executor.", 1e6, "", 60);
+		Counter &rejectedClient = Metrics::counter("search_rejected_total", "Searches answered 429/503 without a result.", "reason=\"client\"");
+		Counter &rejectedQueue = Metrics::counter("search_rejected_total", "Searches answered 429/503 without a result.", "reason=\"queue\"");
+		Counter &rejectedDeadline = Metrics::counter("search_rejected_total", "Searches answered 429/503 without a result.", "reason=\"deadline\"");
+		Counter &failed = Metrics::counter("search_failures_total", "Searches that ended in a 500.");
+	};
+
+	SearchMetrics &metrics()
+	{
+		static SearchMetrics instance;
+		return instance;
+	}
+
+	// A request the parser rejected, as opposed to a connection that closed
+	// or timed out, possibly in the middle of one.
+	bool malformed(const beast::error_code &ec)
+	{
+		return ec.category() == http::make_error_code(http::error::end_of_stream).category() &&
+			   ec != http::error::end_of_stream && ec != http::error::partial_message;
+	}
+
+	// Cache statistics read at scrape time; the weak pointer because the registry outlives the server.
+	std::function<double()> cacheStat(std::weak_ptr<SearchCache> cache, std::uint64_t SearchCache::Stats::*field)
+	{
+		return [cache, field]
+		{
+			auto c = cache.lock();
+			return c ? static_cast<double>(c->stats().*field) : 0.0;
+		};
+	}
+}
+
+Server::Server(net::io_context &ioc, unsigned short port, std::shared_ptr<QueryExecutor> executor,
+							 std::shared_ptr<SearchCache> cache, std::shared_ptr<StaticAssets> assets, std::shared_ptr<Suggester> suggester,
+							 std::shared_ptr<MemoryIndex> memoryIndex, const ServerOptions &options)
+		: ioc_(ioc), executor_(std::move(executor)), cache_(std::move(cache)), assets_(std::move(assets)),
+			suggester_(std::move(suggester)), memoryIndex_(std::move(memoryIndex)), options_(options)
+{
+	int acceptors = options.acceptors;
+#ifndef SO_REUSEPORT
+	acceptors = 1;
+#endif
+	tcp::endpoint endpoint{tcp::v4(), port};
+	for (int i = 0; i < std::max(1, acceptors); ++i)
+	{
+		tcp::acceptor acceptor(net::make_strand(ioc));
+		acceptor.open(endpoint.protocol());
+		acceptor.set_option(net::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+		if (acceptors > 1)
+			acceptor.set_option(net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+		acceptor.bind(endpoint);
+		acceptor.listen(net::socket_base::max_listen_connections);
+		acceptors_.push_back(std::move(acceptor));
+	}
+
+	std::weak_ptr<QueryExecutor> weakExecutor = executor_;
+	Metrics::callback("search_queue_depth", "Searches waiting for a query thread.", "gauge", [weakExecutor]
+										{
+		auto executor = weakExecutor.lock();
+		return executor ? static_cast<double>(executor->queued()) : 0.0; });
+	Metrics::callback("search_cache_hits_total", "Result cache hits.", "counter", cacheStat(cache_, &SearchCache::Stats::hits));
+	Metrics::callback("search_cache_misses_total", "Result cache misses.", "counter", cacheStat(cache_, &SearchCache::Stats::misses));
+	Metrics::callback("search_cache_evictions_total", "Entries evicted for space.", "counter", cacheStat(cache_, &SearchCache::Stats::evictions));
+	Metrics::callback("search_cache_invalidations_total", "Entries dropped as stale or expired.", "counter",
+										cacheStat(cache_, &SearchCache::Stats::invalidations));
+	std::weak_ptr<Suggester> weakSuggester = suggester_;
+	Metrics::callback("suggest_terms", "Terms in the autocomplete dictionary.", "gauge", [weakSuggester]
+										{
+		auto suggester = weakSuggester.lock();
+		return suggester ? static_cast<double>(suggester->size()) : 0.0; });
+	if (memoryIndex_)
+	{
+		std::weak_ptr<MemoryIndex> weakIndex = memoryIndex_;
+		Metrics::callback("memory_index_documents", "Documents in the in-memory index.", "gauge", [weakIndex]
+											{
+			auto memoryIndex = weakIndex.lock();
+			auto index = memoryIndex ? memoryIndex->current() : nullptr;
+			return index ? static_cast<double>(index->documents()) : 0.0; });
+		Metrics::callback("memory_index_bytes", "Memory held by the in-memory index's posting lists.", "gauge", [weakIndex]
+											{
+			auto memoryIndex = weakIndex.lock();
+			auto index = memoryIndex ? memoryIndex->current() : nullptr;
+			return index ? static_cast<double>(index->memoryBytes()) : 0.0; });
+	}
+}
 
 void Server::run()
 {
-	accept();
+	suggester_->refresh();
+	for (auto &acceptor : acceptors_)
+		accept(acceptor);
 }
 
-void Server::accept()
+void Server::accept(tcp::acceptor &acceptor)
 {
 	auto self = shared_from_this();
-	acceptor_.async_accept(socket_, [self](beast::error_code ec)
-												 {
-													 if (!ec)
-														 std::make_shared<Session>(std::move(self->socket_))->start();
+	acceptor.async_accept(net::make_strand(ioc_), [self, &acceptor](beast::error_code ec, tcp::socket socket)
+												{
+													if (!ec)
+														std::make_shared<Session>(std::move(socket), self)->start();
 
-													 self->accept();
-												 });
+													self->accept(acceptor);
+												});
 }
 
-Server::Session::Session(tcp::socket socket) : socket_(std::move(socket)) {}
+std::shared_ptr<Server::Admission> Server::admitClient(const std::string &client)
+{
+	std::lock_guard<std::mutex> lk(clientsMtx_);
+	unsigned &queries = clientQueries_[client];
+	if (queries >= options_.maxClientQueries)
+		return nullptr;
+	++queries;
+	return std::shared_ptr<Admission>(new Admission{shared_from_this(), client});
+}
+
+Server::Admission::~Admission()
+{
+	std::lock_guard<std::mutex> lk(server->clientsMtx_);
+	auto it = server->clientQueries_.find(client);
+	if (it != server->clientQueries_.end() && --it->second == 0)
+		server->clientQueries_.erase(it);
+}
+
+Server::Session::Session(tcp::socket socket, std::shared_ptr<Server> server)
+		: stream_(std::move(socket)), server_(std::move(server)), options_(server_->options_)
+{
+	beast::error_code ec;
+	auto endpoint = stream_.socket().remote_endpoint(ec);
+	if (!ec)
+		client_ = endpoint.address().to_string();
+}
 
 void Server::Session::start()
 {
@@ -30,113 +147,584 @@ void Server::Session::start()
 
 void Server::Session::readRequest()
 {
-	http::async_read(socket_, buffer_, req_,
+	if (reading_ || lastRead_ || pending_.size() >= options_.maxPipeline)
+		return;
+
+	reading_ = true;
+	parser_.emplace();
+	stream_.expires_after(options_.idleTimeout);
+	http::async_read_header(stream_, buffer_, *parser_,
+													[self = shared_from_this()](beast::error_code ec, std::size_t)
+													{
+														self->onReadHeader(ec);
+													});
+}
+
+void Server::Session::onReadHeader(beast::error_code ec)
+{
+	if (ec || parser_->is_done())
+	{
+		onRead(ec);
+		return;
+	}
+
+	stream_.expires_after(options_.readTimeout);
+	http::async_read(stream_, buffer_, *parser_,
 									 [self = shared_from_this()](beast::error_code ec, std::size_t)
 									 {
-										 if (!ec)
-											 self->handleRequest();
+										 self->onRead(ec);
 									 });
 }
 
-void Server::Session::handleRequest()
+void Server::Session::onRead(beast::error_code ec)
 {
-	http::response<http::string_body> res;
-
-	if (req_.method() == http::verb::get && req_.target() == "/")
+	reading_ = false;
+	if (ec)
 	{
-		std::ifstream file("templates/index.html");
-		if (file)
+		// Client closed, idle timeout or a malformed request: answer what was
+		// already read, then close. A malformed request is answered too, with
+		// a 400 after the others and Connection: close.
+		lastRead_ = true;
+		if (malformed(ec))
 		{
-			std::string body((std::istreambuf_iterator<char>(file)), {});
-			res.result(http::status::ok);
-			res.set(http::field::content_type, "text/html; charset=utf-8");
-			res.body() = body;
+			std::uint64_t seq = headSeq_ + pending_.size();
+			Slot slot;
+			slot.keepAlive = false;
+			pending_.push_back(std::move(slot));
+			complete(seq, errorResponse(11, http::status::bad_request, "Некорректный HTTP-запрос: " + ec.message(), false));
 		}
-		else
+		else if (pending_.empty())
+		{
+			close();
+		}
+		return;
+	}
+
+	Request req = parser_->release();
+	++requests_;
+	bool last = !req.keep_alive() || requests_ >= options_.maxRequests;
+	lastRead_ = last;
+
+	std::uint64_t seq = headSeq_ + pending_.size();
+	Slot slot;
+	slot.keepAlive = !last;
+	pending_.push_back(std::move(slot));
+	handleRequest(seq, std::move(req));
+
+	readRequest();
+}
+
+void Server::Session::complete(std::uint64_t seq, Response res)
+{
+	auto &slot = pending_[seq - headSeq_];
+	res.keep_alive(slot.keepAlive);
+	res.prepare_payload();
+	slot.response = std::make_shared<Response>(std::move(res));
+	writeNext();
+}
+
+void Server::Session::complete(std::uint64_t seq, AssetResponse res, std::shared_ptr<const StaticAssets::Asset> data)
+{
+	auto &slot = pending_[seq - headSeq_];
+	res.keep_alive(slot.keepAlive);
+	res.prepare_payload();
+	slot.assetData = std::move(data);
+	slot.asset = std::make_shared<AssetResponse>(std::move(res));
+	writeNext();
+}
+
+void Server::Session::writeNext()
+{
+	if (writing_ || pending_.empty())
+		return;
+
+	auto &slot = pending_.front();
+	if (slot.response)
+		write(slot.response);
+	else if (slot.asset)
+		write(slot.asset);
+}
+
+template <class Message>
+void Server::Session::write(std::shared_ptr<Message> message)
+{
+	writing_ = true;
+	stream_.expires_after(options_.writeTimeout);
+	http::async_write(stream_, *message,
+										[self = shared_from_this(), message](beast::error_code ec, std::size_t)
+										{
+											self->onWrite(ec, message->need_eof());
+										});
+}
+
+void Server::Session::onWrite(beast::error_code ec, bool close)
+{
+	writing_ = false;
+	pending_.pop_front();
+	++headSeq_;
+
+	if (ec || close || (lastRead_ && pending_.empty() && !reading_))
+	{
+		this->close();
+		return;
+	}
+
+	writeNext();
+	readRequest(); // may have stopped at the pipeline limit
+}
+
+void Server::Session::close()
+{
+	beast::error_code ec;
+	stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+	stream_.cancel();
+}
+
+void Server::Session::handleRequest(std::uint64_t seq, Request req)
+{
+	Response res;
+	res.version(req.version());
+
+	if (req.method() == http::verb::get && req.target() == "/stats/cache")
+	{
+		res = cacheStats(req.version());
+	}
+	else if (req.method() == http::verb::get && req.target() == "/metrics")
+	{
+		res.result(http::status::ok);
+		res.set(http::field::content_type, "text/plain; version=0.0.4");
+		res.body() = Metrics::prometheus();
+	}
+	else if (req.method() == http::verb::get && req.target().starts_with("/api/search"))
+	{
+		apiSearch(seq, req);
+		return;
+	}
+	else if (req.method() == http::verb::get && req.target().starts_with("/api/suggest"))
+	{
+		res = apiSuggest(req);
+	}
+	else if (req.method() == http::verb::get)
+	{
+		std::string path(req.target().substr(0, req.target().find('?')));
+		if (auto asset = server_->assets_->find(path))
 		{
-			res.result(http::status::not_found);
-			res.body() = "index.html not found";
+			serveAsset(seq, req, std::move(asset));
+			return;
 		}
+		res.result(http::status::not_found);
+		res.body() = "404 Not Found";
 	}
-	else if (req_.method() == http::verb::post && req_.target() == "/search")
+	else if (req.method() == http::verb::post && req.target() == "/search")
 	{
+		std::string body = req.body();
+		auto pos = body.find("query=");
+		std::string query = urlDecode((pos != std::string::npos) ? body.substr(pos + 6, body.find('&', pos) - pos - 6) : body);
+
+		QueryNode parsed;
 		try
 		{
+			parsed = QueryParser::parse(query, options_.queryLimits.maxTerms);
+		}
+		catch (const QueryError &e)
+		{
+			complete(seq, errorResponse(req.version(), http::status::bad_request, e.what(), false));
+			return;
+		}
 
-			std::string body = req_.body();
-			auto pos = body.find("query=");
-			std::string query = (pos != std::string::npos) ? body.substr(pos + 6) : body;
-			std::replace(query.begin(), query.end(), '+', ' ');
+		std::string key = QueryParser::canonical(parsed);
+		if (auto cached = server_->cache_->get(key))
+		{
+			complete(seq, searchResults(req.version(), query, *cached));
+			return;
+		}
 
-			auto words = splitWords(query);
-			if (words.empty() || words.size() > 4)
-			{
-				res.result(http::status::bad_request);
-				res.body() = "<html><body><p>Запрос должен содержать от 1 до 4 слов.</p></body></html>";
-			}
-			else
+		std::uint64_t generation = Database::generation();
+		auto self = shared_from_this();
+		submitQuery(seq, req.version(), false, [self, version = req.version(), query, parsed, key, generation](Database &db) mutable
+								{
+			auto results = self->search(db, parsed, 10, {}, false, generation);
+			auto res = searchResults(version, query, results);
+			self->server_->cache_->put(key, generation, std::move(results));
+			return res; });
+		return;
+	}
+	else
+	{
+		res.result(http::status::not_found);
+		res.body() = "404 Not Found";
+	}
+
+	complete(seq, std::move(res));
+}
+
+void Server::Session::submitQuery(std::uint64_t seq, unsigned version, bool json, std::function<Response(Database &db)> query)
+{
+	auto admission = server_->admitClient(client_);
+	if (!admission)
+	{
+		metrics().rejectedClient.add();
+		complete(seq, retryLater(version, http::status::too_many_requests, "Слишком много одновременных запросов.", json));
+		return;
+	}
+
+	// The query runs on an executor worker; the response comes back through
+	// this session's strand. The client slot is held until the job is gone.
+	auto admitted = std::chrono::steady_clock::now();
+	auto deadline = admitted + options_.queryTimeout;
+	auto self = shared_from_this();
+	bool queued = server_->executor_->submit([self, seq, version, json, query = std::move(query), admission, admitted, deadline](Database *db)
+																					 {
+		Response res;
+		try
+		{
+			if (!db)
+				throw std::runtime_error("нет соединения с базой данных");
+			if (std::chrono::steady_clock::now() >= deadline)
+				throw DeadlineExceeded("query waited out its deadline in the queue");
+
+			struct DeadlineScope
 			{
-				IniParser parser;
-				parser.load(config_path);
-				std::string dbname = parser.get("Database", "dbname");
-				std::string user = parser.get("Database", "user");
-				std::string pass = parser.get("Database", "password");
-				std::string host = parser.get("Database", "hostname");
-
-				std::string connStr = "dbname=" + dbname + " user=" + user + " password=" + pass + " host=" + host;
-				std::cout << connStr << std::endl;
-				Database db(connStr);
-				auto results = db.searchDocuments(words);
-
-				std::stringstream html;
-				html << "<html><body><h3>Результаты поиска для: " << query << "</h3>";
-
-				if (results.empty())
-				{
-					html << "<p>Ничего не найдено.</p>";
-				}
-				else
-				{
-					html << "<ol>";
-					for (auto &r : results)
-					{
-						html << "<li><a href=\"" << r.url << "\">" << r.url << "</a> ("
-								 << r.relevance << ")</li>";
-					}
-					html << "</ol>";
-				}
-				html << "</body></html>";
-
-				res.result(http::status::ok);
-				res.set(http::field::content_type, "text/html; charset=utf-8");
-				res.body() = html.str();
-			}
+				Database &db;
+				~DeadlineScope() { db.setDeadline({}); }
+			} scope{*db};
+			db->setDeadline(deadline);
+			res = query(*db);
+		}
+		catch (const QueryError &e)
+		{
+			res = errorResponse(version, http::status::bad_request, e.what(), json);
+		}
+		catch (const DeadlineExceeded &)
+		{
+			metrics().rejectedDeadline.add();
+			res = retryLater(version, http::status::service_unavailable, "Время ожидания запроса истекло, повторите запрос позже.", json);
+		}
+		catch (const pqxx::query_canceled &)
+		{
+			metrics().rejectedDeadline.add();
+			res = retryLater(version, http::status::service_unavailable, "Время ожидания запроса истекло, повторите запрос позже.", json);
 		}
 		catch (std::exception &e)
 		{
-			res.result(http::status::internal_server_error);
-			res.body() = std::string("<html><body><h3>Внутренняя ошибка</h3><p>") + e.what() + "</p></body></html>";
+			metrics().failed.add();
+			res = errorResponse(version, http::status::internal_server_error, e.what(), json);
 		}
+		metrics().latency.record(static_cast<std::uint64_t>(
+				std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - admitted).count()));
+		net::post(self->stream_.get_executor(), [self, seq, res = std::move(res)]() mutable
+							{ self->complete(seq, std::move(res)); }); });
+	if (queued)
+		return;
+
+	metrics().rejectedQueue.add();
+	complete(seq, retryLater(version, http::status::service_unavailable, "Сервер перегружен, повторите запрос позже.", json));
+}
+
+void Server::Session::apiSearch(std::uint64_t seq, const Request &req)
+{
+	std::string target(req.target());
+	unsigned version = req.version();
+
+	QueryNode parsed;
+	try
+	{
+		parsed = QueryParser::parse(queryParam(target, "q"), options_.queryLimits.maxTerms);
 	}
-	else
+	catch (const QueryError &e)
 	{
-		res.result(http::status::not_found);
-		res.body() = "404 Not Found";
+		complete(seq, errorResponse(version, http::status::bad_request, e.what(), true));
+		return;
 	}
+	auto terms = QueryParser::terms(parsed);
 
-	res.version(req_.version());
-	res.keep_alive(false);
-	res.prepare_payload();
+	std::size_t k = 10;
+	std::string kParam = queryParam(target, "k");
+	if (!kParam.empty())
+		k = std::clamp<long>(std::strtol(kParam.c_str(), nullptr, 10), 1, 100);
+	bool tf = queryParam(target, "tf") == "1";
 
-	auto sp_res = std::make_shared<http::response<http::string_body>>(std::move(res));
+	// Cursor "relevance.docId" of the last result on the previous page.
+	SearchCursor after;
+	std::string cursor = queryParam(target, "cursor");
+	if (!cursor.empty())
+	{
+		char *end = nullptr;
+		after.relevance = static_cast<int>(std::strtol(cursor.c_str(), &end, 10));
+		if (*end == '.')
+			after.docId = static_cast<int>(std::strtol(end + 1, &end, 10));
+		if (*end != '\0' || after.docId <= 0)
+		{
+			complete(seq, errorResponse(version, http::status::bad_request, "malformed cursor", true));
+			return;
+		}
+	}
+
+	std::string key = QueryParser::canonical(parsed) + '|' + std::to_string(k) + '|' + cursor + (tf ? "|tf" : "");
+	if (auto cached = server_->cache_->get(key))
+	{
+		complete(seq, apiResults(version, terms, k, tf, *cached));
+		return;
+	}
 
+	std::uint64_t generation = Database::generation();
 	auto self = shared_from_this();
-	http::async_write(socket_, *sp_res,
-										[self, sp_res](beast::error_code ec, std::size_t)
-										{
-											beast::error_code shutdown_ec;
-											self->socket_.shutdown(tcp::socket::shutdown_send, shutdown_ec);
-										});
+	submitQuery(seq, version, true, [self, version, parsed, terms, k, tf, after, key, generation](Database &db) mutable
+							{
+		// One extra row tells whether there is a next page.
+		auto results = self->search(db, parsed, k + 1, after, tf, generation);
+		auto res = apiResults(version, terms, k, tf, results);
+		self->server_->cache_->put(key, generation, std::move(results));
+		return res; });
+}
+
+std::vector<SearchResult> Server::Session::search(Database &db, const QueryNode &query, std::size_t limit,
+																								 const SearchCursor &after, bool termFrequencies,
+																								 std::uint64_t &generation) const
+{
+	auto ranks = StaticRank::current();
+	std::shared_ptr<ShardedIndex> index;
+	if (auto &memoryIndex = server_->memoryIndex_)
+	{
+		memoryIndex->refresh();
+		index = memoryIndex->current();
+	}
+	if (!index)
+	{
+		QueryPlan plan(query, db, options_.queryLimits);
+		return plan.execute(db, limit, after, termFrequencies, ranks.get());
+	}
+
+	generation = std::min(generation, index->generation());
+	QueryPlan plan(query, *index, options_.queryLimits);
+	return index->execute(plan, db, limit, after, termFrequencies, ranks.get());
+}
+
+Server::Session::Response Server::Session::apiSuggest(const Request &req) const
+{
+	std::string target(req.target());
+	auto &suggester = *server_->suggester_;
+	suggester.refresh();
+
+	std::size_t n = 8;
+	std::string nParam = queryParam(target, "n");
+	if (!nParam.empty())
+		n = std::clamp<long>(std::strtol(nParam.c_str(), nullptr, 10), 1, 50);
+
+	// Only the word being typed is completed; an empty or finished one gets no suggestions.
+	std::string query = queryParam(target, "q");
+	auto words = splitWords(query);
+	std::string prefix;
+	if (!words.empty() && !std::isspace(static_cast<unsigned char>(query.back())))
+		prefix = normalizeWords({words.back()}).front();
+
+	Response res{http::status::ok, req.version()};
+	res.set(http::field::content_type, "application/json");
+	JsonWriter json(res.body());
+	json.beginObject().key("prefix").value(prefix).key("suggestions").beginArray();
+	if (!prefix.empty())
+	{
+		for (const auto &entry : suggester.suggest(prefix, n))
+			json.beginObject().key("term").value(entry.term).key("df").value(static_cast<std::int64_t>(entry.frequency)).endObject();
+	}
+	json.endArray().endObject();
+	return res;
+}
+
+Server::Session::Response Server::Session::apiResults(unsigned version, const std::vector<std::string> &terms, std::size_t k,
+																											bool termFrequencies, const std::vector<SearchResult> &results)
+{
+	Response res{http::status::ok, version};
+	res.set(http::field::content_type, "application/json");
+
+	std::size_t count = std::min(k, results.size());
+	std::string &body = res.body();
+	body.reserve(64 + count * 128);
+	JsonWriter json(body);
+	json.beginObject().key("terms").beginArray();
+	for (const auto &term : terms)
+		json.value(term);
+	json.endArray().key("results").beginArray();
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		const auto &r = results[i];
+		json.beginObject().key("id").value(r.docId).key("url").value(r.url).key("score").value(r.relevance);
+		if (termFrequencies)
+		{
+			json.key("tf").beginObject();
+			for (std::size_t t = 0; t < terms.size() && t < r.termFrequencies.size(); ++t)
+				json.key(terms[t]).value(r.termFrequencies[t]);
+			json.endObject();
+		}
+		json.endObject();
+	}
+	json.endArray().key("next_cursor");
+	if (results.size() > k)
+		json.value(std::to_string(results[k - 1].relevance) + '.' + std::to_string(results[k - 1].docId));
+	else
+		json.null();
+	json.endObject();
+	return res;
+}
+
+Server::Session::Response Server::Session::errorResponse(unsigned version, http::status status, const std::string &message, bool json)
+{
+	Response res{status, version};
+	if (json)
+	{
+		res.set(http::field::content_type, "application/json");
+		JsonWriter(res.body()).beginObject().key("error").value(message).endObject();
+	}
+	else
+	{
+		res.set(http::field::content_type, "text/html; charset=utf-8");
+		res.body() = "<html><body><h3>" + std::string(status == http::status::internal_server_error ? "Внутренняя ошибка" : "Ошибка") +
+								 "</h3><p>" + htmlEscape(message) + "</p></body></html>";
+	}
+	return res;
+}
+
+Server::Session::Response Server::Session::retryLater(unsigned version, http::status status, const std::string &message, bool json)
+{
+	auto res = errorResponse(version, status, message, json);
+	res.set(http::field::retry_after, "1");
+	return res;
+}
+
+std::string Server::Session::queryParam(const std::string &target, const std::string &name)
+{
+	auto query = target.find('?');
+	while (query != std::string::npos)
+	{
+		auto begin = query + 1;
+		auto end = target.find('&', begin);
+		auto eq = target.find('=', begin);
+		if (eq != std::string::npos && eq < end && target.compare(begin, eq - begin, name) == 0 && eq - begin == name.size())
+			return urlDecode(target.substr(eq + 1, end == std::string::npos ? std::string::npos : end - eq - 1));
+		query = end;
+	}
+	return {};
+}
+
+std::string Server::Session::urlDecode(const std::string &s)
+{
+	std::string out;
+	out.reserve(s.size());
+	for (std::size_t i = 0; i < s.size(); ++i)
+	{
+		if (s[i] == '+')
+			out += ' ';
+		else if (s[i] == '%' && i + 2 < s.size() && std::isxdigit(static_cast<unsigned char>(s[i + 1])) &&
+						 std::isxdigit(static_cast<unsigned char>(s[i + 2])))
+		{
+			out += static_cast<char>(std::stoi(s.substr(i + 1, 2), nullptr, 16));
+			i += 2;
+		}
+		else
+			out += s[i];
+	}
+	return out;
+}
+
+void Server::Session::serveAsset(std::uint64_t seq, const Request &req, std::shared_ptr<const StaticAssets::Asset> asset)
+{
+	auto acceptEncoding = req.find(http::field::accept_encoding);
+	bool gzip = !asset->gzip.empty() && acceptEncoding != req.end() &&
+							std::string(acceptEncoding->value()).find("gzip") != std::string::npos;
+	const std::string &etag = gzip ? asset->gzipEtag : asset->etag;
+
+	auto ifNoneMatch = req.find(http::field::if_none_match);
+	if (ifNoneMatch != req.end() && std::string(ifNoneMatch->value()).find(etag) != std::string::npos)
+	{
+		Response res{http::status::not_modified, req.version()};
+		res.set(http::field::etag, etag);
+		res.set(http::field::cache_control, "no-cache");
+		complete(seq, std::move(res));
+		return;
+	}
+
+	const std::string &body = gzip ? asset->gzip : asset->body;
+	AssetResponse res{http::status::ok, req.version()};
+	res.set(http::field::content_type, asset->contentType);
+	res.set(http::field::etag, etag);
+	res.set(http::field::cache_control, "no-cache");
+	if (!asset->gzip.empty())
+		res.set(http::field::vary, "Accept-Encoding");
+	if (gzip)
+		res.set(http::field::content_encoding, "gzip");
+	res.body() = AssetResponse::body_type::value_type(body.data(), body.size());
+	complete(seq, std::move(res), std::move(asset));
+}
+
+Server::Session::Response Server::Session::cacheStats(unsigned version) const
+{
+	auto stats = server_->cache_->stats();
+	auto lookups = stats.hits + stats.misses;
+	std::stringstream json;
+	json << "{\"hits\":" << stats.hits << ",\"misses\":" << stats.misses
+			 << ",\"hit_ratio\":" << (lookups ? static_cast<double>(stats.hits) / lookups : 0.0)
+			 << ",\"evictions\":" << stats.evictions << ",\"invalidations\":" << stats.invalidations
+			 << ",\"entries\":" << stats.entries << ",\"bytes\":" << stats.bytes
+			 << ",\"budget_bytes\":" << stats.budgetBytes << ",\"generation\":" << Database::generation() << "}";
+
+	Response res{http::status::ok, version};
+	res.set(http::field::content_type, "application/json");
+	res.body() = json.str();
+	return res;
+}
+
+Server::Session::Response Server::Session::searchResults(unsigned version, const std::string &query, const std::vector<SearchResult> &results)
+{
+	std::stringstream html;
+	html << "<html><body><h3>Результаты поиска для: " << htmlEscape(query) << "</h3>";
+
+	if (results.empty())
+	{
+		html << "<p>Ничего не найдено.</p>";
+	}
+	else
+	{
+		html << "<ol>";
+		for (auto &r : results)
+		{
+			html << "<li><a href=\"" << htmlEscape(r.url) << "\">" << htmlEscape(r.url) << "</a> ("
+					 << r.relevance << ")</li>";
+		}
+		html << "</ol>";
+	}
+	html << "</body></html>";
+
+	Response res{http::status::ok, version};
+	res.set(http::field::content_type, "text/html; charset=utf-8");
+	res.body() = html.str();
+	return res;
+}
+
+std::string Server::Session::htmlEscape(const std::string &s)
+{
+	std::string out;
+	out.reserve(s.size());
+	for (char c : s)
+	{
+		switch (c)
+		{
+		case '<':
+			out += "&lt;";
+			break;
+		case '>':
+			out += "&gt;";
+			break;
+		case '&':
+			out += "&amp;";
+			break;
+		case '"':
+			out += "&quot;";
+			break;
+		default:
+			out += c;
+		}
+	}
+	return out;
 }
 
 std::vector<std::string> Server::Session::splitWords(const std::string &query)
@@ -151,3 +739,22 @@ std::vector<std::string> Server::Session::splitWords(const std::string &query)
 	}
 	return words;
 }
+
+std::vector<std::string> Server::Session::normalizeWords(std::vector<std::string> words)
+{
+	for (auto &word : words)
+	{
+		try
+		{
+			word = boost::locale::to_lower(word);
+		}
+		catch (const std::exception &)
+		{
+			std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c)
+										 { return static_cast<char>(std::tolower(c)); });
+		}
+	}
+	std::sort(words.begin(), words.end());
+	words.erase(std::unique(words.begin(), words.end()), words.end());
+	return words;
+}
@@ -5,44 +5,161 @@
 #include <boost/asio/dispatch.hpp>
 #pragma once
 #include <boost/asio/strand.hpp>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
 #include "../database/Database.h"
 #include "../parser/Parser.h"
+#include "QueryExecutor.h"
+#include "SearchCache.h"
+#include "StaticAssets.h"
+#include "Suggester.h"
+#include "JsonWriter.h"
+#include "MemoryIndex.h"
+#include "../query/QueryPlan.h"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
 namespace net = boost::asio;
 using tcp = net::ip::tcp;
 
+struct ServerOptions
+{
+	int acceptors = 1;
+	std::chrono::seconds idleTimeout{30}; // keep-alive connection closed after this long without a request
+	std::chrono::seconds readTimeout{10};  // to receive a request body once its header has arrived
+	std::chrono::seconds writeTimeout{10}; // to send one response
+	unsigned maxRequests = 1000;		  // per connection; the last response carries Connection: close
+	std::size_t maxPipeline = 16;		  // requests read ahead while earlier responses are still pending
+	// From admission to answer: a search still queued at its deadline is
+	// dropped, a running one is cancelled, and both get 503.
+	std::chrono::milliseconds queryTimeout{2000};
+	unsigned maxClientQueries = 8; // searches in flight per client address; more get 429
+	QueryLimits queryLimits;
+};
+
 class Server : public std::enable_shared_from_this<Server>
 {
 public:
-	Server(net::io_context &ioc, unsigned short port);
+	// With options.acceptors > 1 that many listening sockets share the port
+	// through SO_REUSEPORT and the kernel spreads new connections across them.
+	// Without memoryIndex every search reads the word_freq table.
+	Server(net::io_context &ioc, unsigned short port, std::shared_ptr<QueryExecutor> executor,
+				 std::shared_ptr<SearchCache> cache, std::shared_ptr<StaticAssets> assets, std::shared_ptr<Suggester> suggester,
+				 std::shared_ptr<MemoryIndex> memoryIndex, const ServerOptions &options = {});
 
 	void run();
 
 private:
-	tcp::acceptor acceptor_;
-	tcp::socket socket_;
+	net::io_context &ioc_;
+	std::vector<tcp::acceptor> acceptors_;
+	std::shared_ptr<QueryExecutor> executor_;
+	std::shared_ptr<SearchCache> cache_;
+	std::shared_ptr<StaticAssets> assets_;
+	std::shared_ptr<Suggester> suggester_;
+	std::shared_ptr<MemoryIndex> memoryIndex_;
+	ServerOptions options_;
+	std::mutex clientsMtx_;
+	std::unordered_map<std::string, unsigned> clientQueries_; // in-flight searches per client address
 
-	void accept();
+	// A search slot of one client, given back on destruction.
+	struct Admission
+	{
+		std::shared_ptr<Server> server;
+		std::string client;
+		~Admission();
+	};
 
+	void accept(tcp::acceptor &acceptor);
+	// Null when client already has maxClientQueries searches in flight.
+	std::shared_ptr<Admission> admitClient(const std::string &client);
+
+	// Keep-alive connection. Requests are read ahead (pipelined) up to
+	// maxPipeline; responses go out strictly in request order.
 	class Session : public std::enable_shared_from_this<Session>
 	{
 	public:
-		explicit Session(tcp::socket socket);
+		using Request = http::request<http::string_body>;
+		using Response = http::response<http::string_body>;
+		// Body points into a StaticAssets entry, which the slot keeps alive.
+		using AssetResponse = http::response<http::span_body<char const>>;
+
+		// The socket's executor is a strand, so a session's handlers never run concurrently.
+		Session(tcp::socket socket, std::shared_ptr<Server> server);
 		void start();
 
 	private:
-		tcp::socket socket_;
+		beast::tcp_stream stream_;
 		beast::flat_buffer buffer_;
-		http::request<http::string_body> req_;
+		std::optional<http::request_parser<http::string_body>> parser_;
+		std::shared_ptr<Server> server_; // executor, cache, assets, suggester and options
+		const ServerOptions &options_;
+		std::string client_; // remote address
+
+		// Empty until one of the responses is set.
+		struct Slot
+		{
+			std::shared_ptr<Response> response;
+			std::shared_ptr<AssetResponse> asset;
+			std::shared_ptr<const StaticAssets::Asset> assetData;
+			bool keepAlive = true;
+		};
+		// Slot per request read but not yet written, front = oldest.
+		std::deque<Slot> pending_;
+		std::uint64_t headSeq_ = 0; // request number of pending_.front()
+		unsigned requests_ = 0;
+		bool reading_ = false;
+		bool writing_ = false;
+		bool lastRead_ = false; // no more requests will be read on this connection
 
+		// The header may take up to idleTimeout to arrive, the body readTimeout after it.
 		void readRequest();
-		void handleRequest();
+		void onReadHeader(beast::error_code ec);
+		void onRead(beast::error_code ec);
+		void complete(std::uint64_t seq, Response res);
+		void complete(std::uint64_t seq, AssetResponse res, std::shared_ptr<const StaticAssets::Asset> data);
+		void writeNext();
+		template <class Message>
+		void write(std::shared_ptr<Message> message);
+		void onWrite(beast::error_code ec, bool close);
+		void close();
+		// Answers through complete(seq, ...), at once or from the query executor.
+		void handleRequest(std::uint64_t seq, Request req);
+		// Runs a query on the executor under the client cap and queryTimeout
+		// and completes seq with its response: QueryError becomes 400, a
+		// full queue or a missed deadline 503, other failures 500.
+		void submitQuery(std::uint64_t seq, unsigned version, bool json, std::function<Response(Database &db)> query);
+		// GET /api/search?q=&k=&cursor=&tf=1; q in the QueryParser language
+		void apiSearch(std::uint64_t seq, const Request &req);
+		// Plans and runs a query on the in-memory index once it is loaded, on
+		// db otherwise. generation is lowered to the in-memory index's, so
+		// results of an index that is behind are not cached as current.
+		std::vector<SearchResult> search(Database &db, const QueryNode &query, std::size_t limit, const SearchCursor &after,
+																		 bool termFrequencies, std::uint64_t &generation) const;
+		// GET /api/suggest?q=&n= completes the last word of q; answered without the executor.
+		Response apiSuggest(const Request &req) const;
+		Response cacheStats(unsigned version) const;
+		// ETag revalidation and gzip negotiation for a preloaded file.
+		void serveAsset(std::uint64_t seq, const Request &req, std::shared_ptr<const StaticAssets::Asset> asset);
+		static Response searchResults(unsigned version, const std::string &query, const std::vector<SearchResult> &results);
+		static Response apiResults(unsigned version, const std::vector<std::string> &terms, std::size_t k,
+															 bool termFrequencies, const std::vector<SearchResult> &results);
+		static Response errorResponse(unsigned version, http::status status, const std::string &message, bool json);
+		// errorResponse with Retry-After, for load shedding.
+		static Response retryLater(unsigned version, http::status status, const std::string &message, bool json);
+		static std::string queryParam(const std::string &target, const std::string &name);
+		static std::string urlDecode(const std::string &s);
+		static std::string htmlEscape(const std::string &s);
 
 		static std::vector<std::string> splitWords(const std::string &query);
+		// Lowercased, sorted and deduplicated.
+		static std::vector<std::string> normalizeWords(std::vector<std::string> words);
 	};
-};
\ No newline at end of file
+};
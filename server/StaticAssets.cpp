@@ -0,0 +1,166 @@
+#include "StaticAssets.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <zlib.h>
+#include "../file_indexer/Indexer.h"
+#include "../logger/Logger.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	std::string contentTypeFor(const fs::path &path)
+	{
+		static const std::unordered_map<std::string, std::string> types = {
+				{".html", "text/html; charset=utf-8"},
+				{".htm", "text/html; charset=utf-8"},
+				{".css", "text/css; charset=utf-8"},
+				{".js", "application/javascript; charset=utf-8"},
+				{".json", "application/json"},
+				{".txt", "text/plain; charset=utf-8"},
+				{".svg", "image/svg+xml"},
+				{".png", "image/png"},
+				{".jpg", "image/jpeg"},
+				{".ico", "image/x-icon"},
+		};
+		auto it = types.find(path.extension().string());
+		return it != types.end() ? it->second : "application/octet-stream";
+	}
+
+	bool compressible(const std::string &contentType)
+	{
+		return contentType.compare(0, 5, "text/") == 0 || contentType.find("javascript") != std::string::npos ||
+					 contentType.find("json") != std::string::npos || contentType.find("svg") != std::string::npos;
+	}
+
+	std::string gzip(const std::string &data)
+	{
+		z_stream zs{};
+		// 15 + 16: gzip wrapper rather than raw zlib.
+		if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+			return {};
+
+		std::string out(deflateBound(&zs, data.size()), '\0');
+		zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+		zs.avail_in = static_cast<uInt>(data.size());
+		zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+		zs.avail_out = static_cast<uInt>(out.size());
+		int rc = deflate(&zs, Z_FINISH);
+		out.resize(zs.total_out);
+		deflateEnd(&zs);
+		return rc == Z_STREAM_END ? out : std::string();
+	}
+
+	std::string etagOf(const std::string &data, const char *suffix = "")
+	{
+		std::ostringstream etag;
+		etag << '"' << std::hex << Indexer::contentHash(data) << suffix << '"';
+		return etag.str();
+	}
+}
+
+StaticAssets::StaticAssets(const std::string &dir, std::chrono::seconds reloadInterval)
+		: dir_(dir), reloadInterval_(reloadInterval)
+{
+	signature_ = scanSignature();
+	std::atomic_store(&assets_, load());
+	if (reloadInterval_.count() > 0)
+		watcher_ = std::thread([this]
+													 { watch(); });
+}
+
+StaticAssets::~StaticAssets()
+{
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	if (watcher_.joinable())
+		watcher_.join();
+}
+
+std::shared_ptr<const StaticAssets::Asset> StaticAssets::find(const std::string &path) const
+{
+	auto assets = std::atomic_load(&assets_);
+	auto it = assets->find(path);
+	return it != assets->end() ? it->second : nullptr;
+}
+
+std::size_t StaticAssets::size() const
+{
+	return std::atomic_load(&assets_)->size();
+}
+
+std::uintmax_t StaticAssets::scanSignature() const
+{
+	std::uintmax_t signature = 0;
+	std::error_code ec;
+	for (fs::recursive_directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec))
+	{
+		std::error_code fileEc;
+		if (!it->is_regular_file(fileEc))
+			continue;
+		std::string entry = it->path().string() + ':' + std::to_string(it->file_size(fileEc)) + ':' +
+												std::to_string(it->last_write_time(fileEc).time_since_epoch().count());
+		signature = signature * 31 + Indexer::contentHash(entry);
+	}
+	return signature;
+}
+
+std::shared_ptr<const StaticAssets::Set> StaticAssets::load() const
+{
+	auto assets = std::make_shared<Set>();
+	std::error_code ec;
+	for (fs::recursive_directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec))
+	{
+		std::error_code fileEc;
+		if (!it->is_regular_file(fileEc))
+			continue;
+
+		std::ifstream file(it->path(), std::ios::binary);
+		if (!file)
+			continue;
+
+		auto asset = std::make_shared<Asset>();
+		asset->body.assign(std::istreambuf_iterator<char>(file), {});
+		asset->contentType = contentTypeFor(it->path());
+		asset->etag = etagOf(asset->body);
+		if (compressible(asset->contentType))
+		{
+			asset->gzip = gzip(asset->body);
+			if (asset->gzip.size() >= asset->body.size())
+				asset->gzip.clear();
+			else
+				asset->gzipEtag = etagOf(asset->body, "-gz");
+		}
+
+		std::string path = "/" + fs::relative(it->path(), dir_, fileEc).generic_string();
+		(*assets)[path] = asset;
+		if (it->path().filename() == "index.html")
+		{
+			auto parent = path.substr(0, path.size() - std::string("index.html").size());
+			(*assets)[parent] = asset;
+		}
+	}
+	if (ec)
+		LOG_ERROR("STATIC") << "Не удалось прочитать " << dir_ << ": " << ec.message();
+	return assets;
+}
+
+void StaticAssets::watch()
+{
+	std::unique_lock<std::mutex> lk(mtx_);
+	while (!cv_.wait_for(lk, reloadInterval_, [this]
+											 { return stop_; }))
+	{
+		auto signature = scanSignature();
+		if (signature == signature_)
+			continue;
+		signature_ = signature;
+		auto assets = load();
+		std::atomic_store(&assets_, assets);
+		LOG_INFO("STATIC") << "Статические файлы перезагружены: " << assets->size();
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Files under a directory, loaded once and served from memory.
+//
+// Each file keeps its bytes, a gzip variant when that is smaller, and an
+// ETag per variant. The whole set is immutable and replaced as a unit on
+// reload, so responses can point straight into it for as long as they
+// hold the shared_ptr.
+class StaticAssets
+{
+public:
+	struct Asset
+	{
+		std::string contentType;
+		std::string body;
+		std::string gzip; // empty when compression does not pay off
+		std::string etag;
+		std::string gzipEtag;
+	};
+	// Request path ("/" for index.html) -> asset.
+	using Set = std::unordered_map<std::string, std::shared_ptr<const Asset>>;
+
+	// reloadInterval > 0 re-scans the directory that often and swaps in a
+	// new set when a file was added, removed or modified.
+	explicit StaticAssets(const std::string &dir, std::chrono::seconds reloadInterval = std::chrono::seconds(0));
+	~StaticAssets();
+
+	std::shared_ptr<const Asset> find(const std::string &path) const;
+	std::size_t size() const;
+
+private:
+	std::string dir_;
+	std::shared_ptr<const Set> assets_; // accessed with std::atomic_load/atomic_store
+	std::uintmax_t signature_ = 0;
+	std::chrono::seconds reloadInterval_;
+	std::thread watcher_;
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	bool stop_ = false;
+
+	std::uintmax_t scanSignature() const;
+	std::shared_ptr<const Set> load() const;
+	void watch();
+};
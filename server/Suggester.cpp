@@ -0,0 +1,88 @@
+#include "Suggester.h"
+#include "../logger/Logger.h"
+
+namespace
+{
+	// Pages fetched more recently may still be having their postings
+	// written; they are counted by a later rebuild.
+	constexpr std::chrono::seconds kSettle{30};
+}
+
+Suggester::Suggester(std::shared_ptr<QueryExecutor> executor, std::chrono::seconds rebuildInterval,
+					 std::chrono::seconds fullRebuildInterval)
+		: executor_(std::move(executor)), rebuildInterval_(rebuildInterval), fullRebuildInterval_(fullRebuildInterval),
+			dictionary_(std::make_shared<const PrefixDictionary>()) {}
+
+std::vector<PrefixDictionary::Entry> Suggester::suggest(const std::string &prefix, std::size_t n) const
+{
+	return std::atomic_load(&dictionary_)->complete(prefix, n);
+}
+
+std::size_t Suggester::size() const
+{
+	return std::atomic_load(&dictionary_)->size();
+}
+
+std::size_t Suggester::memoryBytes() const
+{
+	return std::atomic_load(&dictionary_)->memoryBytes();
+}
+
+void Suggester::refresh()
+{
+	if (rebuilding_)
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lk(mtx_);
+		if (built_ && now - lastBuild_ < rebuildInterval_)
+			return;
+		built_ = true;
+		lastBuild_ = now;
+	}
+
+	rebuilding_ = true;
+	auto self = shared_from_this();
+	bool queued = executor_->submit([self](Database *db)
+																	{
+		try
+		{
+			if (db)
+				self->rebuild(*db);
+		}
+		catch (std::exception &e)
+		{
+			LOG_ERROR("SUGGEST") << "Не удалось обновить словарь подсказок: " << e.what();
+		}
+		self->rebuilding_ = false; });
+	if (!queued)
+		rebuilding_ = false; // retried once rebuildInterval has passed
+}
+
+void Suggester::rebuild(Database &db)
+{
+	auto now = std::chrono::steady_clock::now();
+	bool full = highWater_ == 0 || now - lastFullBuild_ >= fullRebuildInterval_;
+	int upTo = db.maxDocumentId(kSettle);
+	if (full || upTo > highWater_)
+	{
+		auto vocabulary = db.loadVocabulary(full ? 0 : highWater_, upTo);
+		std::vector<PrefixDictionary::Entry> entries;
+		entries.reserve(vocabulary.size());
+		for (auto &[word, documents] : vocabulary)
+			entries.push_back({std::move(word), static_cast<std::uint32_t>(documents)});
+
+		std::shared_ptr<const PrefixDictionary> dictionary;
+		if (full)
+			dictionary = std::make_shared<const PrefixDictionary>(std::move(entries));
+		else
+			dictionary = std::make_shared<const PrefixDictionary>(std::atomic_load(&dictionary_)->merged(std::move(entries)));
+		std::atomic_store(&dictionary_, dictionary);
+		LOG_INFO("SUGGEST") << "Словарь подсказок обновлён по документам " << (full ? 1 : highWater_ + 1) << ".." << upTo
+							<< ": " << dictionary->size() << " слов, " << dictionary->memoryBytes() / 1024 << " КБ";
+		if (full)
+			lastFullBuild_ = now;
+		highWater_ = upTo;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "PrefixDictionary.h"
+#include "QueryExecutor.h"
+
+// Query autocompletion over the indexed vocabulary, ranked by document
+// frequency. Lookups only read an immutable PrefixDictionary; a new one is
+// built on the loader executor and swapped in atomically, so requests never
+// wait for a rebuild. Every rebuildInterval a rebuild asks the database what
+// was added, rather than trusting Database::generation(), which only counts
+// this process's writes while other crawlers may share the database.
+//
+// A rebuild reads only the words of the documents added since the last one
+// (above the dictionary's high-water document id) and merges their counts
+// into the current dictionary. Words of pages re-indexed under an existing
+// id are counted again that way, so the whole vocabulary is re-read every
+// fullRebuildInterval.
+class Suggester : public std::enable_shared_from_this<Suggester>
+{
+public:
+	// rebuildInterval is the minimum time between two rebuilds.
+	Suggester(std::shared_ptr<QueryExecutor> executor, std::chrono::seconds rebuildInterval,
+			  std::chrono::seconds fullRebuildInterval = std::chrono::seconds(3600));
+
+	// prefix must already be lowercased.
+	std::vector<PrefixDictionary::Entry> suggest(const std::string &prefix, std::size_t n) const;
+	// Schedules a rebuild once rebuildInterval has passed since the last one; cheap enough to call per request.
+	void refresh();
+	std::size_t size() const;
+	std::size_t memoryBytes() const;
+
+private:
+	std::shared_ptr<QueryExecutor> executor_;
+	std::chrono::seconds rebuildInterval_;
+	std::chrono::seconds fullRebuildInterval_;
+	std::shared_ptr<const PrefixDictionary> dictionary_;
+
+	std::mutex mtx_;
+	bool built_ = false; // a rebuild was submitted at least once
+	std::chrono::steady_clock::time_point lastBuild_;
+	std::atomic<bool> rebuilding_{false};
+	// Only touched by the rebuild job, which never runs twice at once.
+	int highWater_ = 0; // largest document id counted
+	std::chrono::steady_clock::time_point lastFullBuild_;
+
+	// Folds in the documents added since the last rebuild, or re-reads all
+	// of them once fullRebuildInterval has passed; a no-op otherwise.
+	void rebuild(Database &db);
+};
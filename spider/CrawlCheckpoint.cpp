@@ -0,0 +1,380 @@
+#include "CrawlCheckpoint.h"
+#include "../logger/Logger.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	// 2: Bloom filters record their initial capacity; 3: spilled runs are linked, not copied
+	const char snapshotMagic[] = "FRONTIER3";
+	const std::size_t magicSize = sizeof(snapshotMagic) - 1;
+
+	void writeU64(std::ostream &out, std::uint64_t v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+	}
+
+	std::uint64_t readU64(std::istream &in)
+	{
+		std::uint64_t v = 0;
+		if (!in.read(reinterpret_cast<char *>(&v), sizeof(v)))
+			throw std::runtime_error("Truncated frontier snapshot");
+		return v;
+	}
+
+	void writeAll(int fd, const std::string &data, const std::string &path)
+	{
+		const char *p = data.data();
+		std::size_t left = data.size();
+		while (left > 0)
+		{
+			ssize_t n = ::write(fd, p, left);
+			if (n < 0)
+				throw std::runtime_error("Cannot write " + path + ": " + std::strerror(errno));
+			p += n;
+			left -= static_cast<std::size_t>(n);
+		}
+	}
+
+	void syncPath(const std::string &path, int flags)
+	{
+		int fd = ::open(path.c_str(), flags);
+		if (fd >= 0)
+		{
+			::fsync(fd);
+			::close(fd);
+		}
+	}
+}
+
+CrawlCheckpoint::CrawlCheckpoint(const std::string &dir, std::chrono::milliseconds flushInterval,
+																 std::chrono::seconds snapshotInterval)
+		: dir_(dir), flushInterval_(flushInterval), snapshotInterval_(snapshotInterval)
+{
+	fs::create_directories(dir_);
+}
+
+CrawlCheckpoint::~CrawlCheckpoint()
+{
+	{
+		std::lock_guard<std::mutex> lk(stateMtx_);
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	if (thread_.joinable())
+		thread_.join();
+	finishRetired();
+	flush();
+	if (logFd_ >= 0)
+		::close(logFd_);
+}
+
+std::string CrawlCheckpoint::logPath(std::uint64_t generation) const
+{
+	return dir_ + "/frontier.log." + std::to_string(generation);
+}
+
+std::string CrawlCheckpoint::snapshotPath() const
+{
+	return dir_ + "/frontier.snap";
+}
+
+std::string CrawlCheckpoint::runDir(std::uint64_t generation) const
+{
+	return dir_ + "/frontier.runs." + std::to_string(generation);
+}
+
+bool CrawlCheckpoint::restore(VisitedSet &visited, std::vector<Entry> &pending)
+{
+	pending.clear();
+	std::uint64_t generation = 0;
+
+	std::ifstream snap(snapshotPath(), std::ios::binary);
+	if (snap)
+	{
+		char magic[magicSize];
+		if (!snap.read(magic, magicSize) || std::memcmp(magic, snapshotMagic, magicSize - 1) != 0)
+			throw std::runtime_error("Not a frontier snapshot: " + snapshotPath());
+		if (magic[magicSize - 1] != snapshotMagic[magicSize - 1])
+			throw std::runtime_error("Frontier snapshot of another format version, remove it to start over: " +
+									 snapshotPath());
+		generation = readU64(snap);
+		if (readU64(snap) != 0)
+			return false; // the crawl finished
+
+		std::uint64_t count = readU64(snap);
+		pending.reserve(count);
+		for (std::uint64_t i = 0; i < count; ++i)
+		{
+			Entry e;
+			e.depth = static_cast<int>(readU64(snap));
+			e.url.resize(readU64(snap));
+			if (!snap.read(&e.url[0], static_cast<std::streamsize>(e.url.size())))
+				throw std::runtime_error("Truncated frontier snapshot");
+			pending.push_back(std::move(e));
+		}
+		visited.load(snap, runDir(generation));
+	}
+	else if (!fs::exists(logPath(0)))
+	{
+		return false;
+	}
+
+	// Replay: P adds to the frontier, D retires an entry. A torn last line
+	// from a crash has no newline and is ignored.
+	std::unordered_map<std::string, std::size_t> index;
+	for (std::size_t i = 0; i < pending.size(); ++i)
+		index[pending[i].url] = i;
+
+	std::size_t replayed = 0;
+	for (std::uint64_t gen = generation; fs::exists(logPath(gen)); ++gen)
+	{
+		std::ifstream log(logPath(gen));
+		std::string line;
+		while (std::getline(log, line))
+		{
+			if (log.eof())
+				break;
+			if (line.size() > 2 && line[0] == 'P')
+			{
+				std::istringstream iss(line.substr(2));
+				Entry e;
+				iss >> e.depth;
+				iss.get();
+				std::getline(iss, e.url);
+				visited.insert(e.url);
+				index[e.url] = pending.size();
+				pending.push_back(std::move(e));
+			}
+			else if (line.size() > 2 && line[0] == 'D')
+			{
+				auto it = index.find(line.substr(2));
+				if (it != index.end())
+				{
+					pending[it->second].depth = -1;
+					index.erase(it);
+				}
+			}
+			++replayed;
+		}
+	}
+
+	pending.erase(std::remove_if(pending.begin(), pending.end(), [](const Entry &e)
+															 { return e.depth < 0; }),
+								pending.end());
+
+	LOG_INFO("CHECKPOINT") << "Restored " << pending.size() << " pending URLs and " << visited.size()
+												 << " visited from " << dir_ << " (" << replayed << " log records replayed)";
+	return true;
+}
+
+void CrawlCheckpoint::openLog(std::uint64_t generation)
+{
+	generation_ = generation;
+	std::string path = logPath(generation);
+	logFd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (logFd_ < 0)
+		throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+}
+
+void CrawlCheckpoint::start(SnapshotSource source)
+{
+	source_ = std::move(source);
+
+	// Continue numbering after any log left by an earlier run; the initial
+	// snapshot below then makes all of them obsolete.
+	std::uint64_t next = 0;
+	for (const auto &entry : fs::directory_iterator(dir_))
+	{
+		std::string name = entry.path().filename().string();
+		if (name.rfind("frontier.log.", 0) == 0)
+			next = std::max<std::uint64_t>(next, std::stoull(name.substr(13)) + 1);
+	}
+	{
+		std::lock_guard<std::mutex> lk(fileMtx_);
+		openLog(next);
+	}
+
+	writeSnapshot(source_);
+
+	stopping_ = false;
+	thread_ = std::thread([this]
+												{ run(); });
+}
+
+void CrawlCheckpoint::stop(bool complete)
+{
+	{
+		std::lock_guard<std::mutex> lk(stateMtx_);
+		stopping_ = true;
+	}
+	cv_.notify_all();
+	if (thread_.joinable())
+		thread_.join();
+
+	if (complete)
+	{
+		// Nothing left to resume; the next resume starts a fresh crawl.
+		writeSnapshot([this](std::ostream &out)
+					  { return serialize(out, rotate(), {}, StringVisitedSet(), true); });
+	}
+	else if (source_)
+	{
+		writeSnapshot(source_);
+	}
+}
+
+void CrawlCheckpoint::logPush(const std::string &url, int depth)
+{
+	std::lock_guard<std::mutex> lk(bufMtx_);
+	buffer_ += "P ";
+	buffer_ += std::to_string(depth);
+	buffer_ += ' ';
+	buffer_ += url;
+	buffer_ += '\n';
+}
+
+void CrawlCheckpoint::logDone(const std::string &url)
+{
+	std::lock_guard<std::mutex> lk(bufMtx_);
+	buffer_ += "D ";
+	buffer_ += url;
+	buffer_ += '\n';
+}
+
+void CrawlCheckpoint::flush()
+{
+	std::lock_guard<std::mutex> fileLk(fileMtx_);
+	std::string data;
+	{
+		std::lock_guard<std::mutex> lk(bufMtx_);
+		data.swap(buffer_);
+	}
+	if (data.empty() || logFd_ < 0)
+		return;
+	writeAll(logFd_, data, logPath(generation_));
+	::fdatasync(logFd_);
+	bytesLogged_ += data.size();
+}
+
+std::uint64_t CrawlCheckpoint::rotate()
+{
+	finishRetired(); // a snapshot that failed after its rotate()
+
+	// This runs under the frontier lock: the old log is only set aside here.
+	std::lock_guard<std::mutex> fileLk(fileMtx_);
+	{
+		std::lock_guard<std::mutex> lk(bufMtx_);
+		retired_.swap(buffer_);
+	}
+	retiredFd_ = logFd_;
+	openLog(generation_ + 1);
+	return generation_;
+}
+
+void CrawlCheckpoint::finishRetired()
+{
+	std::lock_guard<std::mutex> fileLk(fileMtx_);
+	if (retiredFd_ < 0)
+		return;
+	// No fdatasync here: the old generation is superseded by the snapshot
+	// being taken anyway.
+	int fd = retiredFd_;
+	std::string data;
+	data.swap(retired_);
+	retiredFd_ = -1;
+	try
+	{
+		writeAll(fd, data, logPath(generation_ - 1));
+	}
+	catch (...)
+	{
+		::close(fd);
+		throw;
+	}
+	bytesLogged_ += data.size();
+	::close(fd);
+}
+
+std::uint64_t CrawlCheckpoint::serialize(std::ostream &out, std::uint64_t generation, const std::vector<Entry> &pending,
+										 const VisitedSet &visited, bool complete)
+{
+	finishRetired();
+
+	out.write(snapshotMagic, magicSize);
+	writeU64(out, generation);
+	writeU64(out, complete ? 1 : 0);
+	writeU64(out, pending.size());
+	for (const auto &e : pending)
+	{
+		writeU64(out, static_cast<std::uint64_t>(e.depth));
+		writeU64(out, e.url.size());
+		out.write(e.url.data(), static_cast<std::streamsize>(e.url.size()));
+	}
+	visited.save(out, runDir(generation));
+	return generation;
+}
+
+void CrawlCheckpoint::writeSnapshot(const SnapshotSource &source)
+{
+	// Streamed straight into the file: a snapshot is never held in memory.
+	std::string tmp = snapshotPath() + ".tmp";
+	std::uint64_t generation;
+	{
+		std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+		if (!out)
+			throw std::runtime_error("Cannot create " + tmp + ": " + std::strerror(errno));
+		generation = source(out);
+		out.flush();
+		if (!out)
+			throw std::runtime_error("Cannot write " + tmp);
+	}
+	syncPath(tmp, O_RDONLY);
+	syncPath(runDir(generation), O_RDONLY | O_DIRECTORY); // the links, when there are any
+	fs::rename(tmp, snapshotPath());
+	syncPath(dir_, O_RDONLY | O_DIRECTORY);
+
+	for (const auto &entry : fs::directory_iterator(dir_))
+	{
+		std::string name = entry.path().filename().string();
+		if (name.rfind("frontier.log.", 0) == 0 && std::stoull(name.substr(13)) < generation)
+			fs::remove(entry.path());
+		else if (name.rfind("frontier.runs.", 0) == 0 && std::stoull(name.substr(14)) < generation)
+			fs::remove_all(entry.path());
+	}
+	++snapshots_;
+}
+
+void CrawlCheckpoint::run()
+{
+	auto nextSnapshot = std::chrono::steady_clock::now() + snapshotInterval_;
+	std::unique_lock<std::mutex> lk(stateMtx_);
+	while (!stopping_)
+	{
+		cv_.wait_for(lk, flushInterval_, [this]
+								 { return stopping_; });
+		lk.unlock();
+		try
+		{
+			flush();
+			if (std::chrono::steady_clock::now() >= nextSnapshot)
+			{
+				writeSnapshot(source_);
+				nextSnapshot = std::chrono::steady_clock::now() + snapshotInterval_;
+			}
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR("CHECKPOINT") << e.what();
+		}
+		lk.lock();
+	}
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include "VisitedSet.h"
+
+// Durable copy of the spider's frontier and visited set.
+//
+// Every queued URL and every finished task is appended to a log buffer that
+// a background thread writes out and fdatasync()s every flushInterval, so
+// workers never wait on the disk. Every snapshotInterval the background
+// thread asks the spider for a compact snapshot (pending tasks + visited
+// set), writes it beside the old one and renames it into place; logs older
+// than the snapshot are then deleted. Logs are numbered by generation and
+// the spider switches generation under its own lock while it copies its
+// pending tasks, so each record is either in the snapshot or in a newer
+// log; the snapshot itself is streamed to disk after that lock is released.
+//
+// Files in dir: frontier.snap, frontier.log.<generation>, and
+// frontier.runs.<generation>/ with hard links to the visited set's spilled
+// run files, which the snapshot names instead of copying them.
+class CrawlCheckpoint
+{
+public:
+	struct Entry
+	{
+		std::string url;
+		int depth;
+	};
+
+	// Writes a snapshot to out (via serialize()) and returns its
+	// generation; called on the background thread and expected to lock the
+	// frontier itself.
+	using SnapshotSource = std::function<std::uint64_t(std::ostream &out)>;
+
+	CrawlCheckpoint(const std::string &dir, std::chrono::milliseconds flushInterval,
+									std::chrono::seconds snapshotInterval);
+	~CrawlCheckpoint();
+
+	CrawlCheckpoint(const CrawlCheckpoint &) = delete;
+	CrawlCheckpoint &operator=(const CrawlCheckpoint &) = delete;
+
+	// Loads the last snapshot and replays the logs after it. Returns false
+	// if there is nothing to resume (no checkpoint, or the crawl completed).
+	bool restore(VisitedSet &visited, std::vector<Entry> &pending);
+
+	void start(SnapshotSource source);
+	// Writes a final snapshot and stops the background thread.
+	void stop(bool complete);
+
+	// Called with the frontier lock held.
+	void logPush(const std::string &url, int depth);
+	void logDone(const std::string &url);
+	// Starts a new log generation and returns it. Must be called with the
+	// frontier lock held, right before the pending tasks passed to
+	// serialize() are copied; it only switches files, the old log's last
+	// records are written by serialize().
+	std::uint64_t rotate();
+	// Writes the snapshot as of rotate() returning generation to out and
+	// returns generation; called without the frontier lock. visited may
+	// have grown since, but only by URLs whose push records are in the newer
+	// log, and replaying them is idempotent.
+	std::uint64_t serialize(std::ostream &out, std::uint64_t generation, const std::vector<Entry> &pending,
+							const VisitedSet &visited, bool complete = false);
+
+	std::uint64_t bytesLogged() const { return bytesLogged_; }
+	std::uint64_t snapshotsWritten() const { return snapshots_; }
+
+private:
+	std::string dir_;
+	std::chrono::milliseconds flushInterval_;
+	std::chrono::seconds snapshotInterval_;
+
+	std::mutex bufMtx_;
+	std::string buffer_;
+
+	std::mutex fileMtx_;
+	int logFd_ = -1;
+	std::uint64_t generation_ = 0;
+	// The log rotate() switched away from, with the records buffered for it.
+	int retiredFd_ = -1;
+	std::string retired_;
+
+	std::mutex stateMtx_;
+	std::condition_variable cv_;
+	bool stopping_ = false;
+	std::thread thread_;
+	SnapshotSource source_;
+
+	std::uint64_t bytesLogged_ = 0;
+	std::uint64_t snapshots_ = 0;
+
+	std::string logPath(std::uint64_t generation) const;
+	std::string snapshotPath() const;
+	std::string runDir(std::uint64_t generation) const;
+	void openLog(std::uint64_t generation);
+	void flush();
+	void finishRetired();
+	void writeSnapshot(const SnapshotSource &source);
+	void run();
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <functional>
+#include <zlib.h>
+
+// Incremental inflater for HTTP Content-Encoding gzip/deflate bodies.
+// Output is handed to the sink in bounded chunks, so memory use does not
+// depend on the compressed or decompressed size of the body.
+class Decompressor
+{
+public:
+	enum class Encoding
+	{
+		identity,
+		gzip,
+		deflate,
+		unsupported
+	};
+
+	using Sink = std::function<void(const char *data, std::size_t size)>;
+
+	explicit Decompressor(Encoding encoding);
+	~Decompressor();
+
+	Decompressor(const Decompressor &) = delete;
+	Decompressor &operator=(const Decompressor &) = delete;
+
+	static Encoding parseEncoding(const std::string &contentEncoding);
+
+	// Throws std::runtime_error on corrupt input.
+	void feed(const char *data, std::size_t size, const Sink &sink);
+	bool finished() const { return finished_; }
+
+private:
+	Encoding encoding_;
+	z_stream zs_{};
+	bool initialized_ = false;
+	bool finished_ = false;
+	bool fedInput_ = false;
+	bool rawFallback_ = false;
+
+	void init(int windowBits);
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+#include "WorkQueue.h"
+
+// Crawl frontier shared between crawler processes. Spider::crawl leases
+// batches of URLs from it and reports each batch back together with the
+// links found on those pages; the frontier decides which links are new and
+// which process fetches them.
+class Frontier
+{
+public:
+	virtual ~Frontier() = default;
+
+	// Adds URLs the frontier has not seen before.
+	virtual void seed(const std::vector<CrawlTask> &tasks) = 0;
+	// Up to max URLs leased to this process; empty if none are free right now.
+	virtual std::vector<CrawlTask> lease(std::size_t max) = 0;
+	// Marks leased URLs as fetched and adds the links discovered on them.
+	virtual void report(const std::vector<std::string> &done, const std::vector<CrawlTask> &discovered) = 0;
+	// True once no URL is pending or leased by any process.
+	virtual bool drained() = 0;
+	// Extends every lease this process holds, on URLs and on whatever they
+	// are grouped by, so pages that take longer than a lease to get through
+	// are not handed to another process meanwhile.
+	virtual void renew() = 0;
+	// How often renew() has to be called while leases are held.
+	virtual std::chrono::milliseconds renewInterval() const = 0;
+};
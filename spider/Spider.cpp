@@ -1,11 +1,38 @@
 #include "Spider.h"
 #include "../file_indexer/Indexer.h"
+#include "../file_indexer/HtmlTokenizer.h"
+#include "../metrics/Metrics.h"
+#include "../logger/Logger.h"
 #include <regex>
 
+namespace {
+    // Process-wide crawl metrics, shared by every Spider instance.
+    struct SpiderMetrics {
+        Counter &pages = Metrics::counter("spider_pages_total", "Pages fetched, 304 responses included.");
+        Counter &failures = Metrics::counter("spider_fetch_failures_total", "Fetches that failed or were rejected.");
+        Counter &wireBytes = Metrics::counter("spider_bytes_total", "Response body bytes.", "kind=\"wire\"");
+        Counter &decodedBytes = Metrics::counter("spider_bytes_total", "Response body bytes.", "kind=\"decoded\"");
+        Histogram &fetch = Metrics::histogram("spider_fetch_seconds", "Connect to last body byte, redirects included.", 1e6, "", 60);
+        Histogram &clean = Metrics::histogram("index_stage_seconds", "Time per page spent in each indexing stage.", 1e6,
+                                              "stage=\"clean\"", 60);
+        Gauge &queueDepth = Metrics::gauge("spider_queue_depth", "URLs waiting in the in-process crawl queue.");
+    };
+
+    SpiderMetrics &metrics() {
+        static SpiderMetrics instance;
+        return instance;
+    }
+}
+
 Spider::~Spider()
 {
     stop_ = true;
-    cv_.notify_all();
+    if (queue_)
+        queue_->wakeAll();
+    {
+        std::lock_guard<std::mutex> lk(doneMtx_);
+        doneCv_.notify_all();
+    }
     for (auto &t : workers_)
         if (t.joinable())
             t.join();
@@ -79,6 +106,215 @@ std::string Spider::normalizeUrl(const std::string& url, const std::string& base
 }
 
 std::string Spider::download(const std::string &url)
+{
+    std::string body;
+    if (!download(url, [&body](const char *data, std::size_t size) { body.append(data, size); }))
+        return "";
+    return body;
+}
+
+bool Spider::download(const std::string &url, const ChunkHandler &onChunk)
+{
+    Exchange ex(onChunk);
+    return download(url, ex);
+}
+
+Spider::TransferStats Spider::transferStats() const
+{
+    TransferStats stats;
+    stats.bytesOnWire = bytesOnWire_.load(std::memory_order_relaxed);
+    stats.bytesDecoded = bytesDecoded_.load(std::memory_order_relaxed);
+    stats.compressedResponses = compressedResponses_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Spider::closeStream(beast::ssl_stream<beast::tcp_stream> &stream)
+{
+    beast::error_code ec;
+    stream.shutdown(ec);
+
+    if (ec == net::error::eof || ec == ssl::error::stream_truncated) {
+        ec = {};
+    }
+
+    if (ec) {
+        LOG_DEBUG("SPIDER") << "SSL shutdown error: " << ec.message();
+    }
+}
+
+void Spider::closeStream(beast::tcp_stream &stream)
+{
+    beast::error_code ec;
+    stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+    if (ec && ec != beast::errc::not_connected) {
+        LOG_DEBUG("SPIDER") << "Socket shutdown error: " << ec.message();
+    }
+}
+
+template <class Stream>
+bool Spider::fetch(Stream &stream, const std::string &host, const std::string &target,
+                   const std::string &url, Exchange &ex)
+{
+    auto const timeout = std::chrono::seconds(10);
+
+    http::request<http::string_body> req{http::verb::get, target, 11};
+    req.set(http::field::host, host);
+    req.set(http::field::user_agent, "Mozilla/5.0 (compatible; SpiderBot/1.0; +http://example.com/bot)");
+    req.set(http::field::accept, "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8");
+    req.set(http::field::accept_language, "en-us,en;q=0.5");
+    if (options_.compression)
+        req.set(http::field::accept_encoding, "gzip, deflate");
+    req.set(http::field::connection, "close");
+    if (!ex.conditional.etag.empty())
+        req.set(http::field::if_none_match, ex.conditional.etag);
+    if (!ex.conditional.lastModified.empty())
+        req.set(http::field::if_modified_since, ex.conditional.lastModified);
+
+    beast::get_lowest_layer(stream).expires_after(timeout);
+    http::write(stream, req);
+
+    // Headers first: status, type and length are checked before any of the
+    // body is read, and the body is then pulled in fixed-size chunks so it
+    // can be inflated and handed on as it arrives instead of being buffered.
+    const size_t max_size = options_.maxBodySize;
+    beast::flat_buffer buffer;
+    http::response_parser<http::buffer_body> parser;
+    parser.body_limit(max_size);
+
+    beast::get_lowest_layer(stream).expires_after(timeout);
+    http::read_header(stream, buffer, parser);
+
+    auto &res = parser.get();
+
+    if (res.result() == http::status::moved_permanently ||
+        res.result() == http::status::found ||
+        res.result() == http::status::see_other ||
+        res.result() == http::status::temporary_redirect ||
+        res.result() == http::status::permanent_redirect) {
+
+        auto location = res.find(http::field::location);
+        if (location != res.end()) {
+            std::string new_url(location->value());
+            LOG_DEBUG("SPIDER") << "Redirect from " << url << " to: " << new_url;
+
+            new_url = normalizeUrl(new_url, url);
+
+            if (ex.redirects < 5) {
+                ex.redirects++;
+                ex.conditional = {}; // validators belong to the original URL
+                return download(new_url, ex);
+            }
+        }
+    }
+
+    if (res.result() == http::status::not_modified) {
+        ex.notModified = true;
+        closeStream(stream);
+        return true;
+    }
+
+    if (res.result() != http::status::ok) {
+        LOG_INFO("SPIDER") << "HTTP status " << res.result_int() << " for " << url;
+        return false;
+    }
+
+    auto content_type = res.find(http::field::content_type);
+    if (content_type != res.end()) {
+        std::string ct(content_type->value());
+        if (ct.find("text/html") == std::string::npos &&
+            ct.find("text/xhtml") == std::string::npos &&
+            ct.find("application/xhtml+xml") == std::string::npos) {
+            LOG_DEBUG("SPIDER") << "Skipping non-HTML content: " << ct;
+            return false;
+        }
+    }
+
+    auto encoding = Decompressor::Encoding::identity;
+    auto content_encoding = res.find(http::field::content_encoding);
+    if (content_encoding != res.end()) {
+        encoding = Decompressor::parseEncoding(std::string(content_encoding->value()));
+        if (encoding == Decompressor::Encoding::unsupported) {
+            LOG_WARN("SPIDER") << "Unsupported Content-Encoding: " << content_encoding->value() << " for " << url;
+            return false;
+        }
+    }
+
+    auto etag = res.find(http::field::etag);
+    if (etag != res.end())
+        ex.received.etag = std::string(etag->value());
+    auto last_modified = res.find(http::field::last_modified);
+    if (last_modified != res.end())
+        ex.received.lastModified = std::string(last_modified->value());
+
+    if (parser.content_length() && *parser.content_length() > max_size) {
+        LOG_WARN("SPIDER") << "Response too large: " << *parser.content_length() << " bytes for " << url;
+        return false;
+    }
+
+    Decompressor inflater(encoding);
+    std::uint64_t wire = 0;
+    std::uint64_t decoded = 0;
+    bool too_large = false;
+
+    auto sink = [&](const char *data, std::size_t size) {
+        if (decoded + size > max_size) {
+            too_large = true;
+            return;
+        }
+        decoded += size;
+        ex.onChunk(data, size);
+    };
+
+    char chunk[16 * 1024];
+    while (!parser.is_done() && !too_large) {
+        res.body().data = chunk;
+        res.body().size = sizeof(chunk);
+
+        beast::error_code ec;
+        beast::get_lowest_layer(stream).expires_after(timeout);
+        http::read(stream, buffer, parser, ec);
+        if (ec == http::error::need_buffer)
+            ec = {};
+        if (ec == http::error::body_limit)
+            too_large = true;
+        else if (ec)
+            throw beast::system_error{ec};
+
+        std::size_t n = sizeof(chunk) - res.body().size;
+        wire += n;
+        inflater.feed(chunk, n, sink);
+
+        // A tiny body that inflates to megabytes is a decompression bomb;
+        // stop before spending the CPU on the rest of it.
+        if (encoding != Decompressor::Encoding::identity &&
+            decoded > 64 * 1024 && decoded > wire * options_.maxCompressionRatio) {
+            LOG_WARN("SPIDER") << "Compression ratio too high (" << wire << " -> " << decoded
+                               << " bytes) for " << url;
+            bytesOnWire_.fetch_add(wire, std::memory_order_relaxed);
+            metrics().wireBytes.add(wire);
+            return false;
+        }
+    }
+
+    bytesOnWire_.fetch_add(wire, std::memory_order_relaxed);
+    metrics().wireBytes.add(wire);
+
+    if (too_large) {
+        LOG_WARN("SPIDER") << "Response too large: more than " << max_size << " bytes for " << url;
+        return false;
+    }
+
+    bytesDecoded_.fetch_add(decoded, std::memory_order_relaxed);
+    metrics().decodedBytes.add(decoded);
+    if (encoding != Decompressor::Encoding::identity)
+        compressedResponses_.fetch_add(1, std::memory_order_relaxed);
+
+    closeStream(stream);
+
+    return true;
+}
+
+bool Spider::download(const std::string &url, Exchange &ex)
 {
     try
     {
@@ -106,18 +342,19 @@ std::string Spider::download(const std::string &url)
 
         auto colon_pos = host.find(':');
         if (colon_pos != std::string::npos) {
+            port = host.substr(colon_pos + 1);
             host = host.substr(0, colon_pos);
         }
 
         net::io_context ioc;
 
         auto const timeout = std::chrono::seconds(10);
-        
+
         if (protocol == "https")
         {
             ssl::context ctx(ssl::context::tls_client);
             ctx.set_default_verify_paths();
-            ctx.set_verify_mode(ssl::verify_peer);
+            ctx.set_verify_mode(options_.verifyPeer ? ssl::verify_peer : ssl::verify_none);
 
             tcp::resolver resolver(ioc);
             beast::ssl_stream<beast::tcp_stream> stream(ioc, ctx);
@@ -131,84 +368,12 @@ std::string Spider::download(const std::string &url)
             }
 
             auto const results = resolver.resolve(host, port);
-            
-            beast::get_lowest_layer(stream).connect(results);
-            
-            stream.handshake(ssl::stream_base::client);
-
-            http::request<http::string_body> req{http::verb::get, target, 11};
-            req.set(http::field::host, host);
-            req.set(http::field::user_agent, "Mozilla/5.0 (compatible; SpiderBot/1.0; +http://example.com/bot)");
-            req.set(http::field::accept, "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8");
-            req.set(http::field::accept_language, "en-us,en;q=0.5");
-            req.set(http::field::connection, "close");
-
-            beast::get_lowest_layer(stream).expires_after(timeout);
-            http::write(stream, req);
-
-            beast::flat_buffer buffer;
-            http::response<http::dynamic_body> res;
-
-            beast::get_lowest_layer(stream).expires_after(timeout);
-            http::read(stream, buffer, res);
-
-            if (res.result() == http::status::moved_permanently || 
-                res.result() == http::status::found ||
-                res.result() == http::status::see_other ||
-                res.result() == http::status::temporary_redirect ||
-                res.result() == http::status::permanent_redirect) {
-                
-                auto location = res.find(http::field::location);
-                if (location != res.end()) {
-                    std::string new_url = location->value();
-                    std::cerr << "[SPIDER] Redirect from " << url << " to: " << new_url << std::endl;
-                    
-                    new_url = normalizeUrl(new_url, url);
-                    
-                    static int redirect_count = 0;
-                    if (redirect_count < 5) {
-                        redirect_count++;
-                        std::string result = download(new_url);
-                        redirect_count--;
-                        return result;
-                    }
-                }
-            }
-
-            if (res.result() != http::status::ok) {
-                std::cerr << "[SPIDER] HTTP status " << res.result_int() << " for " << url << std::endl;
-                return "";
-            }
 
-            auto content_type = res.find(http::field::content_type);
-            if (content_type != res.end()) {
-                std::string ct = content_type->value();
-                if (ct.find("text/html") == std::string::npos && 
-                    ct.find("text/xhtml") == std::string::npos &&
-                    ct.find("application/xhtml+xml") == std::string::npos) {
-                    std::cerr << "[SPIDER] Skipping non-HTML content: " << ct << std::endl;
-                    return "";
-                }
-            }
-
-            const size_t max_size = 5 * 1024 * 1024;
-            if (res.body().size() > max_size) {
-                std::cerr << "[SPIDER] Response too large: " << res.body().size() << " bytes for " << url << std::endl;
-                return "";
-            }
-
-            beast::error_code ec;
-            stream.shutdown(ec);
-
-            if (ec == net::error::eof || ec == ssl::error::stream_truncated) {
-                ec = {};
-            }
+            beast::get_lowest_layer(stream).connect(results);
 
-            if (ec && ec != ssl::error::stream_truncated) {
-                std::cerr << "[SPIDER] SSL shutdown error: " << ec.message() << std::endl;
-            }
+            stream.handshake(ssl::stream_base::client);
 
-            return beast::buffers_to_string(res.body().data());
+            return fetch(stream, host, target, url, ex);
         }
         else
         {
@@ -220,90 +385,21 @@ std::string Spider::download(const std::string &url)
             auto const results = resolver.resolve(host, port);
             stream.connect(results);
 
-            http::request<http::string_body> req{http::verb::get, target, 11};
-            req.set(http::field::host, host);
-            req.set(http::field::user_agent, "Mozilla/5.0 (compatible; SpiderBot/1.0; +http://example.com/bot)");
-            req.set(http::field::accept, "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8");
-            req.set(http::field::connection, "close");
-
-            beast::get_lowest_layer(stream).expires_after(timeout);
-            http::write(stream, req);
-
-            beast::flat_buffer buffer;
-            http::response<http::dynamic_body> res;
-
-            beast::get_lowest_layer(stream).expires_after(timeout);
-            http::read(stream, buffer, res);
-
-            if (res.result() >= http::status::moved_permanently && 
-                res.result() <= http::status::permanent_redirect) {
-                
-                auto location = res.find(http::field::location);
-                if (location != res.end()) {
-                    std::string new_url = location->value();
-                    std::cerr << "[SPIDER] Redirect from " << url << " to: " << new_url << std::endl;
-                    
-                    new_url = normalizeUrl(new_url, url);
-                    
-                    static int redirect_count = 0;
-                    if (redirect_count < 5) {
-                        redirect_count++;
-                        std::string result = download(new_url);
-                        redirect_count--;
-                        return result;
-                    }
-                }
-            }
-
-            if (res.result() != http::status::ok) {
-                std::cerr << "[SPIDER] HTTP status " << res.result_int() << " for " << url << std::endl;
-                return "";
-            }
-
-            auto content_type = res.find(http::field::content_type);
-            if (content_type != res.end()) {
-                std::string ct = content_type->value();
-                if (ct.find("text/html") == std::string::npos && 
-                    ct.find("text/xhtml") == std::string::npos &&
-                    ct.find("application/xhtml+xml") == std::string::npos) {
-                    std::cerr << "[SPIDER] Skipping non-HTML content: " << ct << std::endl;
-                    return "";
-                }
-            }
-
-            const size_t max_size = 5 * 1024 * 1024;
-            if (res.body().size() > max_size) {
-                std::cerr << "[SPIDER] Response too large: " << res.body().size() << " bytes for " << url << std::endl;
-                return "";
-            }
-
-            beast::error_code ec;
-            stream.socket().shutdown(tcp::socket::shutdown_both, ec);
-            if (ec && ec != beast::errc::not_connected) {
-                std::cerr << "[SPIDER] Socket shutdown error: " << ec.message() << std::endl;
-            }
-
-            return beast::buffers_to_string(res.body().data());
+            return fetch(stream, host, target, url, ex);
         }
     }
     catch (const std::exception &e)
     {
-        std::cerr << "[SPIDER] Download error for " << url << ": " << e.what() << std::endl;
-        return "";
+        LOG_WARN("SPIDER") << "Download error for " << url << ": " << e.what();
+        return false;
     }
 }
 
-bool Spider::pushIfNotVisited(const std::string &url, int depth, const std::string& allowed_domain)
+bool Spider::acceptUrl(const std::string &url, const std::string &allowed_domain)
 {
-    std::lock_guard<std::mutex> lk(mtx_);
-    
-    if (visited_.count(url))
-        return false;
-    
     if (!allowed_domain.empty()) {
         std::string url_domain = extractDomain(url);
         if (url_domain != allowed_domain) {
-            std::cerr << "[SPIDER] Skipping external domain: " << url_domain << " (expected: " << allowed_domain << ")" << std::endl;
             return false;
         }
     }
@@ -324,38 +420,184 @@ bool Spider::pushIfNotVisited(const std::string &url, int depth, const std::stri
             return false;
         }
     }
-    
-    visited_.insert(url);
-    queue_.push({url, depth});
-    cv_.notify_one();
-    
-    std::cerr << "[SPIDER] Added to queue: " << url << " (depth " << depth << ")" << std::endl;
     return true;
 }
 
-bool Spider::popTask(Task &task)
+bool Spider::pushIfNotVisited(const std::string &url, int depth, const std::string& allowed_domain, int worker)
 {
-    std::unique_lock<std::mutex> lk(mtx_);
-    
-    while (!cv_.wait_for(lk, std::chrono::milliseconds(100), 
-                        [this] { return stop_ || !queue_.empty(); })) {
-        if (stop_) break;
+    if (!acceptUrl(url, allowed_domain))
+        return false;
+
+    // Only the visited shard for this URL and this worker's lane are locked.
+    // The checkpoint gate is shared here and exclusive while a snapshot is
+    // captured, so a push is either in the snapshot or in the newer log.
+    std::shared_lock<std::shared_mutex> gate;
+    if (checkpoint_)
+        gate = std::shared_lock<std::shared_mutex>(checkpointGate_);
+
+    if (!visited_->insert(url))
+        return false;
+    if (checkpoint_)
+        checkpoint_->logPush(url, depth);
+    outstanding_.fetch_add(1);
+    queue_->push(worker, {url, depth});
+    metrics().queueDepth.set(static_cast<std::int64_t>(queue_->size()));
+    return true;
+}
+
+bool Spider::popTask(Task &task, int worker)
+{
+    if (!queue_->pop(worker, task, stop_))
+        return false;
+    metrics().queueDepth.set(static_cast<std::int64_t>(queue_->size()));
+
+    if (checkpoint_) {
+        std::shared_lock<std::shared_mutex> gate(checkpointGate_);
+        std::lock_guard<std::mutex> lk(mtx_);
+        inflight_.emplace(task.url, task.depth);
+    }
+    return true;
+}
+
+void Spider::taskDone(const Task &task)
+{
+    if (checkpoint_) {
+        std::shared_lock<std::shared_mutex> gate(checkpointGate_);
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            inflight_.erase(task.url);
+        }
+        checkpoint_->logDone(task.url);
     }
 
-    if (stop_ && queue_.empty())
+    // The task's own links were pushed (and counted) before this, so zero
+    // means nothing is queued and nothing is running: the crawl is done.
+    if (outstanding_.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lk(doneMtx_);
+        doneCv_.notify_all();
+    }
+}
+
+std::uint64_t Spider::captureCheckpoint(std::ostream &out)
+{
+    // Tasks being processed right now are saved as pending: a restart
+    // re-fetches them rather than losing them. Pushes and pops wait only
+    // while the tasks are copied and the log switched; the visited set is
+    // saved afterwards, shard by shard under the shards' own locks.
+    std::vector<CrawlCheckpoint::Entry> pending;
+    std::uint64_t generation;
+    {
+        std::unique_lock<std::shared_mutex> gate(checkpointGate_);
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            pending.reserve(inflight_.size());
+            for (const auto &entry : inflight_)
+                pending.push_back({entry.first, entry.second});
+        }
+        for (auto &task : queue_->snapshot())
+            pending.push_back({std::move(task.url), task.depth});
+        generation = checkpoint_->rotate();
+    }
+    return checkpoint_->serialize(out, generation, pending, *visited_);
+}
+
+bool Spider::fetchPage(Page &page)
+{
+    std::unique_ptr<HtmlTokenizer> tokenizer;
+    ChunkHandler onChunk;
+    if (options_.streamTokenize) {
+        tokenizer = std::make_unique<HtmlTokenizer>(page.url);
+        onChunk = [&tokenizer](const char *data, std::size_t size) { tokenizer->feed(data, size); };
+    } else {
+        onChunk = [&page](const char *data, std::size_t size) { page.html.append(data, size); };
+    }
+
+    Exchange ex(onChunk);
+    if (validatorLookup_)
+        validatorLookup_(page.url, ex.conditional);
+
+    auto started = std::chrono::steady_clock::now();
+    if (!download(page.url, ex)) {
+        metrics().failures.add();
         return false;
+    }
+    page.fetchTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    metrics().fetch.record(page.fetchTime.count());
+    metrics().pages.add();
+
+    page.validators = ex.received;
+    if (ex.notModified) {
+        page.notModified = true;
+        page.validators = ex.conditional;
+        return true;
+    }
 
-    if (!queue_.empty()) {
-        task = queue_.front();
-        queue_.pop();
+    if (tokenizer) {
+        tokenizer->finish();
+        page.text = tokenizer->takeText();
+        page.links = tokenizer->takeLinks();
         return true;
     }
-    
-    return false;
+
+    if (page.html.empty())
+        return false;
+    {
+        ScopedTimer timer(metrics().clean);
+        page.text = Indexer::cleanHTML(page.html);
+    }
+    page.links = Indexer::extractLinks(page.html, page.url);
+    return true;
+}
+
+void Spider::setValidatorLookup(ValidatorLookup lookup)
+{
+    validatorLookup_ = std::move(lookup);
+}
+
+void Spider::addSeed(const std::string &url, int depth)
+{
+    std::lock_guard<std::mutex> lk(mtx_);
+    seeds_.push_back({url, depth});
 }
 
-void Spider::crawl(const std::string &startUrl, int maxDepth, int numThreads, 
-                  std::function<void(const std::string &url, const std::string &html, int depth)> onPage)
+std::vector<std::string> Spider::visit(const Task &task, const PageHandler &onPage)
+{
+    std::vector<std::string> links;
+    try
+    {
+        LOG_INFO("WORKER") << "downloading: " << task.url << " depth=" << task.depth;
+        Page page;
+        page.url = task.url;
+        page.depth = task.depth;
+
+        if (fetchPage(page) && onPage)
+        {
+            // Normalized before the handler sees them, so stored links use
+            // the same form as the URLs pages are stored under.
+            for (const auto &link : page.links)
+            {
+                std::string normalized_link = normalizeUrl(link, task.url);
+                if (!normalized_link.empty())
+                    links.push_back(std::move(normalized_link));
+            }
+            page.links = links;
+
+            onPage(page);
+
+            LOG_DEBUG("WORKER") << "extracted " << page.links.size() << " links from " << task.url;
+        }
+
+        if (options_.politenessDelayMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(options_.politenessDelayMs));
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("WORKER") << "error processing " << task.url << ": " << e.what();
+    }
+    return links;
+}
+
+void Spider::crawl(const std::string &startUrl, int maxDepth, int numThreads, PageHandler onPage)
 {
     if (maxDepth < 1)
         return;
@@ -363,93 +605,254 @@ void Spider::crawl(const std::string &startUrl, int maxDepth, int numThreads,
         numThreads = 1;
 
     std::string allowed_domain = extractDomain(startUrl);
-    std::cerr << "[SPIDER] Starting crawl for domain: " << allowed_domain << " with max depth: " << maxDepth << std::endl;
+    LOG_INFO("SPIDER") << "Starting crawl for domain: " << allowed_domain << " with max depth: " << maxDepth;
+
+    queue_ = std::make_unique<WorkQueue>(numThreads);
+    outstanding_ = 0;
+    visited_->clear();
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        inflight_.clear();
+    }
 
+    std::vector<Task> seeds;
     {
         std::lock_guard<std::mutex> lk(mtx_);
-        while (!queue_.empty())
-            queue_.pop();
-        visited_.clear();
+        seeds.swap(seeds_);
+    }
+
+    bool resumed = false;
+    if (!options_.checkpointDir.empty()) {
+        checkpoint_ = std::make_unique<CrawlCheckpoint>(options_.checkpointDir,
+                                                        std::chrono::milliseconds(options_.checkpointFlushMs),
+                                                        std::chrono::seconds(options_.snapshotIntervalSec));
+        std::vector<CrawlCheckpoint::Entry> pending;
+        if (options_.resume && checkpoint_->restore(*visited_, pending)) {
+            outstanding_.fetch_add(pending.size());
+            for (auto &entry : pending)
+                queue_->push(-1, {std::move(entry.url), entry.depth});
+            resumed = true;
+        } else {
+            visited_->clear();
+        }
+    }
+
+    if (!resumed) {
+        pushIfNotVisited(startUrl, 1, allowed_domain);
+        for (const auto &seed : seeds)
+            pushIfNotVisited(seed.url, seed.depth, allowed_domain);
     }
 
-    pushIfNotVisited(startUrl, 1, allowed_domain);
+    if (checkpoint_)
+        checkpoint_->start([this](std::ostream &out) { return captureCheckpoint(out); });
 
-    std::atomic<int> activeWorkers{0};
     stop_ = false;
 
-    auto worker = [&]()
+    auto worker = [&](int id)
     {
         Task task;
         while (!stop_)
         {
-            if (!popTask(task)) {
-                continue;
+            if (!popTask(task, id)) {
+                break;
             }
 
             if (task.depth > maxDepth) {
+                taskDone(task);
                 continue;
             }
 
-            activeWorkers.fetch_add(1, std::memory_order_relaxed);
+            for (const auto &link : visit(task, onPage))
+            {
+                if (task.depth + 1 <= maxDepth)
+                    pushIfNotVisited(link, task.depth + 1, allowed_domain, id);
+            }
+
+            taskDone(task);
+        }
+    };
+
+    workers_.clear();
+    workers_.reserve(numThreads);
+    for (int i = 0; i < numThreads; ++i)
+        workers_.emplace_back(worker, i);
+
+    bool drained;
+    {
+        std::unique_lock<std::mutex> lk(doneMtx_);
+        auto finished = [this] { return outstanding_.load() == 0; };
+        if (options_.maxDuration.count() > 0) {
+            drained = doneCv_.wait_until(lk, std::chrono::steady_clock::now() + options_.maxDuration, finished);
+        } else {
+            doneCv_.wait(lk, finished);
+            drained = true;
+        }
+    }
+
+    LOG_INFO("MAIN") << "Crawling " << (drained ? "completed" : "timed out") << ". Visited " << visited_->size() << " URLs, "
+                     << queue_->steals() << " tasks stolen between workers.";
+
+    auto visited = visited_->stats();
+    {
+        LogLine line(LogLevel::info, "MAIN");
+        line << "Visited set (" << options_.visited.backend << (options_.visited.bloom ? "+bloom" : "") << "): "
+             << visited.memoryBytes << " bytes in memory";
+        if (visited.count > 0)
+            line << " (" << visited.memoryBytes / visited.count << " per URL)";
+        line << ", " << visited.diskBytes << " bytes on disk, false-positive rate " << visited.falsePositiveRate;
+    }
+
+    auto stats = transferStats();
+    {
+        LogLine line(LogLevel::info, "MAIN");
+        line << "Transfer: " << stats.bytesOnWire << " bytes on wire, " << stats.bytesDecoded
+             << " bytes decoded, " << stats.compressedResponses << " compressed responses";
+        if (stats.bytesDecoded > stats.bytesOnWire)
+            line << " (saved " << 100.0 * (stats.bytesDecoded - stats.bytesOnWire) / stats.bytesDecoded << "%)";
+    }
+
+    stop_ = true;
+    queue_->wakeAll();
+
+    for (auto &t : workers_)
+        if (t.joinable())
+            t.join();
+
+    workers_.clear();
+
+    if (checkpoint_) {
+        bool complete;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            complete = queue_->empty() && inflight_.empty();
+        }
+        checkpoint_->stop(complete);
+        LOG_INFO("MAIN") << "Checkpoint: " << checkpoint_->bytesLogged() << " log bytes, "
+                         << checkpoint_->snapshotsWritten() << " snapshots, crawl "
+                         << (complete ? "complete" : "can be resumed");
+        checkpoint_.reset();
+    }
+}
+
+void Spider::crawl(Frontier &frontier, const std::string &startUrl, int maxDepth, int numThreads, PageHandler onPage)
+{
+    std::string allowed_domain = extractDomain(startUrl);
+    LOG_INFO("SPIDER") << "Starting shared-frontier crawl for domain: " << allowed_domain
+                       << " with max depth: " << maxDepth;
+
+    // Locally the visited set only keeps this process from reporting the
+    // same link twice; the frontier table is the authoritative one.
+    visited_->clear();
 
+    std::vector<Task> seeds;
+    {
+        std::lock_guard<std::mutex> lk(mtx_);
+        seeds.swap(seeds_);
+    }
+    seeds.insert(seeds.begin(), {startUrl, 1});
+    frontier.seed(seeds);
+
+    stop_ = false;
+    std::atomic<int> running{numThreads};
+    std::atomic<std::uint64_t> leased{0};
+
+    auto worker = [&](int id)
+    {
+        std::vector<std::string> done;
+        std::vector<Task> discovered;
+        while (!stop_)
+        {
             try
             {
-                std::cerr << "[WORKER] downloading: " << task.url << " depth=" << task.depth << "\n";
-                std::string html = download(task.url);
-                
-                if (!html.empty() && onPage)
+                auto batch = frontier.lease(options_.frontierBatch);
+                if (batch.empty())
                 {
-                    onPage(task.url, html, task.depth);
-                    
-                    auto links = Indexer::extractLinks(html, task.url);
-                    std::cerr << "[WORKER] extracted " << links.size() << " links from " << task.url << "\n";
+                    if (frontier.drained())
+                        break;
+                    // The rest is leased by other workers or processes; their
+                    // reports may still add URLs we are allowed to take.
+                    std::unique_lock<std::mutex> lk(doneMtx_);
+                    doneCv_.wait_for(lk, std::chrono::milliseconds(options_.frontierIdleMs), [this] { return stop_.load(); });
+                    continue;
+                }
+                leased += batch.size();
 
-                    for (const auto &link : links)
+                for (const auto &task : batch)
+                {
+                    if (stop_)
+                        break; // the rest of the lease expires and is reclaimed
+                    done.push_back(task.url);
+                    visited_->insert(task.url);
+                    if (task.depth > maxDepth)
+                        continue;
+                    for (auto &link : visit(task, onPage))
                     {
-                        std::string normalized_link = normalizeUrl(link, task.url);
-                        if (!normalized_link.empty() && task.depth + 1 <= maxDepth) {
-                            pushIfNotVisited(normalized_link, task.depth + 1, allowed_domain);
-                        }
+                        if (task.depth + 1 <= maxDepth && acceptUrl(link, allowed_domain) && visited_->insert(link))
+                            discovered.push_back({std::move(link), task.depth + 1});
                     }
                 }
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+                frontier.report(done, discovered);
+                done.clear();
+                discovered.clear();
             }
             catch (const std::exception &e)
             {
-                std::cerr << "[WORKER] error processing " << task.url << ": " << e.what() << "\n";
+                LOG_ERROR("WORKER") << "worker " << id << " frontier error: " << e.what();
+                std::unique_lock<std::mutex> lk(doneMtx_);
+                doneCv_.wait_for(lk, std::chrono::milliseconds(options_.frontierIdleMs), [this] { return stop_.load(); });
             }
+        }
 
-            activeWorkers.fetch_sub(1, std::memory_order_relaxed);
+        if (running.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lk(doneMtx_);
+            doneCv_.notify_all();
         }
     };
 
     workers_.clear();
     workers_.reserve(numThreads);
     for (int i = 0; i < numThreads; ++i)
-        workers_.emplace_back(worker);
+        workers_.emplace_back(worker, i);
+
+    // Leases are extended on a timer, not per batch: a batch of slow or
+    // politely spaced pages can outlast the lease, and its partitions must
+    // not pass to another process while they are still being fetched.
+    std::thread renewer([&] {
+        std::unique_lock<std::mutex> lk(doneMtx_);
+        while (!doneCv_.wait_for(lk, frontier.renewInterval(), [&running] { return running.load() == 0; })) {
+            lk.unlock();
+            try {
+                frontier.renew();
+            } catch (const std::exception &e) {
+                LOG_ERROR("SPIDER") << "frontier lease renewal failed: " << e.what();
+            }
+            lk.lock();
+        }
+    });
 
-    auto start_time = std::chrono::steady_clock::now();
-    const auto max_duration = std::chrono::minutes(10);
-    
-    while (std::chrono::steady_clock::now() - start_time < max_duration)
+    bool drained;
     {
-        {
-            std::lock_guard<std::mutex> lk(mtx_);
-            if (queue_.empty() && activeWorkers.load() == 0)
-                break;
+        std::unique_lock<std::mutex> lk(doneMtx_);
+        auto finished = [&running] { return running.load() == 0; };
+        if (options_.maxDuration.count() > 0) {
+            drained = doneCv_.wait_until(lk, std::chrono::steady_clock::now() + options_.maxDuration, finished);
+        } else {
+            doneCv_.wait(lk, finished);
+            drained = true;
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        stop_ = true;
     }
-
-    std::cerr << "[MAIN] Crawling completed or timed out. Visited " << visited_.size() << " URLs." << std::endl;
-
-    stop_ = true;
-    cv_.notify_all();
+    doneCv_.notify_all();
 
     for (auto &t : workers_)
         if (t.joinable())
             t.join();
-
     workers_.clear();
-}
\ No newline at end of file
+    renewer.join();
+
+    auto stats = transferStats();
+    LOG_INFO("MAIN") << "Shared-frontier crawl " << (drained ? "completed" : "timed out") << ". Leased "
+                     << leased << " URLs, reported " << visited_->size() << " distinct URLs, "
+                     << stats.bytesOnWire << " bytes on wire.";
+}
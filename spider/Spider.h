@@ -8,14 +8,21 @@
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ssl/error.hpp>
 #include <boost/asio/ssl/stream.hpp>
-#include <queue>
-#include <unordered_set>
+#include <shared_mutex>
+#include <memory>
+#include <unordered_map>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
 #include <thread>
 #include <vector>
 #include <functional>
 #include <random>
+#include "Decompressor.h"
+#include "VisitedSet.h"
+#include "CrawlCheckpoint.h"
+#include "WorkQueue.h"
+#include "Frontier.h"
 
 namespace net = boost::asio;
 namespace beast = boost::beast;
@@ -23,32 +30,123 @@ namespace http = beast::http;
 namespace ssl = net::ssl;
 using tcp = net::ip::tcp;
 
+struct SpiderOptions
+{
+	bool compression = true;
+	std::size_t maxBodySize = 5 * 1024 * 1024; // limit on the decoded body
+	std::size_t maxCompressionRatio = 200;		 // decoded/wire ratio treated as a bomb
+	bool streamTokenize = false;							 // tokenize while downloading, never hold the raw HTML
+	VisitedSetOptions visited; // visited.shards sets the lock striping
+	std::string checkpointDir; // empty disables checkpointing
+	bool resume = false;			 // continue from checkpointDir instead of startUrl
+	int checkpointFlushMs = 200;
+	int snapshotIntervalSec = 60;
+	std::chrono::seconds maxDuration{600}; // crawl deadline; 0 waits until the frontier drains
+	int politenessDelayMs = 100;			   // pause after each page, per worker
+	int frontierBatch = 16;					   // URLs leased per worker from a shared Frontier
+	int frontierIdleMs = 500;				   // back-off when the shared frontier has nothing free
+	bool verifyPeer = true;					   // off only for local test servers with self-signed certs
+};
+
 class Spider
 {
 public:
-	Spider() = default;
+	struct TransferStats
+	{
+		std::uint64_t bytesOnWire = 0;
+		std::uint64_t bytesDecoded = 0;
+		std::uint64_t compressedResponses = 0;
+	};
+
+	// HTTP cache validators used for conditional re-fetching.
+	struct Validators
+	{
+		std::string etag;
+		std::string lastModified;
+	};
+
+	struct Page
+	{
+		std::string url;
+		int depth = 0;
+		std::string html; // empty when SpiderOptions::streamTokenize is set
+		std::string text;
+		std::vector<std::string> links; // normalized by the time a PageHandler sees them
+		Validators validators;
+		bool notModified = false; // 304: html, text and links are empty
+		std::chrono::microseconds fetchTime{0}; // connect to last body byte, redirects included
+	};
+
+	using ChunkHandler = std::function<void(const char *data, std::size_t size)>;
+	using PageHandler = std::function<void(const Page &page)>;
+	// Fills the validators stored for a URL; called concurrently by workers.
+	using ValidatorLookup = std::function<bool(const std::string &url, Validators &validators)>;
+
+	explicit Spider(const SpiderOptions &options = {})
+			: visited_(std::make_unique<ShardedVisitedSet>(options.visited)), options_(options) {}
 	~Spider();
 	std::string download(const std::string &url);
-	void crawl(const std::string &startUrl, int maxDepth, int numThreads,
-						 std::function<void(const std::string &url, const std::string &html, int depth)> onPage);
+	// Streams the decoded body to onChunk; false if the page was rejected.
+	bool download(const std::string &url, const ChunkHandler &onChunk);
+	TransferStats transferStats() const;
+	// Sends If-None-Match/If-Modified-Since for URLs the lookup knows.
+	void setValidatorLookup(ValidatorLookup lookup);
+	// Queues an extra start URL for the next crawl (e.g. known documents on a re-crawl).
+	void addSeed(const std::string &url, int depth);
+	void crawl(const std::string &startUrl, int maxDepth, int numThreads, PageHandler onPage);
+	// Crawls from a frontier shared with other processes instead of the
+	// in-process queue; returns once the frontier is drained everywhere.
+	void crawl(Frontier &frontier, const std::string &startUrl, int maxDepth, int numThreads, PageHandler onPage);
 
 private:
-	struct Task
+	using Task = CrawlTask;
+
+	struct Exchange
 	{
-		std::string url;
-		int depth;
+		explicit Exchange(const ChunkHandler &handler) : onChunk(handler) {}
+
+		const ChunkHandler &onChunk;
+		Validators conditional;
+		Validators received;
+		bool notModified = false;
+		int redirects = 0;
 	};
 
-	std::queue<Task> queue_;
-	std::unordered_set<std::string> visited_;
-	std::mutex mtx_;
-	std::condition_variable cv_;
+	std::unique_ptr<WorkQueue> queue_;
+	std::vector<Task> seeds_;
+	ValidatorLookup validatorLookup_;
+	std::unique_ptr<VisitedSet> visited_;
+	std::unique_ptr<CrawlCheckpoint> checkpoint_;
+	std::unordered_map<std::string, int> inflight_; // popped, not yet done; tracked for checkpoints
+	std::shared_mutex checkpointGate_;
+	std::mutex mtx_; // seeds_ and inflight_
+	// Tasks queued or being processed. Incremented on enqueue, decremented
+	// once a task's links have been enqueued; reaching zero ends the crawl.
+	std::atomic<std::size_t> outstanding_{0};
+	std::mutex doneMtx_;
+	std::condition_variable doneCv_;
 	std::atomic<bool> stop_{false};
 	std::vector<std::thread> workers_;
+	SpiderOptions options_;
+
+	std::atomic<std::uint64_t> bytesOnWire_{0};
+	std::atomic<std::uint64_t> bytesDecoded_{0};
+	std::atomic<std::uint64_t> compressedResponses_{0};
 
 	std::string generateUserAgent();
 	std::string extractDomain(const std::string &url);
 	std::string normalizeUrl(const std::string &url, const std::string &base_url);
-	bool pushIfNotVisited(const std::string &url, int depth, const std::string &allowed_domain = "");
-	bool popTask(Task &task);
+	bool download(const std::string &url, Exchange &ex);
+	template <class Stream>
+	bool fetch(Stream &stream, const std::string &host, const std::string &target, const std::string &url, Exchange &ex);
+	bool fetchPage(Page &page);
+	static void closeStream(beast::ssl_stream<beast::tcp_stream> &stream);
+	static void closeStream(beast::tcp_stream &stream);
+	bool acceptUrl(const std::string &url, const std::string &allowed_domain);
+	// Fetches a task's page, hands it to onPage and returns its normalized links.
+	std::vector<std::string> visit(const Task &task, const PageHandler &onPage);
+	bool pushIfNotVisited(const std::string &url, int depth, const std::string &allowed_domain = "", int worker = -1);
+	bool popTask(Task &task, int worker);
+	void taskDone(const Task &task);
+	std::uint64_t captureCheckpoint(std::ostream &out);
 };
\ No newline at end of file
@@ -0,0 +1,840 @@
+#include "VisitedSet.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	const std::size_t sparseStep = 256;
+	const std::size_t maxRuns = 8;
+	const std::uint64_t bloomSeed1 = 0x9E3779B97F4A7C15ULL;
+	const std::uint64_t bloomSeed2 = 0xC2B2AE3D27D4EB4FULL;
+	const std::uint64_t shardSeed = 0x2545F4914F6CDD1DULL;
+
+	void writeU64(std::ostream &out, std::uint64_t v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+	}
+
+	std::uint64_t readU64(std::istream &in)
+	{
+		std::uint64_t v = 0;
+		if (!in.read(reinterpret_cast<char *>(&v), sizeof(v)))
+			throw std::runtime_error("Truncated visited set data");
+		return v;
+	}
+
+	// Run files are never modified, so a second name for one is as good as a copy.
+	void linkOrCopy(const std::string &from, const std::string &to)
+	{
+		std::error_code ec;
+		fs::remove(to, ec);
+		fs::create_hard_link(from, to, ec);
+		if (ec)
+			fs::copy_file(from, to, fs::copy_options::overwrite_existing);
+	}
+}
+
+std::uint64_t VisitedSet::hash(const std::string &url, std::uint64_t seed)
+{
+	// MurmurHash64A
+	const std::uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	std::uint64_t h = seed ^ (url.size() * m);
+
+	const char *data = url.data();
+	std::size_t blocks = url.size() / 8;
+	for (std::size_t i = 0; i < blocks; ++i)
+	{
+		std::uint64_t k;
+		std::memcpy(&k, data + i * 8, 8);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	const unsigned char *tail = reinterpret_cast<const unsigned char *>(data + blocks * 8);
+	switch (url.size() & 7)
+	{
+	case 7: h ^= std::uint64_t(tail[6]) << 48; [[fallthrough]];
+	case 6: h ^= std::uint64_t(tail[5]) << 40; [[fallthrough]];
+	case 5: h ^= std::uint64_t(tail[4]) << 32; [[fallthrough]];
+	case 4: h ^= std::uint64_t(tail[3]) << 24; [[fallthrough]];
+	case 3: h ^= std::uint64_t(tail[2]) << 16; [[fallthrough]];
+	case 2: h ^= std::uint64_t(tail[1]) << 8; [[fallthrough]];
+	case 1:
+		h ^= std::uint64_t(tail[0]);
+		h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+std::unique_ptr<VisitedSet> VisitedSet::create(const VisitedSetOptions &options)
+{
+	std::unique_ptr<VisitedSet> set;
+	if (options.backend == "strings")
+		set = std::make_unique<StringVisitedSet>();
+	else if (options.backend == "fingerprint64")
+		set = std::make_unique<FingerprintVisitedSet>(false, options.spillDir, options.spillThreshold);
+	else if (options.backend == "fingerprint128")
+		set = std::make_unique<FingerprintVisitedSet>(true, options.spillDir, options.spillThreshold);
+	else
+		throw std::runtime_error("Unknown visited set backend: " + options.backend);
+
+	if (options.bloom)
+		set = std::make_unique<BloomVisitedSet>(std::move(set), options.bloomErrorRate, options.bloomCapacity);
+	return set;
+}
+
+// ShardedVisitedSet
+
+ShardedVisitedSet::ShardedVisitedSet(const VisitedSetOptions &options)
+{
+	VisitedSetOptions shardOptions = options;
+	int n = std::max(1, options.shards);
+	shardOptions.spillThreshold = std::max<std::size_t>(options.spillThreshold / n, 1024);
+	shardOptions.bloomCapacity = std::max<std::size_t>(options.bloomCapacity / n, 1024);
+	shards_.reserve(n);
+	for (int i = 0; i < n; ++i)
+	{
+		auto shard = std::make_unique<Shard>();
+		shard->set = create(shardOptions);
+		shards_.push_back(std::move(shard));
+	}
+}
+
+ShardedVisitedSet::Shard &ShardedVisitedSet::shardFor(const std::string &url) const
+{
+	// Own seed: shards must not correlate with the slots inside a shard,
+	// which are chosen by the unseeded hash.
+	return *shards_[hash(url, shardSeed) % shards_.size()];
+}
+
+bool ShardedVisitedSet::insert(const std::string &url)
+{
+	Shard &shard = shardFor(url);
+	std::lock_guard<std::mutex> lk(shard.mtx);
+	return shard.set->insert(url);
+}
+
+bool ShardedVisitedSet::contains(const std::string &url) const
+{
+	Shard &shard = shardFor(url);
+	std::lock_guard<std::mutex> lk(shard.mtx);
+	return shard.set->contains(url);
+}
+
+void ShardedVisitedSet::clear()
+{
+	for (auto &shard : shards_)
+	{
+		std::lock_guard<std::mutex> lk(shard->mtx);
+		shard->set->clear();
+	}
+}
+
+std::size_t ShardedVisitedSet::size() const
+{
+	std::size_t n = 0;
+	for (const auto &shard : shards_)
+	{
+		std::lock_guard<std::mutex> lk(shard->mtx);
+		n += shard->set->size();
+	}
+	return n;
+}
+
+VisitedSet::Stats ShardedVisitedSet::stats() const
+{
+	Stats total;
+	for (const auto &shard : shards_)
+	{
+		std::lock_guard<std::mutex> lk(shard->mtx);
+		Stats s = shard->set->stats();
+		total.count += s.count;
+		total.memoryBytes += s.memoryBytes;
+		total.diskBytes += s.diskBytes;
+		total.falsePositiveRate += s.falsePositiveRate; // a URL is probed in one shard only
+	}
+	total.falsePositiveRate /= shards_.size();
+	return total;
+}
+
+void ShardedVisitedSet::save(std::ostream &out, const std::string &runDir) const
+{
+	writeU64(out, shards_.size());
+	for (const auto &shard : shards_)
+	{
+		std::lock_guard<std::mutex> lk(shard->mtx);
+		shard->set->save(out, runDir);
+	}
+}
+
+void ShardedVisitedSet::load(std::istream &in, const std::string &runDir)
+{
+	if (readU64(in) != shards_.size())
+		throw std::runtime_error("Visited set checkpoint was written with a different shard count");
+	for (auto &shard : shards_)
+	{
+		std::lock_guard<std::mutex> lk(shard->mtx);
+		shard->set->load(in, runDir);
+	}
+}
+
+// StringVisitedSet
+
+bool StringVisitedSet::insert(const std::string &url)
+{
+	return urls_.insert(url).second;
+}
+
+bool StringVisitedSet::contains(const std::string &url) const
+{
+	return urls_.count(url) != 0;
+}
+
+void StringVisitedSet::clear()
+{
+	urls_.clear();
+}
+
+std::size_t StringVisitedSet::size() const
+{
+	return urls_.size();
+}
+
+VisitedSet::Stats StringVisitedSet::stats() const
+{
+	Stats s;
+	s.count = urls_.size();
+	// Bucket array, plus per node: next pointer, cached hash, the string
+	// object and malloc's header; long URLs add a heap buffer of their own.
+	s.memoryBytes = urls_.bucket_count() * sizeof(void *);
+	for (const auto &url : urls_)
+	{
+		s.memoryBytes += sizeof(void *) + sizeof(std::size_t) + sizeof(std::string) + 16;
+		if (url.capacity() > 15)
+			s.memoryBytes += url.capacity() + 1 + 16;
+	}
+	return s;
+}
+
+void StringVisitedSet::save(std::ostream &out, const std::string &) const
+{
+	writeU64(out, urls_.size());
+	for (const auto &url : urls_)
+	{
+		writeU64(out, url.size());
+		out.write(url.data(), static_cast<std::streamsize>(url.size()));
+	}
+}
+
+void StringVisitedSet::load(std::istream &in, const std::string &)
+{
+	urls_.clear();
+	std::uint64_t count = readU64(in);
+	urls_.reserve(count);
+	std::string url;
+	for (std::uint64_t i = 0; i < count; ++i)
+	{
+		url.resize(readU64(in));
+		if (!in.read(&url[0], static_cast<std::streamsize>(url.size())))
+			throw std::runtime_error("Truncated visited set data");
+		urls_.insert(url);
+	}
+}
+
+// FingerprintVisitedSet
+
+FingerprintVisitedSet::FingerprintVisitedSet(bool wide, const std::string &spillDir, std::size_t spillThreshold)
+		: wide_(wide), spillDir_(spillDir), spillThreshold_(std::max<std::size_t>(spillThreshold, 1024))
+{
+	clear();
+}
+
+FingerprintVisitedSet::~FingerprintVisitedSet()
+{
+	closeRuns();
+}
+
+void FingerprintVisitedSet::closeRuns()
+{
+	for (auto &run : runs_)
+	{
+		if (run.fd >= 0)
+			::close(run.fd);
+		std::remove(run.path.c_str());
+	}
+	runs_.clear();
+}
+
+FingerprintVisitedSet::Key FingerprintVisitedSet::key(const std::string &url) const
+{
+	Key k{hash(url), wide_ ? hash(url, 0x51ED270B27D4EB4FULL) : 0};
+	if (k.hi == 0 && k.lo == 0)
+		k.hi = 1; // all-zero marks an empty slot
+	return k;
+}
+
+bool FingerprintVisitedSet::tableFind(const Key &k, std::size_t &slot) const
+{
+	std::size_t width = wide_ ? 2 : 1;
+	for (std::size_t i = k.hi & mask_;; i = (i + 1) & mask_)
+	{
+		std::uint64_t hi = slots_[i * width];
+		std::uint64_t lo = wide_ ? slots_[i * width + 1] : 0;
+		if (hi == 0 && lo == 0)
+		{
+			slot = i;
+			return false;
+		}
+		if (hi == k.hi && lo == k.lo)
+		{
+			slot = i;
+			return true;
+		}
+	}
+}
+
+void FingerprintVisitedSet::tablePut(const Key &k)
+{
+	if ((used_ + 1) * 10 > (mask_ + 1) * 7)
+		grow();
+
+	std::size_t slot;
+	if (tableFind(k, slot))
+		return;
+	std::size_t width = wide_ ? 2 : 1;
+	slots_[slot * width] = k.hi;
+	if (wide_)
+		slots_[slot * width + 1] = k.lo;
+	++used_;
+}
+
+void FingerprintVisitedSet::grow()
+{
+	std::vector<std::uint64_t> old;
+	old.swap(slots_);
+	std::size_t width = wide_ ? 2 : 1;
+	std::size_t capacity = (mask_ + 1) * 2;
+	slots_.assign(capacity * width, 0);
+	mask_ = capacity - 1;
+	used_ = 0;
+
+	for (std::size_t i = 0; i < old.size(); i += width)
+	{
+		Key k{old[i], wide_ ? old[i + 1] : 0};
+		if (k.hi || k.lo)
+			tablePut(k);
+	}
+}
+
+bool FingerprintVisitedSet::insert(const std::string &url)
+{
+	Key k = key(url);
+	std::size_t slot;
+	if (tableFind(k, slot))
+		return false;
+	for (const auto &run : runs_)
+		if (runContains(run, k))
+			return false;
+
+	tablePut(k);
+	++total_;
+	if (!spillDir_.empty() && used_ >= spillThreshold_)
+		spill();
+	return true;
+}
+
+void FingerprintVisitedSet::add(const std::string &url)
+{
+	addKey(key(url));
+}
+
+void FingerprintVisitedSet::addKey(const Key &k)
+{
+	tablePut(k);
+	++total_;
+	if (!spillDir_.empty() && used_ >= spillThreshold_)
+		spill();
+}
+
+void FingerprintVisitedSet::save(std::ostream &out, const std::string &runDir) const
+{
+	std::size_t width = wide_ ? 2 : 1;
+	writeU64(out, width);
+	writeU64(out, total_);
+	writeU64(out, used_);
+	for (std::size_t i = 0; i < slots_.size(); i += width)
+	{
+		if (slots_[i] || (wide_ && slots_[i + 1]))
+		{
+			writeU64(out, slots_[i]);
+			if (wide_)
+				writeU64(out, slots_[i + 1]);
+		}
+	}
+
+	writeU64(out, runs_.size());
+	if (!runs_.empty())
+		fs::create_directories(runDir);
+	for (const auto &run : runs_)
+	{
+		std::string name = fs::path(run.path).filename().string();
+		linkOrCopy(run.path, runDir + "/" + name);
+		writeU64(out, run.count);
+		writeU64(out, name.size());
+		out.write(name.data(), static_cast<std::streamsize>(name.size()));
+	}
+}
+
+void FingerprintVisitedSet::load(std::istream &in, const std::string &runDir)
+{
+	clear();
+	std::uint64_t width = readU64(in);
+	if (width != (wide_ ? 2u : 1u))
+		throw std::runtime_error("Visited set checkpoint has a different fingerprint width");
+	std::uint64_t total = readU64(in);
+	std::uint64_t count = readU64(in);
+	for (std::uint64_t i = 0; i < count; ++i)
+	{
+		Key k{readU64(in), 0};
+		if (wide_)
+			k.lo = readU64(in);
+		addKey(k);
+	}
+
+	std::uint64_t runs = readU64(in);
+	for (std::uint64_t i = 0; i < runs; ++i)
+	{
+		std::uint64_t keys = readU64(in);
+		std::string name(readU64(in), '\0');
+		if (!in.read(&name[0], static_cast<std::streamsize>(name.size())))
+			throw std::runtime_error("Truncated visited set data");
+		std::string path = runDir + "/" + name;
+		if (!spillDir_.empty())
+		{
+			// Linked under a name of our own: closeRuns() removes it, not the checkpoint's.
+			std::string own = nextRunPath();
+			linkOrCopy(path, own);
+			openRun(own, static_cast<std::size_t>(keys));
+			continue;
+		}
+
+		// Spilling is off now: the run's keys go back into the table.
+		std::ifstream run(path, std::ios::binary);
+		if (!run)
+			throw std::runtime_error("Cannot open visited set run: " + path);
+		for (std::uint64_t j = 0; j < keys; ++j)
+		{
+			Key k{readU64(run), 0};
+			if (wide_)
+				k.lo = readU64(run);
+			addKey(k);
+		}
+	}
+	total_ = static_cast<std::size_t>(total);
+	if (runs_.size() > maxRuns)
+		mergeRuns();
+}
+
+bool FingerprintVisitedSet::contains(const std::string &url) const
+{
+	Key k = key(url);
+	std::size_t slot;
+	if (tableFind(k, slot))
+		return true;
+	for (const auto &run : runs_)
+		if (runContains(run, k))
+			return true;
+	return false;
+}
+
+void FingerprintVisitedSet::clear()
+{
+	closeRuns();
+	std::size_t capacity = 1024;
+	slots_.assign(capacity * (wide_ ? 2 : 1), 0);
+	mask_ = capacity - 1;
+	used_ = 0;
+	total_ = 0;
+}
+
+std::size_t FingerprintVisitedSet::size() const
+{
+	return total_;
+}
+
+VisitedSet::Stats FingerprintVisitedSet::stats() const
+{
+	Stats s;
+	s.count = total_;
+	s.memoryBytes = slots_.capacity() * sizeof(std::uint64_t);
+	for (const auto &run : runs_)
+	{
+		s.memoryBytes += run.sparse.capacity() * sizeof(Key);
+		s.diskBytes += run.count * (wide_ ? 16 : 8);
+	}
+	// Birthday bound: a new URL collides with one of n stored fingerprints.
+	s.falsePositiveRate = std::ldexp(static_cast<double>(total_), wide_ ? -128 : -64);
+	return s;
+}
+
+void FingerprintVisitedSet::spill()
+{
+	std::vector<Key> keys;
+	keys.reserve(used_);
+	std::size_t width = wide_ ? 2 : 1;
+	for (std::size_t i = 0; i < slots_.size(); i += width)
+	{
+		Key k{slots_[i], wide_ ? slots_[i + 1] : 0};
+		if (k.hi || k.lo)
+			keys.push_back(k);
+	}
+	std::sort(keys.begin(), keys.end());
+	std::size_t next = 0;
+	writeRun([&](Key &k)
+			 {
+		if (next == keys.size())
+			return false;
+		k = keys[next++];
+		return true; });
+
+	std::fill(slots_.begin(), slots_.end(), 0);
+	used_ = 0;
+
+	if (runs_.size() > maxRuns)
+		mergeRuns();
+}
+
+std::string FingerprintVisitedSet::nextRunPath()
+{
+	return spillDir_ + "/visited-" + std::to_string(::getpid()) + "-" +
+		   std::to_string(reinterpret_cast<std::uintptr_t>(this)) + "-" + std::to_string(spillSeq_++) + ".run";
+}
+
+void FingerprintVisitedSet::writeRun(const std::function<bool(Key &)> &next)
+{
+	Run run;
+	run.path = nextRunPath();
+	{
+		std::ofstream out(run.path, std::ios::binary | std::ios::trunc);
+		if (!out)
+			throw std::runtime_error("Cannot create visited set run: " + run.path);
+		Key k;
+		for (; next(k); ++run.count)
+		{
+			out.write(reinterpret_cast<const char *>(&k.hi), 8);
+			if (wide_)
+				out.write(reinterpret_cast<const char *>(&k.lo), 8);
+			if (run.count % sparseStep == 0)
+				run.sparse.push_back(k);
+		}
+		if (!out)
+			throw std::runtime_error("Cannot write visited set run: " + run.path);
+	}
+	run.fd = ::open(run.path.c_str(), O_RDONLY);
+	if (run.fd < 0)
+		throw std::runtime_error("Cannot open visited set run: " + run.path);
+	runs_.push_back(std::move(run));
+}
+
+void FingerprintVisitedSet::openRun(const std::string &path, std::size_t count)
+{
+	Run run;
+	run.path = path;
+	run.count = count;
+	run.fd = ::open(path.c_str(), O_RDONLY);
+	if (run.fd < 0)
+		throw std::runtime_error("Cannot open visited set run: " + path);
+
+	// Only the sparse index is read back, one key per sparseStep.
+	std::size_t width = wide_ ? 2 : 1;
+	ssize_t want = static_cast<ssize_t>(width * sizeof(std::uint64_t));
+	for (std::size_t i = 0; i < count; i += sparseStep)
+	{
+		std::uint64_t buf[2] = {0, 0};
+		if (::pread(run.fd, buf, want, static_cast<off_t>(i * width * sizeof(std::uint64_t))) != want)
+		{
+			::close(run.fd);
+			throw std::runtime_error("Cannot read visited set run: " + path);
+		}
+		run.sparse.push_back({buf[0], buf[1]});
+	}
+	runs_.push_back(std::move(run));
+}
+
+bool FingerprintVisitedSet::runContains(const Run &run, const Key &k) const
+{
+	if (run.sparse.empty() || k < run.sparse.front())
+		return false;
+
+	auto it = std::upper_bound(run.sparse.begin(), run.sparse.end(), k);
+	std::size_t block = static_cast<std::size_t>(it - run.sparse.begin()) - 1;
+	std::size_t first = block * sparseStep;
+	std::size_t n = std::min(sparseStep, run.count - first);
+	std::size_t width = wide_ ? 2 : 1;
+
+	std::uint64_t buf[sparseStep * 2];
+	ssize_t want = static_cast<ssize_t>(n * width * sizeof(std::uint64_t));
+	if (::pread(run.fd, buf, want, static_cast<off_t>(first * width * sizeof(std::uint64_t))) != want)
+		throw std::runtime_error("Cannot read visited set run: " + run.path);
+
+	std::size_t lo = 0, hi = n;
+	while (lo < hi)
+	{
+		std::size_t mid = (lo + hi) / 2;
+		Key m{buf[mid * width], wide_ ? buf[mid * width + 1] : 0};
+		if (m == k)
+			return true;
+		if (m < k)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
+void FingerprintVisitedSet::mergeRuns()
+{
+	// Streaming k-way merge of all runs into one, written as the heap pops
+	// the keys, so it needs memory for one key per run and the new run's
+	// sparse index only. Runs never overlap because insert() checks them
+	// first, so no de-duplication is needed.
+	struct Cursor
+	{
+		std::ifstream in;
+		Key current;
+		bool valid = false;
+	};
+	std::vector<Cursor> cursors(runs_.size());
+	auto advance = [this](Cursor &c)
+	{
+		c.current.lo = 0;
+		c.valid = static_cast<bool>(c.in.read(reinterpret_cast<char *>(&c.current.hi), 8));
+		if (c.valid && wide_)
+			c.valid = static_cast<bool>(c.in.read(reinterpret_cast<char *>(&c.current.lo), 8));
+	};
+	for (std::size_t i = 0; i < runs_.size(); ++i)
+	{
+		cursors[i].in.open(runs_[i].path, std::ios::binary);
+		advance(cursors[i]);
+	}
+
+	// Min-heap of the cursors by their current key.
+	auto later = [&cursors](std::size_t a, std::size_t b)
+	{ return cursors[b].current < cursors[a].current; };
+	std::vector<std::size_t> heap;
+	for (std::size_t i = 0; i < cursors.size(); ++i)
+		if (cursors[i].valid)
+			heap.push_back(i);
+	std::make_heap(heap.begin(), heap.end(), later);
+
+	std::size_t merged = runs_.size();
+	writeRun([&](Key &k)
+			 {
+		if (heap.empty())
+			return false;
+		std::pop_heap(heap.begin(), heap.end(), later);
+		Cursor &c = cursors[heap.back()];
+		k = c.current;
+		advance(c);
+		if (c.valid)
+			std::push_heap(heap.begin(), heap.end(), later);
+		else
+			heap.pop_back();
+		return true; });
+	cursors.clear();
+
+	for (std::size_t i = 0; i < merged; ++i)
+	{
+		::close(runs_[i].fd);
+		std::remove(runs_[i].path.c_str());
+	}
+	runs_.erase(runs_.begin(), runs_.begin() + static_cast<std::ptrdiff_t>(merged));
+}
+
+// ScalableBloomFilter
+
+ScalableBloomFilter::ScalableBloomFilter(double errorRate, std::size_t initialCapacity)
+		: errorRate_(errorRate), initialCapacity_(initialCapacity)
+{
+	clear();
+}
+
+void ScalableBloomFilter::clear()
+{
+	filters_.clear();
+	addFilter();
+}
+
+void ScalableBloomFilter::addFilter()
+{
+	// Tightening ratio 0.5: the error bounds form a geometric series that
+	// sums to errorRate_.
+	Filter f;
+	f.capacity = initialCapacity_ << filters_.size();
+	f.errorRate = errorRate_ * 0.5 / std::pow(2.0, static_cast<double>(filters_.size()));
+	double ln2 = std::log(2.0);
+	f.nbits = static_cast<std::size_t>(std::ceil(-static_cast<double>(f.capacity) * std::log(f.errorRate) / (ln2 * ln2)));
+	f.nbits = (f.nbits + 63) & ~std::size_t(63);
+	f.hashes = std::max(1, static_cast<int>(std::ceil(-std::log2(f.errorRate))));
+	f.bits.assign(f.nbits / 64, 0);
+	filters_.push_back(std::move(f));
+}
+
+bool ScalableBloomFilter::test(const Filter &f, std::uint64_t h1, std::uint64_t h2)
+{
+	for (int i = 0; i < f.hashes; ++i)
+	{
+		std::uint64_t bit = (h1 + static_cast<std::uint64_t>(i) * h2) % f.nbits;
+		if (!(f.bits[bit / 64] & (1ULL << (bit % 64))))
+			return false;
+	}
+	return true;
+}
+
+bool ScalableBloomFilter::mayContain(std::uint64_t h1, std::uint64_t h2) const
+{
+	for (const auto &f : filters_)
+		if (test(f, h1, h2))
+			return true;
+	return false;
+}
+
+void ScalableBloomFilter::add(std::uint64_t h1, std::uint64_t h2)
+{
+	if (filters_.back().count >= filters_.back().capacity)
+		addFilter();
+	Filter &f = filters_.back();
+	for (int i = 0; i < f.hashes; ++i)
+	{
+		std::uint64_t bit = (h1 + static_cast<std::uint64_t>(i) * h2) % f.nbits;
+		f.bits[bit / 64] |= 1ULL << (bit % 64);
+	}
+	++f.count;
+}
+
+std::size_t ScalableBloomFilter::memoryBytes() const
+{
+	std::size_t bytes = 0;
+	for (const auto &f : filters_)
+		bytes += f.bits.capacity() * sizeof(std::uint64_t);
+	return bytes;
+}
+
+double ScalableBloomFilter::falsePositiveRate() const
+{
+	// Per filter (1 - e^(-kn/m))^k at its current fill; the chain misses
+	// only if every filter misses.
+	double miss = 1.0;
+	for (const auto &f : filters_)
+	{
+		double fill = 1.0 - std::exp(-static_cast<double>(f.hashes) * f.count / f.nbits);
+		miss *= 1.0 - std::pow(fill, f.hashes);
+	}
+	return 1.0 - miss;
+}
+
+void ScalableBloomFilter::save(std::ostream &out) const
+{
+	writeU64(out, initialCapacity_);
+	writeU64(out, filters_.size());
+	for (const auto &f : filters_)
+	{
+		writeU64(out, f.count);
+		out.write(reinterpret_cast<const char *>(f.bits.data()), static_cast<std::streamsize>(f.bits.size() * sizeof(std::uint64_t)));
+	}
+}
+
+void ScalableBloomFilter::load(std::istream &in)
+{
+	// Filter geometry is a function of errorRate_, the initial capacity and
+	// the position in the chain, so only those, counts and bits need
+	// restoring. The saved capacity wins: the set may have been sharded
+	// differently when it was written.
+	filters_.clear();
+	std::uint64_t capacity = readU64(in);
+	if (capacity == 0)
+		throw std::runtime_error("Corrupt visited set data");
+	initialCapacity_ = static_cast<std::size_t>(capacity);
+	std::uint64_t n = readU64(in);
+	for (std::uint64_t i = 0; i < n; ++i)
+	{
+		addFilter();
+		Filter &f = filters_.back();
+		f.count = readU64(in);
+		if (!in.read(reinterpret_cast<char *>(f.bits.data()), static_cast<std::streamsize>(f.bits.size() * sizeof(std::uint64_t))))
+			throw std::runtime_error("Truncated visited set data");
+	}
+	if (filters_.empty())
+		addFilter();
+}
+
+// BloomVisitedSet
+
+BloomVisitedSet::BloomVisitedSet(std::unique_ptr<VisitedSet> exact, double errorRate, std::size_t initialCapacity)
+		: exact_(std::move(exact)), bloom_(errorRate, initialCapacity) {}
+
+bool BloomVisitedSet::insert(const std::string &url)
+{
+	std::uint64_t h1 = hash(url, bloomSeed1);
+	std::uint64_t h2 = hash(url, bloomSeed2) | 1;
+	if (!bloom_.mayContain(h1, h2))
+	{
+		bloom_.add(h1, h2);
+		exact_->add(url);
+		return true;
+	}
+	return exact_->insert(url);
+}
+
+bool BloomVisitedSet::contains(const std::string &url) const
+{
+	std::uint64_t h1 = hash(url, bloomSeed1);
+	std::uint64_t h2 = hash(url, bloomSeed2) | 1;
+	return bloom_.mayContain(h1, h2) && exact_->contains(url);
+}
+
+void BloomVisitedSet::clear()
+{
+	exact_->clear();
+	bloom_.clear();
+}
+
+std::size_t BloomVisitedSet::size() const
+{
+	return exact_->size();
+}
+
+VisitedSet::Stats BloomVisitedSet::stats() const
+{
+	Stats s = exact_->stats();
+	s.memoryBytes += bloom_.memoryBytes();
+	return s;
+}
+
+void BloomVisitedSet::save(std::ostream &out, const std::string &runDir) const
+{
+	exact_->save(out, runDir);
+	bloom_.save(out);
+}
+
+void BloomVisitedSet::load(std::istream &in, const std::string &runDir)
+{
+	exact_->load(in, runDir);
+	bloom_.load(in);
+}
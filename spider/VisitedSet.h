@@ -0,0 +1,227 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <functional>
+#include <cstddef>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <iosfwd>
+
+struct VisitedSetOptions
+{
+	// Independently locked shards, selected by URL hash (ShardedVisitedSet).
+	int shards = 64;
+	// "strings" keeps full URLs; "fingerprint64"/"fingerprint128" keep hashes.
+	std::string backend = "fingerprint64";
+	// Scalable Bloom filter consulted before the exact set.
+	bool bloom = false;
+	double bloomErrorRate = 0.001;
+	std::size_t bloomCapacity = 1 << 20; // URLs the first filter is sized for, shared by the shards
+	// Directory for sorted fingerprint runs; empty keeps everything in memory.
+	std::string spillDir;
+	std::size_t spillThreshold = 4 * 1024 * 1024; // fingerprints held in memory before a spill
+};
+
+// Set of URLs the spider has already queued. Implementations are not
+// synchronized; callers hold their own lock.
+class VisitedSet
+{
+public:
+	struct Stats
+	{
+		std::size_t count = 0;
+		std::size_t memoryBytes = 0;
+		std::size_t diskBytes = 0;
+		// Probability that a URL never seen is reported as visited.
+		double falsePositiveRate = 0;
+	};
+
+	virtual ~VisitedSet() = default;
+
+	// True if the URL was not in the set before the call.
+	virtual bool insert(const std::string &url) = 0;
+	virtual bool contains(const std::string &url) const = 0;
+	virtual void clear() = 0;
+	virtual std::size_t size() const = 0;
+	virtual Stats stats() const = 0;
+
+	// Inserts a URL the caller knows is absent (a Bloom filter said so),
+	// skipping the membership probe.
+	virtual void add(const std::string &url) { insert(url); }
+
+	// Binary serialization for crawl checkpoints; load() replaces the
+	// contents. Fingerprints spilled to disk are not copied into out: their
+	// run files are hard-linked into runDir (copied across file systems)
+	// and only named in out, so load() needs the same runDir.
+	virtual void save(std::ostream &out, const std::string &runDir) const = 0;
+	virtual void load(std::istream &in, const std::string &runDir) = 0;
+
+	static std::unique_ptr<VisitedSet> create(const VisitedSetOptions &options);
+	static std::uint64_t hash(const std::string &url, std::uint64_t seed = 0);
+};
+
+// The original representation: every URL stored as a std::string node.
+class StringVisitedSet : public VisitedSet
+{
+public:
+	bool insert(const std::string &url) override;
+	bool contains(const std::string &url) const override;
+	void clear() override;
+	std::size_t size() const override;
+	Stats stats() const override;
+	void save(std::ostream &out, const std::string &runDir) const override;
+	void load(std::istream &in, const std::string &runDir) override;
+
+private:
+	std::unordered_set<std::string> urls_;
+};
+
+// Open-addressing table of 64- or 128-bit URL fingerprints (8 or 16 bytes
+// per slot, linear probing, load factor <= 0.7). With a spill directory
+// the table is sorted and written out as a run file whenever it reaches
+// the threshold; lookups then also binary-search the runs on disk.
+class FingerprintVisitedSet : public VisitedSet
+{
+public:
+	FingerprintVisitedSet(bool wide, const std::string &spillDir, std::size_t spillThreshold);
+	~FingerprintVisitedSet() override;
+
+	bool insert(const std::string &url) override;
+	bool contains(const std::string &url) const override;
+	void clear() override;
+	std::size_t size() const override;
+	Stats stats() const override;
+	void add(const std::string &url) override;
+	void save(std::ostream &out, const std::string &runDir) const override;
+	void load(std::istream &in, const std::string &runDir) override;
+
+private:
+	struct Key
+	{
+		std::uint64_t hi;
+		std::uint64_t lo;
+		bool operator==(const Key &o) const { return hi == o.hi && lo == o.lo; }
+		bool operator<(const Key &o) const { return hi < o.hi || (hi == o.hi && lo < o.lo); }
+	};
+
+	struct Run
+	{
+		std::string path;
+		int fd = -1;
+		std::size_t count = 0;
+		std::vector<Key> sparse; // every sparseStep-th key, for narrowing the search
+	};
+
+	bool wide_;
+	std::string spillDir_;
+	std::size_t spillThreshold_;
+	std::vector<std::uint64_t> slots_; // wide_: two words per slot
+	std::size_t mask_ = 0;
+	std::size_t used_ = 0;
+	std::size_t total_ = 0;
+	std::vector<Run> runs_;
+	int spillSeq_ = 0;
+
+	Key key(const std::string &url) const;
+	std::string nextRunPath();
+	void addKey(const Key &k);
+	bool tableFind(const Key &k, std::size_t &slot) const;
+	void tablePut(const Key &k);
+	void grow();
+	void spill();
+	void mergeRuns();
+	bool runContains(const Run &run, const Key &k) const;
+	// Writes the keys next() yields, ascending, as a new run; next() returns
+	// false when there are no more.
+	void writeRun(const std::function<bool(Key &)> &next);
+	// Adopts an existing run file of count keys at path.
+	void openRun(const std::string &path, std::size_t count);
+	void closeRuns();
+};
+
+// Scalable Bloom filter (Almeida et al.): a chain of filters, each twice
+// as large as the previous with a tighter error bound, so the compound
+// false-positive rate stays below the target however many URLs arrive.
+class ScalableBloomFilter
+{
+public:
+	explicit ScalableBloomFilter(double errorRate, std::size_t initialCapacity = 1 << 20);
+
+	// True if the key may have been added before.
+	bool mayContain(std::uint64_t h1, std::uint64_t h2) const;
+	void add(std::uint64_t h1, std::uint64_t h2);
+	void clear();
+
+	std::size_t memoryBytes() const;
+	double falsePositiveRate() const;
+
+	void save(std::ostream &out) const;
+	void load(std::istream &in);
+
+private:
+	struct Filter
+	{
+		std::vector<std::uint64_t> bits;
+		std::size_t nbits;
+		int hashes;
+		std::size_t capacity;
+		std::size_t count = 0;
+		double errorRate;
+	};
+
+	double errorRate_;
+	std::size_t initialCapacity_;
+	std::vector<Filter> filters_;
+
+	void addFilter();
+	static bool test(const Filter &f, std::uint64_t h1, std::uint64_t h2);
+};
+
+// Bloom layer in front of an exact set: URLs the filter has never seen
+// skip the exact lookup, which matters once the exact set is on disk.
+class BloomVisitedSet : public VisitedSet
+{
+public:
+	BloomVisitedSet(std::unique_ptr<VisitedSet> exact, double errorRate, std::size_t initialCapacity = 1 << 20);
+
+	bool insert(const std::string &url) override;
+	bool contains(const std::string &url) const override;
+	void clear() override;
+	std::size_t size() const override;
+	Stats stats() const override;
+	void save(std::ostream &out, const std::string &runDir) const override;
+	void load(std::istream &in, const std::string &runDir) override;
+
+private:
+	std::unique_ptr<VisitedSet> exact_;
+	ScalableBloomFilter bloom_;
+};
+
+// Thread-safe set of N independently locked shards of the configured
+// backend, so concurrent workers rarely contend on the same lock.
+class ShardedVisitedSet : public VisitedSet
+{
+public:
+	explicit ShardedVisitedSet(const VisitedSetOptions &options);
+
+	bool insert(const std::string &url) override;
+	bool contains(const std::string &url) const override;
+	void clear() override;
+	std::size_t size() const override;
+	Stats stats() const override;
+	void save(std::ostream &out, const std::string &runDir) const override;
+	void load(std::istream &in, const std::string &runDir) override;
+
+private:
+	struct alignas(64) Shard
+	{
+		mutable std::mutex mtx;
+		std::unique_ptr<VisitedSet> set;
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards_;
+
+	Shard &shardFor(const std::string &url) const;
+};
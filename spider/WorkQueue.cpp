@@ -0,0 +1,103 @@
+#include "WorkQueue.h"
+
+WorkQueue::WorkQueue(int workers)
+{
+	if (workers < 1)
+		workers = 1;
+	lanes_.reserve(workers);
+	for (int i = 0; i < workers; ++i)
+		lanes_.push_back(std::make_unique<Lane>());
+}
+
+void WorkQueue::push(int worker, CrawlTask task)
+{
+	std::size_t lane = worker >= 0 ? static_cast<std::size_t>(worker) % lanes_.size()
+																 : next_.fetch_add(1, std::memory_order_relaxed) % lanes_.size();
+	{
+		std::lock_guard<std::mutex> lk(lanes_[lane]->mtx);
+		lanes_[lane]->tasks.push_back(std::move(task));
+	}
+	// seq_cst on both sides (here and in pop) so a worker going to sleep
+	// either sees this task or is seen as a sleeper.
+	size_.fetch_add(1);
+
+	if (sleepers_.load() > 0)
+	{
+		std::lock_guard<std::mutex> lk(idleMtx_);
+		idleCv_.notify_one();
+	}
+}
+
+bool WorkQueue::tryPop(int worker, CrawlTask &task)
+{
+	if (size_.load(std::memory_order_acquire) == 0)
+		return false;
+
+	std::size_t n = lanes_.size();
+	std::size_t own = worker >= 0 ? static_cast<std::size_t>(worker) % n : 0;
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		Lane &lane = *lanes_[(own + i) % n];
+		std::lock_guard<std::mutex> lk(lane.mtx);
+		if (lane.tasks.empty())
+			continue;
+		if (i == 0)
+		{
+			task = std::move(lane.tasks.front());
+			lane.tasks.pop_front();
+		}
+		else
+		{
+			task = std::move(lane.tasks.back());
+			lane.tasks.pop_back();
+			steals_.fetch_add(1, std::memory_order_relaxed);
+		}
+		size_.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+bool WorkQueue::pop(int worker, CrawlTask &task, const std::atomic<bool> &stop)
+{
+	while (!stop)
+	{
+		if (tryPop(worker, task))
+			return true;
+
+		std::unique_lock<std::mutex> lk(idleMtx_);
+		sleepers_.fetch_add(1);
+		idleCv_.wait(lk, [&]
+								 { return stop || size_.load() > 0; });
+		sleepers_.fetch_sub(1);
+	}
+	return false;
+}
+
+void WorkQueue::wakeAll()
+{
+	std::lock_guard<std::mutex> lk(idleMtx_);
+	idleCv_.notify_all();
+}
+
+std::vector<CrawlTask> WorkQueue::snapshot() const
+{
+	std::vector<CrawlTask> tasks;
+	tasks.reserve(size());
+	for (const auto &lane : lanes_)
+	{
+		std::lock_guard<std::mutex> lk(lane->mtx);
+		tasks.insert(tasks.end(), lane->tasks.begin(), lane->tasks.end());
+	}
+	return tasks;
+}
+
+void WorkQueue::clear()
+{
+	for (auto &lane : lanes_)
+	{
+		std::lock_guard<std::mutex> lk(lane->mtx);
+		size_.fetch_sub(lane->tasks.size(), std::memory_order_relaxed);
+		lane->tasks.clear();
+	}
+}
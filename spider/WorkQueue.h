@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+struct CrawlTask
+{
+	std::string url;
+	int depth;
+};
+
+// Crawl frontier split into one lane per worker. A worker pushes the links
+// it extracts onto its own lane and pops from its front, so in the common
+// case it only touches its own lock. An idle worker steals from the back of
+// another lane. Pushes from outside the pool are spread round-robin.
+class WorkQueue
+{
+public:
+	explicit WorkQueue(int workers);
+
+	// worker < 0: not called from a pool thread.
+	void push(int worker, CrawlTask task);
+	// Own lane first, then steal; false if every lane is empty.
+	bool tryPop(int worker, CrawlTask &task);
+	// Blocks until a task is available or stop is set; the caller must
+	// call wakeAll() after setting stop.
+	bool pop(int worker, CrawlTask &task, const std::atomic<bool> &stop);
+	void wakeAll();
+
+	std::size_t size() const { return size_.load(std::memory_order_relaxed); }
+	bool empty() const { return size() == 0; }
+	// Copies all queued tasks (for checkpoints); lanes are locked one at a time.
+	std::vector<CrawlTask> snapshot() const;
+	void clear();
+
+	std::uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+	struct alignas(64) Lane
+	{
+		mutable std::mutex mtx;
+		std::deque<CrawlTask> tasks;
+	};
+
+	std::vector<std::unique_ptr<Lane>> lanes_;
+	std::atomic<std::size_t> size_{0};
+	std::atomic<unsigned> next_{0};
+	std::atomic<std::uint64_t> steals_{0};
+
+	std::mutex idleMtx_;
+	std::condition_variable idleCv_;
+	std::atomic<int> sleepers_{0};
+};